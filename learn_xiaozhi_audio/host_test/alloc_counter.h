@@ -0,0 +1,44 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+// Replaces the global operator new/delete of the executable with counting ones.
+// Include it from exactly one file per executable.
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace AllocCounter {
+inline std::atomic<uint64_t> allocations{0};
+inline std::atomic<int64_t> live_bytes{0};
+// Room in front of every block for its size, keeps the max_align_t alignment
+constexpr size_t kHeader = alignof(std::max_align_t);
+}
+
+void* operator new(size_t size) {
+    auto block = static_cast<unsigned char*>(malloc(size + AllocCounter::kHeader));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<size_t*>(block) = size;
+    AllocCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+    AllocCounter::live_bytes.fetch_add(size, std::memory_order_relaxed);
+    return block + AllocCounter::kHeader;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto block = static_cast<unsigned char*>(ptr) - AllocCounter::kHeader;
+    AllocCounter::live_bytes.fetch_sub(*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+    free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* ptr) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { operator delete(ptr); }
+
+#endif // ALLOC_COUNTER_H
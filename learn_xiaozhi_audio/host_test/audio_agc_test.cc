@@ -0,0 +1,200 @@
+// AudioAgc on sine sweeps at several input levels, in the 30 ms frames NoAudioCodec reads.
+// Levels are in dBFS of the old fixed 12-bit shift. Checks where the gain settles, that
+// clipping stops within the first frames, that the reference channel passes unchanged,
+// and that Process() never allocates; then compares its cost with the plain shift.
+#include "alloc_counter.h"
+#include "audio_agc.h"
+#include "audio_kernels.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define FRAME_SAMPLES (SAMPLE_RATE / 1000 * 30)
+// Long enough for the slowest case, a 24 dB release at about 0.07 dB per frame
+#define SECONDS 20
+#define FRAMES (SECONDS * SAMPLE_RATE / FRAME_SAMPLES)
+#define SHIFT 12
+// Frames after which no sample may clip any more
+#define SETTLE_FRAMES 10
+
+// Keeps the benchmark loops from being optimized away
+static volatile int16_t sink;
+
+enum Expect {
+    // Output peak within 1 dB below the -6 dBFS target
+    kOnTarget,
+    // Too quiet for the target, the gain stops at the maximum
+    kMaxGain,
+    // Below the noise floor, the gain never moves
+    kUnity,
+};
+
+struct Level {
+    double dbfs;
+    Expect expect;
+};
+
+static double ToDb(double value, double reference) {
+    return 20 * log10(std::max(value, 1e-9) / reference);
+}
+
+// One tone frame per channel, the channels at different frequencies; 16-bit samples are
+// returned when out16 is set, else 32-bit I2S slots
+static void MakeFrame(int frame, double dbfs, int channels, int32_t* out32, int16_t* out16) {
+    double amplitude = 32767 * pow(10, dbfs / 20);
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+        double t = (double)(frame * FRAME_SAMPLES + i) / SAMPLE_RATE;
+        for (int c = 0; c < channels; c++) {
+            double value = amplitude * sin(2 * M_PI * (440 + 110 * c) * t);
+            if (out16 != nullptr) {
+                out16[i * channels + c] = (int16_t)std::max(-32767.0, std::min(32767.0, value));
+            } else {
+                out32[i * channels + c] = (int32_t)lround(value * (1 << SHIFT));
+            }
+        }
+    }
+}
+
+// The 32-bit path of NoAudioCodec::Read(), or the 16-bit one of the PDM codec
+static bool Sweep(const Level& level, bool pdm) {
+    AudioAgc agc;
+    std::vector<int32_t> in(FRAME_SAMPLES);
+    std::vector<int16_t> out(FRAME_SAMPLES);
+    uint32_t clipped_late = 0;
+    int32_t peak = 0;
+    uint64_t allocations = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        MakeFrame(frame, level.dbfs, 1, in.data(), pdm ? out.data() : nullptr);
+        uint32_t clipped = agc.clipped();
+        uint64_t before = AllocCounter::allocations.load();
+        if (pdm) {
+            agc.Process(out.data(), 1, false, FRAME_SAMPLES);
+        } else {
+            agc.Process(in.data(), 1, nullptr, out.data(), FRAME_SAMPLES, SHIFT);
+        }
+        allocations += AllocCounter::allocations.load() - before;
+        if (frame >= SETTLE_FRAMES) {
+            clipped_late += agc.clipped() - clipped;
+        }
+        // The peak of the last second
+        if (frame >= FRAMES - SAMPLE_RATE / FRAME_SAMPLES) {
+            for (auto sample : out) {
+                peak = std::max<int32_t>(peak, std::abs(sample));
+            }
+        }
+    }
+
+    double peak_db = ToDb(peak, 32767);
+    double gain_db = ToDb(agc.gain(), AudioAgc::kUnityGain);
+    bool settled;
+    const char* expected;
+    switch (level.expect) {
+    case kOnTarget:
+        settled = peak_db <= ToDb(16384, 32767) + 0.01 && peak_db >= ToDb(16384, 32767) - 1;
+        expected = "-6 dBFS peak";
+        break;
+    case kMaxGain:
+        settled = agc.gain() == AudioAgc::Config().max_gain;
+        expected = "max gain";
+        break;
+    default:
+        settled = agc.gain() == AudioAgc::kUnityGain;
+        expected = "unity gain";
+        break;
+    }
+    bool ok = settled && clipped_late == 0 && allocations == 0;
+    printf("%s %+4.0f dBFS: gain %+6.2f dB, peak %6.2f dBFS (%s), %u clipped after frame %d, "
+        "%llu allocations %s\n", pdm ? "16-bit" : "32-bit", level.dbfs, gain_db, peak_db, expected,
+        clipped_late, SETTLE_FRAMES, (unsigned long long)allocations, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Two microphones and a reference: the microphones share the gain, the reference is copied
+static bool Reference() {
+    AudioAgc agc;
+    std::vector<int32_t> in(FRAME_SAMPLES * 2);
+    std::vector<int16_t> reference(FRAME_SAMPLES);
+    std::vector<int16_t> out(FRAME_SAMPLES * 3);
+    bool ok = true;
+    for (int frame = 0; frame < 100; frame++) {
+        MakeFrame(frame, 6, 2, in.data(), nullptr);
+        MakeFrame(frame, -3, 1, nullptr, reference.data());
+        agc.Process(in.data(), 2, reference.data(), out.data(), FRAME_SAMPLES, SHIFT);
+        for (int i = 0; i < FRAME_SAMPLES; i++) {
+            ok = ok && out[i * 3 + 2] == reference[i];
+        }
+    }
+    printf("Reference channel passed unchanged with two microphones at +6 dBFS: %s\n", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// ns per sample of the AGC against the shift it replaces, at a level that keeps it limiting
+static void Benchmark() {
+    std::vector<int32_t> in(FRAME_SAMPLES);
+    std::vector<int16_t> in16(FRAME_SAMPLES);
+    std::vector<int16_t> out(FRAME_SAMPLES);
+    MakeFrame(0, 0, 1, in.data(), nullptr);
+    MakeFrame(0, 0, 1, nullptr, in16.data());
+    const int rounds = 20000;
+    AudioAgc agc;
+    AudioAgc agc16;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        agc.Process(in.data(), 1, nullptr, out.data(), FRAME_SAMPLES, SHIFT);
+        sink = out[r % FRAME_SAMPLES];
+    }
+    auto agc_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        std::copy(in16.begin(), in16.end(), out.begin());
+        agc16.Process(out.data(), 1, false, FRAME_SAMPLES);
+        sink = out[r % FRAME_SAMPLES];
+    }
+    auto agc16_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        AudioKernels::ShiftToInt16(in.data(), out.data(), FRAME_SAMPLES, SHIFT);
+        sink = out[r % FRAME_SAMPLES];
+    }
+    auto shift_time = std::chrono::steady_clock::now() - start;
+
+    double samples = (double)rounds * FRAME_SAMPLES;
+    auto ns = [samples](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::nano>(d).count() / samples;
+    };
+    printf("32-bit AGC %.2f ns/sample, 16-bit AGC (with copy) %.2f ns/sample, ShiftToInt16 %.2f ns/sample; "
+        "%.4f%% of a core at %d Hz\n", ns(agc_time), ns(agc16_time), ns(shift_time),
+        ns(agc_time) * SAMPLE_RATE / 1e7, SAMPLE_RATE);
+}
+
+int main() {
+    const Level levels[] = {
+        {-60, kUnity},
+        {-40, kMaxGain},
+        {-20, kOnTarget},
+        {-10, kOnTarget},
+        {-6, kOnTarget},
+        {0, kOnTarget},
+        {6, kOnTarget},
+        {12, kOnTarget},
+    };
+    bool ok = true;
+    for (auto& level : levels) {
+        ok = Sweep(level, false) && ok;
+    }
+    // 16-bit samples cannot go above full scale
+    for (auto& level : levels) {
+        if (level.dbfs <= 0) {
+            ok = Sweep(level, true) && ok;
+        }
+    }
+    ok = Reference() && ok;
+    Benchmark();
+    return ok ? 0 : 1;
+}
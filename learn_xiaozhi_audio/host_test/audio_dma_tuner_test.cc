@@ -0,0 +1,212 @@
+// AudioDmaTuner boot after boot, on the in-memory Settings of host_settings.cc and with
+// Measure() replaced by a simulation of the TX DMA ring. Every boot builds a new codec from
+// the stored geometry and a new tuner, like the device does, so the sweep only goes on
+// through Settings. Checks Result::IsBetterThan(), that the candidates are measured in
+// order, that a boot dying in the middle of a measurement repeats that candidate, that
+// the sweep keeps the best candidate of the simulation and then stays off.
+#include "audio_dma_tuner.h"
+#include "settings.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define TUNE_MS 5000
+// Wake-up and copy cost of a pipeline task for every DMA buffer it handles
+#define BUFFER_COST_US 1200
+// The TX task is held up for one of these every STALL_INTERVAL_MS, in turn
+#define STALL_INTERVAL_MS 700
+static const int kStallsMs[] = {20, 35, 50};
+
+struct Geometry {
+    int desc_num;
+    int frame_num;
+
+    bool operator==(const Geometry& other) const {
+        return desc_num == other.desc_num && frame_num == other.frame_num;
+    }
+};
+
+// The table of audio_dma_tuner.cc, in its order
+static const std::vector<Geometry> kCandidates = {
+    {3, 240}, {4, 240}, {6, 240}, {8, 240},
+    {4, 120}, {6, 120}, {8, 120},
+    {2, 480}, {4, 480},
+};
+
+// The DMA sends a buffer every frame_num samples, the TX task tops the ring up after every
+// send unless it is stalled. A send that finds the ring empty is an underrun.
+static AudioDmaTuner::Result Simulate(const Geometry& geometry) {
+    const int64_t buffer_us = (int64_t)geometry.frame_num * 1000000 / SAMPLE_RATE;
+    const int64_t interval_us = STALL_INTERVAL_MS * 1000;
+    int queued = geometry.desc_num;
+    AudioDmaTuner::Result result = {};
+    for (int64_t t = buffer_us; t < TUNE_MS * 1000; t += buffer_us) {
+        if (queued == 0) {
+            result.underruns++;
+        } else {
+            queued--;
+        }
+        int64_t stall_us = kStallsMs[t / interval_us % 3] * 1000;
+        if (t % interval_us >= stall_us) {
+            queued = geometry.desc_num;
+        }
+    }
+    // Both directions, in us per ms
+    result.cpu_permille = 2 * BUFFER_COST_US * 1000 / buffer_us;
+    // A click waits behind the TX queue, which Measure() keeps full, and the ring, and
+    // reaches the microphone with the next RX buffer
+    result.latency_ms = (AUDIO_CODEC_TX_QUEUE_FRAMES + geometry.desc_num + 1) * buffer_us / 1000;
+    return result;
+}
+
+// Takes its geometry from Settings("audio") like AudioCodec does, there is no I2S behind it
+class SimCodec : public AudioCodec {
+public:
+    SimCodec() {
+        Settings settings("audio", false);
+        dma_desc_num_ = settings.GetInt("dma_desc_num", AUDIO_CODEC_DMA_DESC_NUM);
+        dma_frame_num_ = settings.GetInt("dma_frame_num", AUDIO_CODEC_DMA_FRAME_NUM);
+        output_sample_rate_ = SAMPLE_RATE;
+        input_sample_rate_ = SAMPLE_RATE;
+    }
+
+private:
+    virtual int Read(int16_t*, int) override { return 0; }
+    virtual int Write(const int16_t*, int samples) override { return samples; }
+};
+
+struct PowerLoss : std::runtime_error {
+    PowerLoss() : std::runtime_error("power lost") {}
+};
+
+class SimTuner : public AudioDmaTuner {
+public:
+    SimTuner(AudioCodec* codec, std::vector<Geometry>& measured, bool lose_power)
+        : AudioDmaTuner(codec), measured_(measured), lose_power_(lose_power) {}
+
+protected:
+    virtual Result Measure() override {
+        Geometry geometry = {codec_->dma_desc_num(), codec_->dma_frame_num()};
+        measured_.push_back(geometry);
+        if (lose_power_) {
+            throw PowerLoss();
+        }
+        return Simulate(geometry);
+    }
+
+private:
+    std::vector<Geometry>& measured_;
+    bool lose_power_;
+};
+
+enum BootResult {
+    kRebootRequested,
+    kRunning,
+    kPowerLost,
+};
+
+static BootResult Boot(std::vector<Geometry>& measured, bool lose_power = false) {
+    SimCodec codec;
+    SimTuner tuner(&codec, measured, lose_power);
+    try {
+        return tuner.Run() ? kRebootRequested : kRunning;
+    } catch (const PowerLoss&) {
+        return kPowerLost;
+    }
+}
+
+static Geometry StoredGeometry() {
+    Settings settings("audio", false);
+    return {settings.GetInt("dma_desc_num", -1), settings.GetInt("dma_frame_num", -1)};
+}
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+static bool Ordering() {
+    using Result = AudioDmaTuner::Result;
+    struct {
+        Result better;
+        Result worse;
+        const char* what;
+    } cases[] = {
+        {{0, 900, 900}, {1, 10, 10}, "fewer underruns win over everything else"},
+        {{2, 290, 400}, {2, 310, 100}, "then staying within the CPU limit"},
+        {{2, 400, 100}, {2, 310, 120}, "then, both over the limit, the lower latency"},
+        {{0, 200, 100}, {0, 100, 120}, "then, both within the limit, the lower latency"},
+        {{0, 100, 100}, {0, 200, 100}, "and at equal latency the lower CPU load"},
+    };
+    bool ok = true;
+    for (auto& c : cases) {
+        ok = Check(c.better.IsBetterThan(c.worse) && !c.worse.IsBetterThan(c.better), c.what) && ok;
+    }
+    Result same = {1, 100, 100};
+    ok = Check(!same.IsBetterThan(same), "no result is better than itself") && ok;
+    return ok;
+}
+
+static bool Sweep() {
+    bool ok = true;
+    std::vector<Geometry> measured;
+    const size_t lost_at = 4;
+
+    // The first boot only selects the first candidate
+    ok = Check(Boot(measured) == kRebootRequested && measured.empty() && StoredGeometry() == kCandidates[0],
+        "the first boot selects the first candidate without measuring") && ok;
+    bool lost = false;
+    BootResult result;
+    for (int boots = 1; boots < 100; boots++) {
+        bool lose_power = !lost && measured.size() == lost_at;
+        result = Boot(measured, lose_power);
+        lost = lost || lose_power;
+        if (result == kRunning) {
+            break;
+        }
+    }
+
+    std::vector<Geometry> expected = kCandidates;
+    expected.insert(expected.begin() + lost_at, kCandidates[lost_at]);
+    ok = Check(measured == expected, "every candidate measured in order, the interrupted one twice") && ok;
+
+    // The best of the simulation, by the tuner's own ordering
+    size_t best = 0;
+    for (size_t i = 1; i < kCandidates.size(); i++) {
+        if (Simulate(kCandidates[i]).IsBetterThan(Simulate(kCandidates[best]))) {
+            best = i;
+        }
+    }
+    for (size_t i = 0; i < kCandidates.size(); i++) {
+        auto r = Simulate(kCandidates[i]);
+        printf("  %d x %3d: %4u underruns, cpu %5.1f%%, latency %3d ms%s\n", kCandidates[i].desc_num,
+            kCandidates[i].frame_num, (unsigned)r.underruns, r.cpu_permille / 10.0, r.latency_ms,
+            i == best ? "  <- best" : "");
+    }
+    ok = Check(StoredGeometry() == kCandidates[best], "the sweep ends on the best candidate") && ok;
+    ok = Check(best != 0 && best != kCandidates.size() - 1, "which is neither the first nor the last one") && ok;
+
+    size_t count = measured.size();
+    ok = Check(result == kRunning && Boot(measured) == kRunning && measured.size() == count,
+        "later boots neither measure nor reboot") && ok;
+
+    // A step beyond the table, e.g. after an update shortened it, ends the sweep
+    {
+        Settings settings("audio", true);
+        settings.SetInt("dma_tuned", 0);
+        settings.SetInt("dma_tune_step", (int)kCandidates.size());
+    }
+    ok = Check(Boot(measured) == kRunning && measured.size() == count &&
+        Settings("audio").GetInt("dma_tune_step", -1) == -1, "a step past the last candidate stops the sweep") && ok;
+    ok = Check(Boot(measured) == kRebootRequested && StoredGeometry() == kCandidates[0],
+        "and the next boot starts it over") && ok;
+    return ok;
+}
+
+int main() {
+    bool ok = Ordering();
+    ok = Sweep() && ok;
+    return ok ? 0 : 1;
+}
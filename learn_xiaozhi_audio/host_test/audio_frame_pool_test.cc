@@ -0,0 +1,154 @@
+// AudioFramePool under sustained load, the way AfeAudioProcessor hands out frames: a fetch
+// thread fills pooled frames and shares some with a second consumer, two consumer threads
+// hold them for a while and release them. Checks that every buffer comes back, that frames
+// keep their contents while held, and that a retired pool lives until its last frame is released.
+#include "alloc_counter.h"
+#include "audio_frame.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define FRAME_COUNT 8
+#define FRAME_SAMPLES 512
+#define FRAMES 200000
+
+// A consumer task with its input queue; it keeps up to `hold` frames before releasing the oldest
+class Consumer {
+public:
+    Consumer(size_t hold) : hold_(hold), thread_(&Consumer::Run, this) {}
+
+    void Push(AudioFrame&& frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(frame));
+        cv_.notify_one();
+    }
+
+    void Finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+            cv_.notify_one();
+        }
+        thread_.join();
+    }
+
+    uint64_t received() const { return received_; }
+    uint64_t corrupted() const { return corrupted_; }
+
+private:
+    size_t hold_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<AudioFrame> queue_;
+    bool finished_ = false;
+    uint64_t received_ = 0;
+    uint64_t corrupted_ = 0;
+    std::thread thread_;
+
+    void Run() {
+        std::deque<AudioFrame> held;
+        while (true) {
+            AudioFrame frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return finished_ || !queue_.empty(); });
+                if (queue_.empty()) {
+                    break;
+                }
+                frame = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            received_++;
+            held.push_back(std::move(frame));
+            if (held.size() > hold_) {
+                Check(held.front());
+                held.pop_front();
+            }
+        }
+        for (auto& frame : held) {
+            Check(frame);
+        }
+    }
+
+    // Every sample of a frame carries its sequence number, an early reuse of the buffer breaks it
+    void Check(const AudioFrame& frame) {
+        for (size_t i = 1; i < frame.size(); i++) {
+            if (frame.data()[i] != frame.data()[0]) {
+                corrupted_++;
+                return;
+            }
+        }
+    }
+};
+
+static bool SustainedLoad() {
+    auto pool = new AudioFramePool(FRAME_COUNT, FRAME_SAMPLES);
+    Consumer recorder(3);
+    Consumer detector(1);
+    uint64_t delivered = 0;
+    uint64_t shared = 0;
+    uint64_t dropped = 0;
+    for (int i = 0; i < FRAMES; i++) {
+        AudioFrame frame = pool->Acquire(FRAME_SAMPLES);
+        if (!frame) {
+            // The consumers hold every frame, AfeAudioProcessor drops the fetch
+            dropped++;
+            std::this_thread::yield();
+            continue;
+        }
+        std::fill(frame.data(), frame.data() + frame.size(), (int16_t)i);
+        if (i % 4 == 0) {
+            detector.Push(frame.Share());
+            shared++;
+        }
+        recorder.Push(std::move(frame));
+        delivered++;
+    }
+    recorder.Finish();
+    detector.Finish();
+
+    int in_use = pool->in_use();
+    bool ok = in_use == 0 && recorder.received() == delivered && detector.received() == shared &&
+        recorder.corrupted() == 0 && detector.corrupted() == 0 && pool->exhausted() == dropped;
+    printf("Sustained load: %llu frames delivered, %llu shared, %llu dropped (%u exhausted), "
+        "%llu corrupted, %d in use: %s\n", (unsigned long long)delivered, (unsigned long long)shared,
+        (unsigned long long)dropped, pool->exhausted(),
+        (unsigned long long)(recorder.corrupted() + detector.corrupted()), in_use, ok ? "ok" : "FAIL");
+    pool->Retire();
+    return ok;
+}
+
+// The owner goes away first, as when an audio processor is destroyed while a frame is queued
+static bool RetireWhileHeld() {
+    int64_t baseline = AllocCounter::live_bytes.load();
+    auto pool = new AudioFramePool(FRAME_COUNT, FRAME_SAMPLES);
+    AudioFrame first = pool->Acquire(FRAME_SAMPLES);
+    AudioFrame second = pool->Acquire(FRAME_SAMPLES);
+    AudioFrame shared = second.Share();
+    pool->Retire();
+
+    // Still writable and alive, the pool must not have been freed
+    std::fill(first.data(), first.data() + first.size(), 1);
+    bool alive = AllocCounter::live_bytes.load() > baseline;
+    first.Release();
+    second.Release();
+    bool alive_shared = AllocCounter::live_bytes.load() > baseline;
+    shared.Release();
+    bool freed = AllocCounter::live_bytes.load() == baseline;
+
+    bool ok = alive && alive_shared && freed;
+    printf("Retire while held: alive with frames out %s, freed with the last one %s: %s\n",
+        alive && alive_shared ? "yes" : "no", freed ? "yes" : "no", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main() {
+    bool ok = SustainedLoad();
+    ok = RetireWhileHeld() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+// The block kernels of audio_kernels.cc against their *Scalar references, which are the
+// per-sample loops NoAudioCodec had before. Built twice: audio_kernels_test with the SIMD
+// path of the host (SSE2, or NEON on ARM) and audio_kernels_test_unrolled without, which
+// takes the unrolled loops of Xtensa and RISC-V.
+//  - every length from 0 to 40 and the codec frames, from aligned and unaligned pointers,
+//    so every tail after the blocks of 4 and 8 is covered;
+//  - ApplyGain() for the volumes 0 to 100 and the gains at the edges of each path, on the
+//    int16 extremes; ShiftToInt16() for the shifts the codecs use and the values around
+//    the clip points, INT32_MIN and INT32_MAX included; ClipInt16() at its bounds;
+//  - InterleaveToInt16() for 1 to 4 channels with and without a reference, against the
+//    frame layout written out sample by sample.
+// Then ns per call of each kernel and its scalar loop for 240, 480 and 960 samples.
+#include "audio_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#if defined(__SSE2__)
+#define KERNEL_PATH "SSE2"
+#elif defined(__ARM_NEON)
+#define KERNEL_PATH "NEON"
+#else
+#define KERNEL_PATH "unrolled"
+#endif
+
+#define MAX_SAMPLES 960
+// Buffers start one element in, for the unaligned runs
+#define PAD 1
+
+// Keeps the benchmark loops from being optimized away
+static volatile int32_t sink;
+
+static uint32_t random_state = 12345;
+
+static uint32_t Random() {
+    random_state = random_state * 1664525 + 1013904223;
+    return random_state;
+}
+
+static std::vector<size_t> Lengths() {
+    std::vector<size_t> lengths;
+    for (size_t n = 0; n <= 40; n++) {
+        lengths.push_back(n);
+    }
+    for (size_t n : {239, 240, 241, 480, 959, 960}) {
+        lengths.push_back(n);
+    }
+    return lengths;
+}
+
+static bool ApplyGainMatches() {
+    std::vector<int32_t> gains;
+    for (int volume = 0; volume <= 100; volume++) {
+        gains.push_back(AudioKernels::VolumeToGain(volume));
+    }
+    // Edges of the unity, madd and scalar paths
+    for (int32_t gain : {-65536, -1, 1, 2, 32766, 32767, 32768, 65533, 65534, 65535, 65536, 65537, 131072,
+             INT32_MAX}) {
+        gains.push_back(gain);
+    }
+
+    std::vector<int16_t> in(MAX_SAMPLES + PAD);
+    std::vector<int32_t> out(MAX_SAMPLES + PAD), expected(MAX_SAMPLES + PAD);
+    // The extremes first, so that every length has some of them
+    const int16_t extremes[] = {INT16_MIN, INT16_MAX, -INT16_MAX, 0, -1, 1};
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = i < 6 ? extremes[i] : (i % 7 == 0 ? extremes[Random() % 6] : (int16_t)Random());
+    }
+
+    uint64_t mismatches = 0, runs = 0;
+    for (int32_t gain : gains) {
+        for (size_t n : Lengths()) {
+            for (size_t offset = 0; offset <= PAD; offset++) {
+                // Canaries behind the end show a kernel writing past its length
+                std::fill(out.begin(), out.end(), 0x5a5a5a5a);
+                std::fill(expected.begin(), expected.end(), 0x5a5a5a5a);
+                AudioKernels::ApplyGain(in.data() + offset, out.data() + offset, n, gain);
+                AudioKernels::ApplyGainScalar(in.data() + offset, expected.data() + offset, n, gain);
+                mismatches += out != expected;
+                runs++;
+            }
+        }
+    }
+    printf("ApplyGain    %-8s %zu gains, %6llu runs, %llu differ from the scalar loop %s\n", KERNEL_PATH,
+        gains.size(), (unsigned long long)runs, (unsigned long long)mismatches, mismatches == 0 ? "ok" : "FAIL");
+    return mismatches == 0;
+}
+
+static bool ShiftToInt16Matches() {
+    std::vector<int32_t> in(MAX_SAMPLES + PAD);
+    std::vector<int16_t> out(MAX_SAMPLES + PAD), expected(MAX_SAMPLES + PAD);
+    uint64_t mismatches = 0, runs = 0;
+    for (int shift : {0, 1, 8, 12, 14, 16, 31}) {
+        // Around the clip points after the shift, and the int32 extremes
+        std::vector<int32_t> edges = {INT32_MIN, INT32_MAX, 0, -1, 1};
+        for (int64_t value : {32766, 32767, 32768, 32769, -32766, -32767, -32768, -32769}) {
+            int64_t shifted = value * (int64_t(1) << shift);
+            if (shifted >= INT32_MIN && shifted <= INT32_MAX) {
+                edges.push_back((int32_t)shifted);
+                edges.push_back((int32_t)shifted - 1);
+                edges.push_back((int32_t)shifted + 1);
+            }
+        }
+        for (size_t i = 0; i < in.size(); i++) {
+            in[i] = i < edges.size() ? edges[i] : (i % 5 == 0 ? edges[Random() % edges.size()] : (int32_t)Random());
+        }
+        for (size_t n : Lengths()) {
+            for (size_t offset = 0; offset <= PAD; offset++) {
+                std::fill(out.begin(), out.end(), 0x5a5a);
+                std::fill(expected.begin(), expected.end(), 0x5a5a);
+                AudioKernels::ShiftToInt16(in.data() + offset, out.data() + offset, n, shift);
+                AudioKernels::ShiftToInt16Scalar(in.data() + offset, expected.data() + offset, n, shift);
+                mismatches += out != expected;
+                runs++;
+            }
+        }
+    }
+    printf("ShiftToInt16 %-8s %6llu runs, %llu differ from the scalar loop %s\n", KERNEL_PATH,
+        (unsigned long long)runs, (unsigned long long)mismatches, mismatches == 0 ? "ok" : "FAIL");
+    return mismatches == 0;
+}
+
+static bool ClipInt16Bounds() {
+    struct {
+        int32_t in;
+        int16_t out;
+    } cases[] = {
+        {0, 0}, {32766, 32766}, {32767, 32767}, {32768, 32767}, {INT32_MAX, 32767},
+        {-32766, -32766}, {-32767, -32767}, {-32768, -32767}, {INT32_MIN, -32767},
+    };
+    bool ok = true;
+    for (auto& c : cases) {
+        ok = ok && AudioKernels::ClipInt16(c.in) == c.out;
+    }
+    printf("ClipInt16 clips symmetrically to +-32767 %s\n", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Every frame is the channels in slot order, shifted and clipped, then the reference sample
+static bool InterleaveToInt16Matches() {
+    const size_t max_frames = 64;
+    std::vector<int32_t> in(max_frames * 4);
+    std::vector<int16_t> reference(max_frames);
+    std::vector<int16_t> out(max_frames * 5 + 1), expected(max_frames * 5 + 1);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = i % 9 == 0 ? (i % 2 ? INT32_MAX : INT32_MIN) : (int32_t)Random();
+    }
+    for (auto& sample : reference) {
+        sample = (int16_t)Random();
+    }
+
+    uint64_t mismatches = 0, runs = 0;
+    for (int channels = 1; channels <= 4; channels++) {
+        for (bool with_reference : {false, true}) {
+            const int16_t* ref = with_reference ? reference.data() : nullptr;
+            int stride = channels + (with_reference ? 1 : 0);
+            for (int shift : {12, 16}) {
+                for (size_t frames = 0; frames <= max_frames; frames += frames < 10 ? 1 : 9) {
+                    std::fill(out.begin(), out.end(), 0x5a5a);
+                    std::fill(expected.begin(), expected.end(), 0x5a5a);
+                    for (size_t f = 0; f < frames; f++) {
+                        for (int ch = 0; ch < channels; ch++) {
+                            expected[f * stride + ch] = AudioKernels::ClipInt16(in[f * channels + ch] >> shift);
+                        }
+                        if (ref != nullptr) {
+                            expected[f * stride + channels] = ref[f];
+                        }
+                    }
+                    AudioKernels::InterleaveToInt16(in.data(), channels, ref, out.data(), frames, shift);
+                    mismatches += out != expected;
+                    runs++;
+                }
+            }
+        }
+    }
+    printf("InterleaveToInt16 %-8s %4llu runs, %llu differ from the frame layout %s\n", KERNEL_PATH,
+        (unsigned long long)runs, (unsigned long long)mismatches, mismatches == 0 ? "ok" : "FAIL");
+    return mismatches == 0;
+}
+
+template <typename F>
+static double NsPerCall(int rounds, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        f(r);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+}
+
+static void Benchmark() {
+    std::vector<int16_t> in16(MAX_SAMPLES);
+    std::vector<int32_t> in32(MAX_SAMPLES);
+    std::vector<int32_t> out32(MAX_SAMPLES);
+    std::vector<int16_t> out16(MAX_SAMPLES);
+    for (size_t i = 0; i < MAX_SAMPLES; i++) {
+        in16[i] = (int16_t)Random();
+        in32[i] = (int32_t)Random() >> 4;
+    }
+    // The default volume of 70 and the microphone shift
+    const int32_t gain = AudioKernels::VolumeToGain(70);
+    const int shift = 12;
+    const int rounds = 200000;
+    printf("%-8s %7s %14s %14s %8s %14s %14s %8s\n", KERNEL_PATH, "samples", "gain scalar", "ApplyGain",
+        "speedup", "shift scalar", "ShiftToInt16", "speedup");
+    for (size_t n : {240, 480, 960}) {
+        double gain_scalar = NsPerCall(rounds, [&](int r) {
+            AudioKernels::ApplyGainScalar(in16.data(), out32.data(), n, gain);
+            sink = out32[r % n];
+        });
+        double gain_block = NsPerCall(rounds, [&](int r) {
+            AudioKernels::ApplyGain(in16.data(), out32.data(), n, gain);
+            sink = out32[r % n];
+        });
+        double shift_scalar = NsPerCall(rounds, [&](int r) {
+            AudioKernels::ShiftToInt16Scalar(in32.data(), out16.data(), n, shift);
+            sink = out16[r % n];
+        });
+        double shift_block = NsPerCall(rounds, [&](int r) {
+            AudioKernels::ShiftToInt16(in32.data(), out16.data(), n, shift);
+            sink = out16[r % n];
+        });
+        printf("%-8s %7zu %11.1f ns %11.1f ns %7.2fx %11.1f ns %11.1f ns %7.2fx\n", "", n, gain_scalar, gain_block,
+            gain_scalar / gain_block, shift_scalar, shift_block, shift_scalar / shift_block);
+    }
+}
+
+int main() {
+    bool ok = ApplyGainMatches();
+    ok = ShiftToInt16Matches() && ok;
+    ok = ClipInt16Bounds() && ok;
+    ok = InterleaveToInt16Matches() && ok;
+    Benchmark();
+    return ok ? 0 : 1;
+}
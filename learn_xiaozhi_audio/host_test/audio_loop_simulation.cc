@@ -0,0 +1,157 @@
+// The audio loop in virtual time, before and after it was driven by codec events.
+// The RX DMA completes a buffer of AUDIO_CODEC_DMA_FRAME_NUM samples every 15 ms, and
+// every buffer captured is handed on as one frame.
+//  - polling: the loop captures with a blocking read while the state needs input, and
+//    otherwise sleeps 30 ms before it looks at the state again;
+//  - events: the loop sleeps until notified. A state change notifies it at once; the codec
+//    notifies it for a buffer only while the event mask, set from the state after every
+//    wakeup, asks for input. Capture resumes with the first buffer after the mask is set.
+// Runs idle, wake word detection and listening phases and counts the loop wakeups in each,
+// then measures the time from a change to listening to the first captured frame for 1000
+// evenly spread phases of the change against the DMA and the poll timer.
+#include "audio_codec.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define POLL_MS 30
+#define PHASE_MS 10000
+#define LATENCY_RUNS 1000
+
+static const int64_t kBufferUs = (int64_t)AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / SAMPLE_RATE;
+
+enum LoopKind {
+    kPolling,
+    kEvents,
+};
+
+struct Phase {
+    const char* name;
+    // Whether the state needs input: listening, or wake word detection running
+    bool capturing;
+};
+
+struct Trace {
+    // Loop wakeups per phase
+    std::vector<int> wakeups;
+    // Per phase, when the first frame was captured, -1 if none
+    std::vector<int64_t> first_frame;
+};
+
+// The phases follow each other every PHASE_MS, the first one starting at start_us
+static Trace Run(LoopKind loop, const std::vector<Phase>& phases, int64_t start_us, int64_t dma_offset_us) {
+    Trace trace;
+    trace.wakeups.assign(phases.size(), 0);
+    trace.first_frame.assign(phases.size(), -1);
+    const int64_t end_us = start_us + (int64_t)phases.size() * PHASE_MS * 1000;
+    auto phase_at = [&](int64_t t) {
+        return t < start_us ? 0 : std::min<size_t>((t - start_us) / (PHASE_MS * 1000), phases.size() - 1);
+    };
+    auto next_buffer = [&](int64_t t) {
+        // The first buffer completing strictly after t
+        return t < dma_offset_us ? dma_offset_us : dma_offset_us + ((t - dma_offset_us) / kBufferUs + 1) * kBufferUs;
+    };
+    auto capture = [&](int64_t t) {
+        size_t phase = phase_at(t);
+        if (trace.first_frame[phase] < 0) {
+            trace.first_frame[phase] = t;
+        }
+    };
+
+    if (loop == kPolling) {
+        int64_t t = 0;
+        while (t < end_us) {
+            trace.wakeups[phase_at(t)]++;
+            if (phases[phase_at(t)].capturing) {
+                // Blocks in the read until the DMA completes the next buffer
+                t = next_buffer(t);
+                if (t < end_us && phases[phase_at(t)].capturing) {
+                    capture(t);
+                }
+            } else {
+                t += POLL_MS * 1000;
+            }
+        }
+        return trace;
+    }
+
+    // Notifications come from the state changes and, while the mask asks for input, the buffers
+    bool input_mask = false;
+    int64_t t = 0;
+    while (true) {
+        int64_t state_change = t < start_us ? start_us :
+            start_us + ((t - start_us) / (PHASE_MS * 1000) + 1) * PHASE_MS * 1000;
+        int64_t wake = input_mask ? std::min(next_buffer(t), state_change) : state_change;
+        if (wake >= end_us) {
+            break;
+        }
+        t = wake;
+        trace.wakeups[phase_at(t)]++;
+        if (input_mask && t != state_change) {
+            capture(t);
+        }
+        // UpdateAudioEvents()
+        input_mask = phases[phase_at(t)].capturing;
+    }
+    return trace;
+}
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+int main() {
+    bool ok = true;
+    const std::vector<Phase> phases = {
+        {"idle", false},
+        {"wake word", true},
+        {"idle", false},
+        {"listening", true},
+        {"idle", false},
+    };
+    Trace polling = Run(kPolling, phases, 0, 0);
+    Trace events = Run(kEvents, phases, 0, 0);
+    printf("%-12s %18s %18s\n", "phase", "polling wakeups/s", "events wakeups/s");
+    for (size_t i = 0; i < phases.size(); i++) {
+        printf("%-12s %18.1f %18.1f\n", phases[i].name, polling.wakeups[i] * 1000.0 / PHASE_MS,
+            events.wakeups[i] * 1000.0 / PHASE_MS);
+    }
+    // The wakeup for a state change counts for the phase it starts, and a phase holds 666
+    // or 667 buffers
+    bool idle_quiet = true, capture_per_buffer = true;
+    for (size_t i = 0; i < phases.size(); i++) {
+        int buffers = PHASE_MS * 1000 / kBufferUs;
+        if (phases[i].capturing) {
+            capture_per_buffer = capture_per_buffer && events.wakeups[i] - buffers >= 0 &&
+                events.wakeups[i] - buffers <= 2;
+        } else {
+            idle_quiet = idle_quiet && events.wakeups[i] <= 1;
+        }
+    }
+    ok = Check(idle_quiet, "idle: the event loop only wakes for the state change") && ok;
+    ok = Check(capture_per_buffer, "capturing: one wakeup per DMA buffer and one for the state change") && ok;
+
+    // Idle -> listening, the change at evenly spread phases of the poll timer and the DMA
+    int64_t worst[2] = {0, 0};
+    double total[2] = {0, 0};
+    for (int run = 0; run < LATENCY_RUNS; run++) {
+        int64_t start_us = PHASE_MS * 1000 + run * (POLL_MS * 1000) / LATENCY_RUNS;
+        int64_t dma_offset_us = (run * 7919) % kBufferUs;
+        const std::vector<Phase> change = {{"idle", false}, {"listening", true}};
+        for (LoopKind loop : {kPolling, kEvents}) {
+            Trace trace = Run(loop, change, start_us, dma_offset_us);
+            int64_t latency = trace.first_frame[1] - (start_us + PHASE_MS * 1000);
+            worst[loop] = std::max(worst[loop], latency);
+            total[loop] += latency;
+        }
+    }
+    printf("idle -> listening, first frame after: polling %.1f ms on average, %.1f ms at worst; "
+        "events %.1f ms on average, %.1f ms at worst\n", total[kPolling] / LATENCY_RUNS / 1000,
+        worst[kPolling] / 1000.0, total[kEvents] / LATENCY_RUNS / 1000, worst[kEvents] / 1000.0);
+    ok = Check(worst[kEvents] <= kBufferUs, "events: the first frame comes within one DMA buffer") && ok;
+    ok = Check(worst[kPolling] > POLL_MS * 1000, "polling: up to the poll period and a buffer on top") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+// Throughput of BackgroundTask with 1, 2 and 4 workers, in tasks per second.
+// Serial: 1 or 4 calling threads schedule serial callbacks, and the test checks the promise
+// made for them: the callbacks of one caller never overlap and run in the order they were
+// scheduled. Nested Schedule() calls from a running callback are counted too.
+// Parallel: a single caller, like the main loop, schedules plain callbacks, once short ones
+// for the overhead and once ones that block (like an SD card write) or compute for a while,
+// for the speedup over one worker. The blocking case must scale with the workers on any
+// host; the computing one only up to the number of hardware threads.
+// Exits with 1 when a callback runs early, twice or concurrently with its predecessor,
+// when WaitForCompletion() returns before everything ran, or when a speedup falls short.
+#include "background_task.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define TASKS_PER_CALLER 20000
+// Work per short callback, in loop iterations
+#define TASK_WORK 100
+// Every this many callbacks schedule one more from inside the pool
+#define NESTED_EVERY 100
+// Callbacks of the speedup cases, the time each one blocks and the loop iterations of the
+// computing ones, a few milliseconds on a desktop
+#define SLOW_TASKS 200
+#define SLOW_TASK_US 2000
+#define COMPUTE_WORK 2000000
+// Share of the ideal speedup a case has to reach
+#define MIN_EFFICIENCY 0.6
+
+struct Caller {
+    // Sequence number of the next callback expected to start
+    std::atomic<uint32_t> next{0};
+    std::atomic<bool> running{false};
+    std::atomic<uint32_t> out_of_order{0};
+    std::atomic<uint32_t> overlapping{0};
+    // Keeps the work from being optimized away, only written by the caller's own callbacks
+    volatile uint32_t sink = 0;
+};
+
+// Keeps the work of the parallel callbacks from being optimized away
+static std::atomic<uint32_t> sink{0};
+
+static uint32_t Work(uint32_t value, int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        value = value * 1664525 + 1013904223;
+    }
+    return value;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool RunSerial(int workers, int callers) {
+    BackgroundTask pool(4096, workers);
+    std::vector<std::unique_ptr<Caller>> state;
+    for (int i = 0; i < callers; i++) {
+        state.emplace_back(new Caller());
+    }
+    std::atomic<uint32_t> nested{0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < callers; c++) {
+        threads.emplace_back([&pool, &nested, caller = state[c].get()]() {
+            for (uint32_t seq = 0; seq < TASKS_PER_CALLER; seq++) {
+                pool.Schedule([&pool, &nested, caller, seq]() {
+                    if (caller->running.exchange(true)) {
+                        caller->overlapping++;
+                    }
+                    if (caller->next.load() != seq) {
+                        caller->out_of_order++;
+                    }
+                    caller->sink = Work(seq, TASK_WORK);
+                    if (seq % NESTED_EVERY == 0) {
+                        pool.Schedule([&nested]() { nested++; });
+                    }
+                    caller->next.store(seq + 1);
+                    caller->running.store(false);
+                }, true);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    pool.WaitForCompletion();
+    double seconds = Seconds(start);
+
+    uint32_t out_of_order = 0, overlapping = 0, incomplete = 0;
+    for (auto& caller : state) {
+        out_of_order += caller->out_of_order;
+        overlapping += caller->overlapping;
+        incomplete += caller->next != TASKS_PER_CALLER ? 1 : 0;
+    }
+    uint32_t expected_nested = callers * ((TASKS_PER_CALLER + NESTED_EVERY - 1) / NESTED_EVERY);
+    bool ok = out_of_order == 0 && overlapping == 0 && incomplete == 0 && nested == expected_nested;
+    printf("serial,   %d workers, %d callers: %8.0f tasks/s, %6u stolen, %u out of order, %u overlapping, "
+        "%u/%u nested %s\n", workers, callers, callers * TASKS_PER_CALLER / seconds, pool.stolen_tasks(),
+        out_of_order, overlapping, nested.load(), expected_nested, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Schedules count plain callbacks from this thread, each calling task(i); returns the seconds
+// until all of them ran
+template <typename F>
+static double RunParallel(int workers, int count, F task, uint32_t& stolen, bool& complete) {
+    BackgroundTask pool(4096, workers);
+    std::atomic<int> done{0};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        pool.Schedule([&done, &task, i]() {
+            task(i);
+            done++;
+        });
+    }
+    pool.WaitForCompletion();
+    double seconds = Seconds(start);
+    stolen = pool.stolen_tasks();
+    complete = done == count;
+    return seconds;
+}
+
+static bool Overhead(int workers) {
+    uint32_t stolen;
+    bool complete;
+    double seconds = RunParallel(workers, TASKS_PER_CALLER, [](int i) {
+        sink.store(Work(i, TASK_WORK), std::memory_order_relaxed);
+    }, stolen, complete);
+    printf("parallel, %d workers, 1 caller:  %8.0f tasks/s, %6u stolen %s\n", workers,
+        TASKS_PER_CALLER / seconds, stolen, complete ? "ok" : "FAIL");
+    return complete;
+}
+
+// Speedup of workers over one worker, for callbacks of which at most parallelism can make
+// progress at the same time
+static bool Speedup(const char* name, int workers, int parallelism, void (*task)(int)) {
+    uint32_t stolen;
+    bool complete_one, complete;
+    double one = RunParallel(1, SLOW_TASKS, task, stolen, complete_one);
+    double many = RunParallel(workers, SLOW_TASKS, task, stolen, complete);
+    double speedup = one / many;
+    double expected = std::min(workers, parallelism);
+    bool ok = complete_one && complete && speedup >= expected * MIN_EFFICIENCY;
+    printf("parallel, %d workers, 1 caller:  %s speedup %.2f, at least %.2f expected, %6u stolen %s\n", workers,
+        name, speedup, expected * MIN_EFFICIENCY, stolen, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+static void Block(int) {
+    std::this_thread::sleep_for(std::chrono::microseconds(SLOW_TASK_US));
+}
+
+static void Compute(int i) {
+    sink.store(Work(i, COMPUTE_WORK), std::memory_order_relaxed);
+}
+
+int main() {
+    int hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    printf("%d hardware threads\n", hardware_threads);
+    bool ok = true;
+    for (int workers : {1, 2, 4}) {
+        for (int callers : {1, 4}) {
+            ok = RunSerial(workers, callers) && ok;
+        }
+    }
+    for (int workers : {1, 2, 4}) {
+        ok = Overhead(workers) && ok;
+    }
+    for (int workers : {2, 4}) {
+        ok = Speedup("blocking", workers, workers, Block) && ok;
+        // Computing only finishes sooner with cores to spread over
+        ok = Speedup("computing", workers, hardware_threads, Compute) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+// Bytes copied and allocations per second of audio on the capture path of
+// Application::OnAudioInput(), for one microphone and for a microphone with the reference:
+//  - vector: the path before AudioFrame, a std::vector sized per frame, InputData() into it,
+//    the first channel compacted in place and then written to the playback ring;
+//  - frame: the path now, a pooled AudioFrame, InputData() into it and the first channel
+//    written from the interleaved frame straight into the ring's spans.
+// The codec is the host AudioCodec of host_audio_codec.cc, so InputData() is one copy out of
+// the codec like the RX queue read on the device. Wake word detection and the AFE read the
+// frame in place on both paths and are left out. Copies are counted where the code makes
+// them, allocations by alloc_counter.h once the path is warm.
+#include "alloc_counter.h"
+#include "audio_codec.h"
+#include "audio_frame.h"
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define FRAME_MS 30
+#define SECONDS 600
+#define WARMUP_FRAMES 10
+#define AUDIO_BUFFER_SAMPLES (24 * 1024)
+#define INPUT_FRAME_SAMPLES 512
+#define INPUT_FRAME_COUNT 4
+
+// Keeps the benchmark loops from being optimized away
+static volatile int16_t sink;
+
+class CountingCodec : public AudioCodec {
+public:
+    explicit CountingCodec(int channels) {
+        input_sample_rate_ = SAMPLE_RATE;
+        output_sample_rate_ = SAMPLE_RATE;
+        input_channels_ = channels;
+    }
+
+private:
+    int16_t next_ = 0;
+
+    virtual int Read(int16_t* dest, int samples) override {
+        for (int i = 0; i < samples; i++) {
+            dest[i] = next_++;
+        }
+        return samples;
+    }
+
+    virtual int Write(const int16_t*, int samples) override { return samples; }
+};
+
+struct Counters {
+    uint64_t captured = 0;
+    uint64_t copied = 0;
+};
+
+// The playback side, releases what was stored without copying it
+static void Drain(SpscRingBuffer<int16_t>& ring) {
+    const int16_t* span;
+    size_t n;
+    while ((n = ring.GetReadSpan(&span)) > 0) {
+        sink = span[n - 1];
+        ring.CommitRead(n);
+    }
+}
+
+static bool VectorPath(AudioCodec& codec, SpscRingBuffer<int16_t>& ring, Counters& counters) {
+    int channels = codec.input_channels();
+    size_t samples = FRAME_MS * SAMPLE_RATE / 1000 * channels;
+    std::vector<int16_t> data;
+    data.resize(samples);
+    if (!codec.InputData(data)) {
+        return false;
+    }
+    counters.copied += samples * sizeof(int16_t);
+    size_t frames = data.size() / channels;
+    if (channels > 1) {
+        for (size_t i = 1; i < frames; i++) {
+            data[i] = data[i * channels];
+        }
+        counters.copied += (frames - 1) * sizeof(int16_t);
+        data.resize(frames);
+    }
+    ring.Write(data.data(), data.size());
+    counters.copied += frames * sizeof(int16_t);
+    counters.captured += samples * sizeof(int16_t);
+    return true;
+}
+
+static bool FramePath(AudioCodec& codec, AudioFramePool& pool, SpscRingBuffer<int16_t>& ring, Counters& counters) {
+    int channels = codec.input_channels();
+    AudioFrame frame = pool.Acquire(FRAME_MS * SAMPLE_RATE / 1000 * channels);
+    if (!frame || !codec.InputData(frame.data(), frame.size())) {
+        return false;
+    }
+    counters.copied += frame.size() * sizeof(int16_t);
+    const int16_t* data = frame.data();
+    size_t frames = frame.size() / channels;
+    if (channels == 1) {
+        ring.Write(data, frames);
+    } else {
+        size_t written = 0;
+        while (written < frames) {
+            int16_t* span;
+            size_t n = std::min(ring.GetWriteSpan(&span), frames - written);
+            if (n == 0) {
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                span[i] = data[(written + i) * channels];
+            }
+            ring.CommitWrite(n);
+            written += n;
+        }
+    }
+    counters.copied += frames * sizeof(int16_t);
+    counters.captured += frame.size() * sizeof(int16_t);
+    return true;
+}
+
+struct Result {
+    double copied_per_second;
+    double captured_per_second;
+    double allocations_per_second;
+    double us_per_second;
+};
+
+template <typename F>
+static Result Run(int channels, F&& step) {
+    CountingCodec codec(channels);
+    codec.Start();
+    SpscRingBuffer<int16_t> ring(AUDIO_BUFFER_SAMPLES);
+    const int frames = SECONDS * 1000 / FRAME_MS;
+    Counters warmup;
+    for (int i = 0; i < WARMUP_FRAMES; i++) {
+        step(codec, ring, warmup);
+        Drain(ring);
+    }
+
+    Counters counters;
+    uint64_t allocations = AllocCounter::allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        step(codec, ring, counters);
+        Drain(ring);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    return {(double)counters.copied / SECONDS, (double)counters.captured / SECONDS,
+        (double)(AllocCounter::allocations.load() - allocations) / SECONDS, us / SECONDS};
+}
+
+static void Print(const char* path, int channels, const Result& result) {
+    printf("%-8s %8d %18.0f %18.0f %14.1f %14.1f\n", path, channels, result.captured_per_second,
+        result.copied_per_second, result.allocations_per_second, result.us_per_second);
+}
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+int main() {
+    bool ok = true;
+    printf("%-8s %8s %18s %18s %14s %14s\n", "path", "channels", "captured bytes/s", "copied bytes/s",
+        "allocations/s", "us CPU/s");
+    for (int channels : {1, 2}) {
+        AudioFramePool* pool = new AudioFramePool(INPUT_FRAME_COUNT, INPUT_FRAME_SAMPLES * channels);
+        Result by_vector = Run(channels, [](AudioCodec& codec, SpscRingBuffer<int16_t>& ring, Counters& counters) {
+            return VectorPath(codec, ring, counters);
+        });
+        Result by_frame = Run(channels, [pool](AudioCodec& codec, SpscRingBuffer<int16_t>& ring, Counters& counters) {
+            return FramePath(codec, *pool, ring, counters);
+        });
+        Print("vector", channels, by_vector);
+        Print("frame", channels, by_frame);
+        ok = Check(by_frame.captured_per_second == SAMPLE_RATE * channels * sizeof(int16_t),
+            channels == 1 ? "one channel: every sample captured" : "two channels: every sample captured") && ok;
+        ok = Check(by_frame.allocations_per_second == 0 && by_vector.allocations_per_second > 0,
+            "the frame path allocates nothing per frame, the vector path does") && ok;
+        // Out of the codec once, then the first channel into the ring
+        ok = Check(by_frame.copied_per_second == by_frame.captured_per_second + SAMPLE_RATE * sizeof(int16_t),
+            "the frame path copies the capture once plus the first channel") && ok;
+        if (channels > 1) {
+            ok = Check(by_frame.copied_per_second < by_vector.copied_per_second,
+                "and with more channels it skips the compaction") && ok;
+        }
+        ok = Check(pool->in_use() == 0 && pool->exhausted() == 0, "every frame went back to the pool") && ok;
+        pool->Retire();
+    }
+    return ok ? 0 : 1;
+}
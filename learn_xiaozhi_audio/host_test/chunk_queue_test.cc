@@ -0,0 +1,186 @@
+// Feeds a WAV file through ChunkQueue into a stub WakeNet detector, the way Feed() and
+// AudioDetectionTask() use it, and checks that the detector sees every accepted sample
+// exactly once and in order, with and without backpressure and across detections.
+//   chunk_queue_test [input.wav]
+// Without an argument a deterministic two-channel file is generated and used.
+#include "chunk_queue.h"
+#include "wav_io.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <thread>
+#include <vector>
+
+// The WakeNet9 chunk at 16kHz and WAKENET_QUEUE_CHUNKS
+#define CHUNK_SIZE 512
+#define QUEUE_CHUNKS 8
+
+// Stands in for esp_wn_iface_t::detect(), it only records what it was given
+struct StubDetector {
+    std::vector<int16_t> seen;
+    int consume_us = 0;
+
+    int Detect(const int16_t* chunk) {
+        seen.insert(seen.end(), chunk, chunk + CHUNK_SIZE);
+        if (consume_us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(consume_us));
+        }
+        return 0;
+    }
+};
+
+struct Scenario {
+    const char* name;
+    // Frames per Feed() call
+    size_t feed_frames;
+    // Retry a push that did not fit instead of dropping it
+    bool backpressure;
+    int feed_interval_us;
+    int detect_us;
+};
+
+static bool Run(const WavData& wav, const Scenario& scenario) {
+    ChunkQueue queue(CHUNK_SIZE, QUEUE_CHUNKS);
+    StubDetector detector;
+    detector.consume_us = scenario.detect_us;
+    std::vector<int16_t> accepted;
+    std::atomic<bool> done{false};
+
+    // The detection task: drain whole chunks, sleep when there are none
+    std::thread consumer([&]() {
+        while (true) {
+            bool finished = done.load(std::memory_order_acquire);
+            const int16_t* chunk;
+            while ((chunk = queue.Front()) != nullptr) {
+                detector.Detect(chunk);
+                queue.Pop();
+            }
+            if (finished) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+
+    // The audio loop: interleaved feeds of the file
+    size_t feed_samples = scenario.feed_frames * wav.channels;
+    for (size_t offset = 0; offset + feed_samples <= wav.samples.size(); offset += feed_samples) {
+        const int16_t* feed = &wav.samples[offset];
+        while (!queue.Push(feed, feed_samples, wav.channels)) {
+            if (!scenario.backpressure) {
+                feed = nullptr;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        if (feed != nullptr) {
+            for (size_t i = 0; i < scenario.feed_frames; i++) {
+                accepted.push_back(feed[i * wav.channels]);
+            }
+        }
+        if (scenario.feed_interval_us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(scenario.feed_interval_us));
+        }
+    }
+    done.store(true, std::memory_order_release);
+    consumer.join();
+
+    // With backpressure every feed gets in, a full queue only delays it
+    size_t feeds = wav.samples.size() / feed_samples;
+    bool ok = !scenario.backpressure || accepted.size() == feeds * scenario.feed_frames;
+    // Only whole chunks are detected, the tail of the last partial one stays queued
+    accepted.resize(accepted.size() - accepted.size() % CHUNK_SIZE);
+    ok = ok && detector.seen == accepted;
+    printf("%-28s %5zu feeds, %5u pushes refused, %6zu chunks detected of %6zu accepted: %s\n", scenario.name,
+        feeds, queue.dropped(), detector.seen.size() / CHUNK_SIZE, accepted.size() / CHUNK_SIZE, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Single-threaded and fully deterministic: every few chunks the stub fires and the queue is
+// cleared like after a wake word, which leaves the read position off the chunk grid so later
+// chunks wrap around the end of the queue and go through the scratch copy
+static bool RunWithDetections(const WavData& wav) {
+    const size_t feed_frames = 480;
+    const int detect_every = 7;
+    ChunkQueue queue(CHUNK_SIZE, QUEUE_CHUNKS);
+    StubDetector detector;
+    // What the queue should hold, and what the detector should see
+    std::deque<int16_t> model;
+    std::vector<int16_t> expected;
+    int chunks = 0;
+    int detections = 0;
+    size_t feed_samples = feed_frames * wav.channels;
+    for (size_t offset = 0; offset + feed_samples <= wav.samples.size(); offset += feed_samples) {
+        if (!queue.Push(&wav.samples[offset], feed_samples, wav.channels)) {
+            printf("FAIL: push refused although the queue was drained\n");
+            return false;
+        }
+        for (size_t i = 0; i < feed_frames; i++) {
+            model.push_back(wav.samples[offset + i * wav.channels]);
+        }
+        const int16_t* chunk;
+        while ((chunk = queue.Front()) != nullptr) {
+            detector.Detect(chunk);
+            queue.Pop();
+            expected.insert(expected.end(), model.begin(), model.begin() + CHUNK_SIZE);
+            model.erase(model.begin(), model.begin() + CHUNK_SIZE);
+            if (++chunks % detect_every == 0) {
+                queue.Clear();
+                model.clear();
+                detections++;
+            }
+        }
+    }
+    bool ok = detector.seen == expected;
+    printf("%-28s %5d detections, %6zu chunks detected of %6zu expected: %s\n", "detections clear the queue",
+        detections, detector.seen.size() / CHUNK_SIZE, expected.size() / CHUNK_SIZE, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// 20s of a microphone channel with a sweeping tone over noise and a reference channel
+static WavData GenerateWav() {
+    WavData wav;
+    wav.sample_rate = 16000;
+    wav.channels = 2;
+    uint32_t seed = 12345;
+    double phase = 0;
+    for (int i = 0; i < 20 * wav.sample_rate; i++) {
+        seed = seed * 1103515245 + 12345;
+        int noise = (int)((seed >> 16) & 0x3ff) - 512;
+        phase += 2 * M_PI * (200 + (i % 16000) / 10.0) / wav.sample_rate;
+        wav.samples.push_back((int16_t)(8000 * sin(phase)) + noise);
+        wav.samples.push_back((int16_t)(i & 0x7fff));
+    }
+    return wav;
+}
+
+int main(int argc, char** argv) {
+    WavData wav;
+    const char* path = argc > 1 ? argv[1] : "chunk_queue_test.wav";
+    if (argc <= 1 && !WriteWav(path, GenerateWav())) {
+        printf("FAIL: could not write %s\n", path);
+        return 1;
+    }
+    if (!ReadWav(path, wav)) {
+        printf("FAIL: %s is not a 16-bit PCM WAV file\n", path);
+        return 1;
+    }
+    printf("%s: %d Hz, %d channels, %zu frames\n", path, wav.sample_rate, wav.channels,
+        wav.samples.size() / wav.channels);
+
+    const Scenario scenarios[] = {
+        {"one chunk per feed", CHUNK_SIZE, true, 0, 0},
+        {"30ms feeds, chunks wrap", 480, true, 0, 0},
+        {"slow detector, drops", CHUNK_SIZE, false, 100, 300},
+        {"slow detector, 30ms feeds", 480, false, 100, 300},
+    };
+    bool ok = true;
+    for (auto& scenario : scenarios) {
+        ok = Run(wav, scenario) && ok;
+    }
+    ok = RunWithDetections(wav) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+// DeviceStateQueue and OutputDrainWait the way Application drives them: SetDeviceState()
+// pushes from any task, RunStateRequests() pops on the main loop, entering listening from
+// speaking waits for the speaker, and the indicators and the drain complete as actions
+// through event bits. Checks in order:
+//  - requests made during a transition wait for it and then run in order, requests for the
+//    current state are skipped and illegal edges rejected and counted;
+//  - a full queue refuses requests;
+//  - the drain wait ends once, by the drain or by the timeout, whichever comes first,
+//    and a timeout left over from an earlier wait does not end a newer one;
+//  - with 4 tasks pushing and the drain and the timeout racing from two more, every request
+//    is started, skipped, rejected or refused, and transitions never overlap.
+#include "device_state_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#define DRAIN_TIMEOUT_US 500000
+
+#define INDICATORS_EVENT (1 << 1)
+#define DRAINED_EVENT (1 << 2)
+
+// Stands in for Application: the same request, transition and action handling, with the
+// side effects replaced by counters
+struct App {
+    DeviceStateQueue queue;
+    OutputDrainWait drain;
+    DeviceState state = kDeviceStateUnknown;
+    // Event group bits of the main loop
+    std::atomic<uint32_t> events{0};
+    std::vector<DeviceState> started;
+    int completed = 0;
+    int rejected = 0;
+    int drains = 0;
+
+    void EnterListening(DeviceState previous) {
+        if (previous == kDeviceStateSpeaking) {
+            queue.AddAction();
+            drain.Start(Now());
+        }
+    }
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Application::RunStateRequests()
+    void Run();
+    // Application::BeginTransition(), the indicators complete once the main loop gets to them
+    void Begin(const DeviceStateQueue::Request& request) {
+        auto previous = state;
+        queue.Begin(request, previous, Now());
+        if (auto on_enter = kStates[request.state].on_enter) {
+            (this->*on_enter)(previous);
+        }
+        state = request.state;
+        started.push_back(state);
+        events |= INDICATORS_EVENT;
+    }
+    void CompleteAction() {
+        if (queue.CompleteAction()) {
+            completed++;
+            Run();
+        }
+    }
+    // One pass of Application::MainEventLoop() over the transition bits
+    bool Loop() {
+        uint32_t bits = events.exchange(0);
+        if (bits & DRAINED_EVENT) {
+            drains++;
+            CompleteAction();
+        }
+        if (bits & INDICATORS_EVENT) {
+            CompleteAction();
+        }
+        return bits != 0;
+    }
+
+    static const DeviceStateInfo<App> kStates[kDeviceStateCount];
+};
+
+#define M DeviceStateMask
+constexpr DeviceStateInfo<App> App::kStates[kDeviceStateCount] = {
+    {kDeviceStateUnknown, M(kDeviceStateStarting), nullptr, nullptr},
+    {kDeviceStateStarting, M(kDeviceStateIdle), nullptr, nullptr},
+    {kDeviceStateWifiConfiguring, 0, nullptr, nullptr},
+    {kDeviceStateIdle, M(kDeviceStateListening, kDeviceStateSpeaking), nullptr, nullptr},
+    {kDeviceStateConnecting, 0, nullptr, nullptr},
+    {kDeviceStateListening, M(kDeviceStateIdle, kDeviceStateSpeaking), nullptr, &App::EnterListening},
+    {kDeviceStateSpeaking, M(kDeviceStateIdle, kDeviceStateListening), nullptr, nullptr},
+    {kDeviceStateUpgrading, 0, nullptr, nullptr},
+    {kDeviceStateActivating, 0, nullptr, nullptr},
+    {kDeviceStateFatalError, 0, nullptr, nullptr},
+};
+#undef M
+static_assert(IsValidDeviceStateTable(App::kStates), "");
+
+void App::Run() {
+    DeviceStateQueue::Request request;
+    DeviceStateQueue::Next next;
+    while ((next = queue.Pop(kStates, state, request)) != DeviceStateQueue::kNextNone) {
+        if (next == DeviceStateQueue::kNextRejected) {
+            rejected++;
+            continue;
+        }
+        Begin(request);
+    }
+}
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+static bool Sequence() {
+    App app;
+    bool ok = true;
+    app.queue.Push(kDeviceStateStarting, 0);
+    app.Run();
+    // Queued behind the running transition: a repeat of it, an illegal edge, two legal ones
+    app.queue.Push(kDeviceStateStarting, 0);
+    app.queue.Push(kDeviceStateSpeaking, 0);
+    app.queue.Push(kDeviceStateIdle, 0);
+    app.queue.Push(kDeviceStateSpeaking, 0);
+    app.Run();
+    ok = Check(app.started.size() == 1 && app.queue.running(), "requests wait while a transition runs") && ok;
+    while (app.Loop()) {
+    }
+    ok = Check(app.started == std::vector<DeviceState>{kDeviceStateStarting, kDeviceStateIdle, kDeviceStateSpeaking},
+        "then run in order, the repeated state skipped") && ok;
+    ok = Check(app.rejected == 1 && app.queue.illegal() == 1, "illegal edge rejected and counted") && ok;
+    ok = Check(app.completed == 3 && !app.queue.running(), "every transition completed") && ok;
+
+    // Listening after speaking holds the transition until the speaker drained
+    app.queue.Push(kDeviceStateListening, 0);
+    app.queue.Push(kDeviceStateIdle, 0);
+    app.Run();
+    while (app.Loop()) {
+    }
+    ok = Check(app.state == kDeviceStateListening && app.queue.running() && app.drain.waiting(),
+        "speaking -> listening waits for the drain, the next request too") && ok;
+    ok = Check(!app.drain.Expired(App::Now(), DRAIN_TIMEOUT_US), "no timeout before its time") && ok;
+    ok = Check(app.drain.Drained() && !app.drain.Drained(), "the drain ends the wait once") && ok;
+    app.events |= DRAINED_EVENT;
+    while (app.Loop()) {
+    }
+    ok = Check(app.state == kDeviceStateIdle && !app.queue.running() && app.completed == 5,
+        "then the transition completes and the queued one runs") && ok;
+
+    // The timeout ends a wait the codec never reports
+    app.queue.Push(kDeviceStateSpeaking, 0);
+    app.queue.Push(kDeviceStateListening, 0);
+    app.Run();
+    while (app.Loop()) {
+    }
+    int64_t start = app.drain.start_time();
+    ok = Check(app.drain.Expired(start + DRAIN_TIMEOUT_US, DRAIN_TIMEOUT_US) && !app.drain.Drained(),
+        "the timeout ends the wait, a late drain does not") && ok;
+    app.events |= DRAINED_EVENT;
+    while (app.Loop()) {
+    }
+    ok = Check(!app.queue.running() && app.completed == 7, "and completes the transition") && ok;
+
+    // A timer of the last wait firing just after a new one started
+    app.queue.Push(kDeviceStateSpeaking, 0);
+    app.queue.Push(kDeviceStateListening, 0);
+    app.Run();
+    while (app.Loop()) {
+    }
+    ok = Check(!app.drain.Expired(app.drain.start_time() + DRAIN_TIMEOUT_US - 1, DRAIN_TIMEOUT_US) &&
+        app.drain.waiting(), "an old timeout does not end a newer wait") && ok;
+    app.drain.Drained();
+    app.events |= DRAINED_EVENT;
+    while (app.Loop()) {
+    }
+
+    // The queue holds 8 requests
+    int pushed = 0;
+    while (app.queue.Push(kDeviceStateIdle, 0)) {
+        pushed++;
+    }
+    ok = Check(pushed == 8, "a full queue refuses requests") && ok;
+    return ok;
+}
+
+// Every request from four pushing tasks ends up started, skipped, rejected or refused
+static bool Stress() {
+    const int kPushers = 4;
+    const int kRequests = 20000;
+    App app;
+    app.queue.Push(kDeviceStateStarting, 0);
+    app.queue.Push(kDeviceStateIdle, 0);
+    std::atomic<bool> stop{false};
+    std::atomic<int> refused{0};
+    std::atomic<int> pushes{0};
+    std::atomic<int> drained_by_codec{0}, drained_by_timer{0};
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < kPushers; p++) {
+        threads.emplace_back([&, p]() {
+            const DeviceState states[] = {kDeviceStateIdle, kDeviceStateListening, kDeviceStateSpeaking,
+                kDeviceStateUpgrading};
+            for (int i = 0; i < kRequests; i++) {
+                if (app.queue.Push(states[(i * 7 + p) % 4], 0)) {
+                    pushes++;
+                } else {
+                    refused++;
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    // The audio loop and the timer race to end every drain wait; the codec misses the waits
+    // started on an odd microsecond, those only the timer ends
+    for (int source = 0; source < 2; source++) {
+        threads.emplace_back([&, source]() {
+            while (!stop) {
+                bool ended = source == 0 ? app.drain.start_time() % 2 == 0 && app.drain.Drained() :
+                    app.drain.Expired(INT64_MAX, 0);
+                if (ended) {
+                    (source == 0 ? drained_by_codec : drained_by_timer)++;
+                    app.events |= DRAINED_EVENT;
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    // The main loop, while the pushers run and after until nothing is left
+    auto idle_since = std::chrono::steady_clock::now();
+    while (pushes + refused < kPushers * kRequests ||
+        std::chrono::steady_clock::now() - idle_since < std::chrono::milliseconds(50)) {
+        app.Run();
+        if (app.Loop()) {
+            idle_since = std::chrono::steady_clock::now();
+        }
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    int drained = drained_by_codec + drained_by_timer;
+    bool ok = true;
+    ok = Check(pushes + refused == kPushers * kRequests, "every push either queued or refused") && ok;
+    ok = Check(!app.queue.running() && (int)app.started.size() == app.completed,
+        "every started transition completed") && ok;
+    ok = Check(drained == app.drains, "every drain wait ended once") && ok;
+    printf("%d pushed, %d refused, %zu started, %d rejected, %d waits for the speaker "
+        "(%d ended by the drain, %d by the timeout)\n", pushes.load(), refused.load(), app.started.size(),
+        app.rejected, app.drains, drained_by_codec.load(), drained_by_timer.load());
+    ok = Check(app.rejected > 0 && drained_by_codec > 0 && drained_by_timer > 0,
+        "illegal edges, drains and timeouts were all exercised") && ok;
+    return ok;
+}
+
+int main() {
+    bool ok = Sequence();
+    ok = Stress() && ok;
+    return ok ? 0 : 1;
+}
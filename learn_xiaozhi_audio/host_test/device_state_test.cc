@@ -0,0 +1,132 @@
+// Edge cases of device_state.h, which the audio, display and LED projects share unchanged:
+// names and masks at both ends of the enum, values cast from out of range integers, and
+// tables IsValidDeviceStateTable() must reject. Most checks are static_asserts, so a broken
+// header fails the build; the transition checks run again at run time over every pair,
+// including values outside the enum, against a plain reimplementation.
+#include "device_state.h"
+
+#include <cstdio>
+#include <cstring>
+
+static_assert(kDeviceStateCount == 10, "a new state needs a name, a table row and an indicator");
+static_assert(kDeviceStateCount <= 32, "DeviceStateMask() holds one bit per state in a uint32_t");
+
+static_assert(DeviceStateMask() == 0, "");
+static_assert(DeviceStateMask(kDeviceStateUnknown) == 1u, "");
+static_assert(DeviceStateMask(kDeviceStateFatalError) == 1u << 9, "");
+static_assert(DeviceStateMask(kDeviceStateIdle, kDeviceStateIdle) == DeviceStateMask(kDeviceStateIdle), "");
+static_assert(DeviceStateMask(kDeviceStateListening, kDeviceStateSpeaking) == ((1u << 5) | (1u << 6)), "");
+
+constexpr bool NameIs(int state, const char* name) {
+    const char* s = DeviceStateName(state);
+    while (*s != '\0' && *s == *name) {
+        s++;
+        name++;
+    }
+    return *s == *name;
+}
+
+static_assert(NameIs(kDeviceStateUnknown, "unknown"), "");
+static_assert(NameIs(kDeviceStateFatalError, "fatal_error"), "");
+static_assert(NameIs(-1, "invalid_state"), "");
+static_assert(NameIs(kDeviceStateCount, "invalid_state"), "");
+static_assert(NameIs(0x7fffffff, "invalid_state"), "");
+static_assert(NameIs(-0x7fffffff - 1, "invalid_state"), "");
+
+// Stands in for Application as the owner of the actions
+struct Owner {
+    void OnExit(DeviceState) {}
+    void OnEnter(DeviceState) {}
+};
+
+using Info = DeviceStateInfo<Owner>;
+
+struct Table {
+    Info rows[kDeviceStateCount];
+};
+
+// Every state may go to its neighbours, unknown to starting and fatal_error to nothing
+constexpr Table MakeTable() {
+    Table table{};
+    for (int i = 0; i < kDeviceStateCount; i++) {
+        uint32_t next = 0;
+        if (i > 0 && i < kDeviceStateFatalError) {
+            next |= 1u << (i - 1);
+        }
+        if (i < kDeviceStateFatalError) {
+            next |= 1u << (i + 1);
+        }
+        table.rows[i] = {(DeviceState)i, next, &Owner::OnExit, nullptr};
+    }
+    return table;
+}
+
+constexpr Table kValid = MakeTable();
+
+constexpr Table WithRow(int index, DeviceState state, uint32_t next_states) {
+    Table table = MakeTable();
+    table.rows[index].state = state;
+    table.rows[index].next_states = next_states;
+    return table;
+}
+
+constexpr Table kSwapped = [] {
+    Table table = MakeTable();
+    Info row = table.rows[3];
+    table.rows[3] = table.rows[4];
+    table.rows[4] = row;
+    return table;
+}();
+constexpr Table kSelfEdge = WithRow(kDeviceStateIdle, kDeviceStateIdle, DeviceStateMask(kDeviceStateIdle));
+constexpr Table kEdgePastEnd = WithRow(kDeviceStateFatalError, kDeviceStateFatalError, 1u << kDeviceStateCount);
+constexpr Table kEdgeTopBit = WithRow(kDeviceStateUnknown, kDeviceStateUnknown, 1u << 31);
+constexpr Table kLastRowWrong = WithRow(kDeviceStateFatalError, kDeviceStateUnknown, 0);
+constexpr Info kShort[kDeviceStateCount - 1] = {};
+constexpr Info kLong[kDeviceStateCount + 1] = {};
+
+static_assert(IsValidDeviceStateTable(kValid.rows), "");
+static_assert(!IsValidDeviceStateTable(kSwapped.rows), "rows out of enum order");
+static_assert(!IsValidDeviceStateTable(kSelfEdge.rows), "edge from a state to itself");
+static_assert(!IsValidDeviceStateTable(kEdgePastEnd.rows), "edge to the first value past the enum");
+static_assert(!IsValidDeviceStateTable(kEdgeTopBit.rows), "edge to the last bit of the mask");
+static_assert(!IsValidDeviceStateTable(kLastRowWrong.rows), "last row for the wrong state");
+static_assert(!IsValidDeviceStateTable(kShort), "one row missing");
+static_assert(!IsValidDeviceStateTable(kLong), "one row too many");
+
+static_assert(IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateUnknown, kDeviceStateStarting), "");
+static_assert(IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateActivating, kDeviceStateFatalError), "");
+static_assert(!IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateFatalError, kDeviceStateActivating), "");
+static_assert(!IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateIdle, kDeviceStateIdle), "");
+static_assert(!IsDeviceStateTransitionAllowed(kValid.rows, -1, kDeviceStateUnknown), "");
+static_assert(!IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateUnknown, -1), "");
+static_assert(!IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateCount, kDeviceStateFatalError), "");
+static_assert(!IsDeviceStateTransitionAllowed(kValid.rows, kDeviceStateFatalError - 1, kDeviceStateCount), "");
+// The shift must not be reached for a target that is out of range
+static_assert(!IsDeviceStateTransitionAllowed(kEdgeTopBit.rows, kDeviceStateUnknown, 31), "");
+static_assert(!IsDeviceStateTransitionAllowed(kEdgeTopBit.rows, kDeviceStateUnknown, 32), "");
+
+int main() {
+    int failures = 0;
+    int checked = 0;
+    // Also at run time, with values the compiler can not fold
+    volatile int low = -2;
+    volatile int high = kDeviceStateCount + 2;
+    for (int from = low; from < high; from++) {
+        for (int to = low; to < high; to++) {
+            bool in_range = from >= 0 && from < kDeviceStateCount && to >= 0 && to < kDeviceStateCount;
+            bool expected = in_range && from != kDeviceStateFatalError && (to == from + 1 || to == from - 1);
+            if (IsDeviceStateTransitionAllowed(kValid.rows, from, to) != expected) {
+                printf("FAIL: %d -> %d\n", from, to);
+                failures++;
+            }
+            checked++;
+        }
+        bool named = strcmp(DeviceStateName(from), "invalid_state") != 0;
+        if (named != (from >= 0 && from < kDeviceStateCount)) {
+            printf("FAIL: name of %d is %s\n", from, DeviceStateName(from));
+            failures++;
+        }
+    }
+    printf("%d transitions checked, %d failures %s\n", checked, failures, failures == 0 ? "ok" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
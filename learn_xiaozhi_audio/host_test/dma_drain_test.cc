@@ -0,0 +1,143 @@
+// DmaDrainCounter against a model of the ESP-IDF I2S TX DMA: a ring of desc_num buffers the
+// DMA sends round and round, and a queue of the buffers it has sent, at most desc_num - 1
+// deep, from which i2s_channel_write() takes the oldest to fill. A buffer dropped from the
+// full queue is cleared, so the idle DMA plays silence. Bursts of audio are written from
+// idle, either as fast as the DMA takes them, like the TX task with a full queue, or one
+// buffer every few sends. Checks that the drain is never reported before the last buffer of
+// audio was sent and at most desc_num - 1 buffers after it; and that while the writer keeps
+// the DMA busy it is reported once, on time. Also shows how early the old count of written
+// frames, taken down on every send, reported the drain.
+#include "dma_drain_counter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#define SILENCE (-1)
+
+class DmaModel {
+public:
+    explicit DmaModel(int desc_num) : desc_num_(desc_num), content_(desc_num, SILENCE) {}
+
+    // The DMA finished sending the current buffer; returns what it held
+    int Send() {
+        int buffer = playing_;
+        int sent = content_[buffer];
+        if ((int)free_.size() == desc_num_ - 1) {
+            content_[free_.front()] = SILENCE;
+            free_.pop_front();
+        }
+        free_.push_back(buffer);
+        playing_ = (playing_ + 1) % desc_num_;
+        return sent;
+    }
+
+    // i2s_channel_write() of one buffer, false when it would block
+    bool Write(int id) {
+        if (free_.empty()) {
+            return false;
+        }
+        content_[free_.front()] = id;
+        free_.pop_front();
+        return true;
+    }
+
+private:
+    int desc_num_;
+    std::vector<int> content_;
+    std::deque<int> free_;
+    int playing_ = 0;
+};
+
+struct Result {
+    // Sends after the last audio buffer went out until the drain was reported
+    int late = 0;
+    // The same for the old frame count, negative when it was early
+    int old_late = 0;
+    bool ok = true;
+};
+
+// buffers of audio after idle sends of silence, one write every write_every sends at most
+static Result Run(int desc_num, int idle, int buffers, int write_every) {
+    DmaModel dma(desc_num);
+    DmaDrainCounter counter(desc_num);
+    Result result;
+    int written = 0;
+    // Highest buffer of audio sent so far, and the send of the last one
+    int max_sent = SILENCE;
+    int last_sent = -1;
+    int reported = -1;
+    int old_frames = 0;
+    int old_reported = -1;
+    int reports = 0;
+    for (int send = 0; send < idle + buffers * write_every + 4 * desc_num; send++) {
+        if (send >= idle && written < buffers) {
+            bool writing = (send - idle) % write_every == 0;
+            // The TX task writes until the DMA has no buffer left, every write_every sends
+            while (writing && written < buffers && dma.Write(written)) {
+                counter.OnWritten();
+                old_frames++;
+                written++;
+                writing = write_every == 1;
+            }
+        }
+        if (counter.drained() && max_sent < written - 1) {
+            printf("FAIL: drained() with %d buffers unsent\n", written - 1 - max_sent);
+            result.ok = false;
+        }
+
+        int sent = dma.Send();
+        max_sent = std::max(max_sent, sent);
+        if (sent == buffers - 1) {
+            last_sent = send;
+        }
+        if (counter.OnSent()) {
+            reports++;
+            if (reported < 0 && written == buffers) {
+                reported = send;
+            }
+        }
+        if (old_frames > 0 && --old_frames == 0 && written == buffers && old_reported < 0) {
+            old_reported = send;
+        }
+    }
+
+    result.late = reported - last_sent;
+    result.old_late = old_reported - last_sent;
+    if (last_sent < 0 || reported < 0 || result.late < 0 || result.late > desc_num - 1 || !counter.drained()) {
+        result.ok = false;
+    }
+    // With the writer keeping up, every drain point but the final one is overtaken by the next write
+    if (write_every == 1 && reports != 1) {
+        result.ok = false;
+    }
+    return result;
+}
+
+int main() {
+    bool ok = true;
+    for (int desc_num : {2, 6, 16}) {
+        for (int buffers : {1, 3, 50}) {
+            for (int write_every : {1, 3}) {
+                int worst = 0, worst_old = 0;
+                bool case_ok = true;
+                for (int idle = 0; idle < 2 * desc_num; idle++) {
+                    Result result = Run(desc_num, idle, buffers, write_every);
+                    case_ok = case_ok && result.ok;
+                    worst = std::max(worst, result.late);
+                    worst_old = std::min(worst_old, result.old_late);
+                }
+                // Once the writer has filled the ring the last write goes to the last buffer of it
+                if (write_every == 1 && buffers >= desc_num && worst != 0) {
+                    case_ok = false;
+                }
+                printf("%2d buffers, %2d written every %d sends: drain reported up to %2d sends late, "
+                    "the frame count up to %2d early %s\n", desc_num, buffers, write_every, worst, -worst_old,
+                    case_ok ? "ok" : "FAIL");
+                ok = ok && case_ok;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
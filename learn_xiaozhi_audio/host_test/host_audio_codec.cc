@@ -0,0 +1,69 @@
+// Host implementation of the AudioCodec base class for file-backed codecs like WavAudioCodec.
+// There are no pipeline tasks or queues: InputData() reads from the codec and OutputData()
+// writes to it synchronously, in the caller's thread.
+#include "audio_codec.h"
+#include "audio_kernels.h"
+
+AudioCodec::AudioCodec() {
+}
+
+AudioCodec::~AudioCodec() {
+}
+
+void AudioCodec::Start() {
+    output_gain_ = AudioKernels::VolumeToGain(output_volume_);
+    EnableInput(true);
+    EnableOutput(true);
+}
+
+void AudioCodec::OutputData(std::vector<int16_t>& data) {
+    OutputData(data.data(), data.size());
+}
+
+void AudioCodec::OutputData(const int16_t* data, size_t samples) {
+    tx_frames_++;
+    if ((size_t)Write(data, samples) < samples) {
+        tx_dropped_++;
+    }
+}
+
+bool AudioCodec::InputData(std::vector<int16_t>& data) {
+    return InputData(data.data(), data.size());
+}
+
+// A short read is the end of the input, it is not handed out
+bool AudioCodec::InputData(int16_t* data, size_t samples) {
+    rx_frames_++;
+    return (size_t)Read(data, samples) == samples;
+}
+
+void AudioCodec::SetOutputVolume(int volume) {
+    output_volume_ = volume;
+    output_gain_ = AudioKernels::VolumeToGain(output_volume_);
+}
+
+void AudioCodec::EnableInput(bool enable) {
+    input_enabled_ = enable;
+}
+
+void AudioCodec::EnableOutput(bool enable) {
+    output_enabled_ = enable;
+}
+
+// Nothing runs in the background, so there is nobody to notify and no task time to report
+void AudioCodec::SetEventTask(TaskHandle_t task) {
+    event_task_ = task;
+}
+
+void AudioCodec::SetEventMask(uint32_t mask) {
+    event_mask_ = mask;
+}
+
+uint32_t AudioCodec::pipeline_run_time() const {
+    return 0;
+}
+
+// Writes go straight to the codec, there is no queue to fill
+size_t AudioCodec::output_space() const {
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Host implementation of Settings. Every namespace is an in-memory store that outlives the
+// Settings objects, like NVS outlives a reboot, so a test can run boot after boot.
+#include "settings.h"
+
+#include <esp_log.h>
+
+#include <map>
+
+#define TAG "Settings"
+
+struct HostNamespace {
+    std::map<std::string, std::string> strings;
+    std::map<std::string, int32_t> ints;
+};
+
+static HostNamespace& GetNamespace(const std::string& ns) {
+    static std::map<std::string, HostNamespace> namespaces;
+    return namespaces[ns];
+}
+
+Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
+}
+
+Settings::~Settings() {
+}
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    auto& strings = GetNamespace(ns_).strings;
+    auto it = strings.find(key);
+    return it != strings.end() ? it->second : default_value;
+}
+
+void Settings::SetString(const std::string& key, const std::string& value) {
+    if (read_write_) {
+        GetNamespace(ns_).strings[key] = value;
+    } else {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    }
+}
+
+int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
+    auto& ints = GetNamespace(ns_).ints;
+    auto it = ints.find(key);
+    return it != ints.end() ? it->second : default_value;
+}
+
+void Settings::SetInt(const std::string& key, int32_t value) {
+    if (read_write_) {
+        GetNamespace(ns_).ints[key] = value;
+    } else {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    }
+}
+
+void Settings::EraseKey(const std::string& key) {
+    if (read_write_) {
+        GetNamespace(ns_).strings.erase(key);
+        GetNamespace(ns_).ints.erase(key);
+    } else {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    }
+}
+
+void Settings::EraseAll() {
+    if (read_write_) {
+        GetNamespace(ns_) = HostNamespace();
+    } else {
+        ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+    }
+}
@@ -0,0 +1,151 @@
+// NoAudioCodec on the host I2S channels of stubs/driver/i2s_common.h, driven through
+// InputData() and OutputData() like the pipeline tasks drive Read() and Write().
+//  - scratch buffers: frames of mixed sizes, from one sample to more than the whole DMA
+//    ring, and reads the channel returns in pieces; the scratch buffer of each direction
+//    is allocated by the first call and never again, and nothing else allocates;
+//  - input reference, with one microphone on a duplex bus and two on a simplex one: the
+//    microphones ramp up and down, a ramp is played at full volume. Every captured frame is
+//    the microphones in slot order and then the reference; the played ramp turns up in the
+//    reference exactly one DMA ring into the capture after the write, whole and followed
+//    by silence; and after a long write without capture the reference skips to the last
+//    ring of it.
+#include "alloc_counter.h"
+#include "no_audio_codec.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define CALLS 300
+// Samples of the played ramp, less than a ring
+#define RAMP 500
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+static bool ScratchBuffers() {
+    NoAudioCodecDuplex codec(SAMPLE_RATE, SAMPLE_RATE, GPIO_NUM_0, GPIO_NUM_0, GPIO_NUM_0, GPIO_NUM_0);
+    codec.Start();
+    const size_t ring = codec.dma_desc_num() * codec.dma_frame_num();
+    // A 10, 30 and 60 ms frame, a single sample and more than the ring
+    const size_t sizes[] = {160, 480, 960, 1, ring + 7};
+    std::vector<int16_t> frame(ring + 7, 1000);
+    bool ok = true;
+
+    ok = Check(codec.scratch_allocations() == 0, "nothing allocated before the first call") && ok;
+    codec.InputData(frame.data(), sizes[0]);
+    ok = Check(codec.scratch_allocations() == 1, "the first read allocates the RX scratch buffer") && ok;
+
+    // Every other read comes back in pieces of 100 slots
+    auto rx = i2s_host_channel(I2S_NUM_0, I2S_DIR_RX);
+    uint64_t allocations = AllocCounter::allocations.load();
+    for (int i = 0; i < CALLS; i++) {
+        rx->max_read_bytes = i % 2 ? 100 * sizeof(int32_t) : 0;
+        codec.InputData(frame.data(), sizes[i % 5]);
+    }
+    rx->max_read_bytes = 0;
+    ok = Check(codec.scratch_allocations() == 1, "and stays the only one over the reads") && ok;
+
+    codec.OutputData(frame.data(), sizes[0]);
+    ok = Check(codec.scratch_allocations() == 2, "the first write allocates the TX scratch buffer") && ok;
+    for (int i = 0; i < CALLS; i++) {
+        codec.OutputData(frame.data(), sizes[i % 5]);
+        codec.InputData(frame.data(), sizes[(i + 2) % 5]);
+    }
+    ok = Check(codec.scratch_allocations() == 2, "and no read or write allocates again") && ok;
+    ok = Check(AllocCounter::allocations.load() == allocations + 1, "nor does anything else on the way") && ok;
+    printf("%d reads and %d writes of up to %zu samples, %u scratch allocations\n", 2 * CALLS + 1, CALLS + 1,
+        ring + 7, (unsigned)codec.scratch_allocations());
+    return ok;
+}
+
+static bool Reference(NoAudioCodec& codec, i2s_chan_handle_t rx, int mics) {
+    bool ok = true;
+    ok = Check(codec.EnableInputReference() && codec.input_channels() == mics + 1,
+        mics == 1 ? "one microphone: the reference is channel 1" : "two microphones: the reference is channel 2") &&
+        ok;
+    codec.Start();
+    codec.SetOutputVolume(100);
+    const size_t ring = codec.dma_desc_num() * codec.dma_frame_num();
+    const int channels = codec.input_channels();
+
+    // Microphone m of frame k is (k % 1000 + 1) * (m ? -1 : 1) after the 12-bit shift
+    int64_t mic_frame = 0;
+    rx->source = [&](void* dest, size_t bytes) {
+        auto slots = (int32_t*)dest;
+        for (size_t i = 0; i < bytes / sizeof(int32_t) / mics; i++, mic_frame++) {
+            for (int m = 0; m < mics; m++) {
+                int32_t value = (int32_t)(mic_frame % 1000 + 1) * (m ? -1 : 1);
+                slots[i * mics + m] = value * (1 << 12);
+            }
+        }
+    };
+
+    // Captures frames, checks the microphone channels and returns the reference channel
+    int64_t expected_mic = 0;
+    bool mics_in_order = true;
+    auto capture = [&](size_t frames) {
+        std::vector<int16_t> data(frames * channels);
+        std::vector<int16_t> reference(frames);
+        codec.InputData(data.data(), data.size());
+        for (size_t f = 0; f < frames; f++, expected_mic++) {
+            for (int m = 0; m < mics; m++) {
+                mics_in_order = mics_in_order &&
+                    data[f * channels + m] == (int16_t)((expected_mic % 1000 + 1) * (m ? -1 : 1));
+            }
+            reference[f] = data[f * channels + mics];
+        }
+        return reference;
+    };
+
+    std::vector<int16_t> ramp(RAMP);
+    for (int i = 0; i < RAMP; i++) {
+        ramp[i] = (int16_t)(i + 1);
+    }
+    codec.OutputData(ramp.data(), ramp.size());
+    // Over the ring and the ramp in frames of 160, so the ramp straddles reads
+    std::vector<int16_t> reference;
+    while (reference.size() < ring + RAMP + 480) {
+        auto part = capture(160);
+        reference.insert(reference.end(), part.begin(), part.end());
+    }
+    size_t first = 0;
+    while (first < reference.size() && reference[first] == 0) {
+        first++;
+    }
+    bool whole = first + RAMP <= reference.size() &&
+        std::equal(ramp.begin(), ramp.end(), reference.begin() + first);
+    bool silence_after = std::all_of(reference.begin() + first + RAMP, reference.end(),
+        [](int16_t sample) { return sample == 0; });
+    ok = Check(first == ring, "the played ramp comes back one DMA ring after the write") && ok;
+    ok = Check(whole && silence_after, "whole and in order, then silence") && ok;
+
+    // Three rings written while nobody captured: only the last ring is left to line up
+    std::vector<int16_t> long_ramp(3 * ring);
+    for (size_t i = 0; i < long_ramp.size(); i++) {
+        long_ramp[i] = (int16_t)(i + 1);
+    }
+    codec.OutputData(long_ramp.data(), long_ramp.size());
+    auto after_pause = capture(ring);
+    ok = Check(std::equal(long_ramp.end() - ring, long_ramp.end(), after_pause.begin()),
+        "after a pause in capture the reference skips to the last ring played") && ok;
+    ok = Check(mics_in_order, "the microphones come in slot order in every frame") && ok;
+    return ok;
+}
+
+int main() {
+    bool ok = ScratchBuffers();
+    {
+        NoAudioCodecDuplex codec(SAMPLE_RATE, SAMPLE_RATE, GPIO_NUM_0, GPIO_NUM_0, GPIO_NUM_0, GPIO_NUM_0);
+        ok = Reference(codec, i2s_host_channel(I2S_NUM_0, I2S_DIR_RX), 1) && ok;
+    }
+    {
+        NoAudioCodecSimplex codec(SAMPLE_RATE, SAMPLE_RATE, GPIO_NUM_0, GPIO_NUM_0, GPIO_NUM_0, I2S_STD_SLOT_LEFT,
+            GPIO_NUM_0, GPIO_NUM_0, GPIO_NUM_0, I2S_STD_SLOT_BOTH);
+        ok = Reference(codec, i2s_host_channel(I2S_NUM_1, I2S_DIR_RX), 2) && ok;
+    }
+    return ok ? 0 : 1;
+}
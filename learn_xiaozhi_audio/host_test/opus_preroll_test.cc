@@ -0,0 +1,130 @@
+// Encodes 10s of audio into OpusPreroll against libopus, the way AudioEncodeTask() does,
+// and checks that Encode() does not allocate, that the store keeps the newest packets,
+// and that they decode in order. Reports the encode time per packet and the stored bytes.
+// The codec delays the audio by its lookahead, so a decoded packet is compared with the
+// input shifted by OPUS_GET_LOOKAHEAD, not with the frame it was encoded from.
+#include "alloc_counter.h"
+#include "opus_preroll.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define SAMPLE_RATE 16000
+#define FRAME_MS 60
+#define FRAME_SAMPLES (SAMPLE_RATE / 1000 * FRAME_MS)
+// CONFIG_WAKE_WORD_PREROLL_MS / FRAME_MS
+#define MAX_PACKETS (2000 / FRAME_MS)
+#define FRAMES (10 * 1000 / FRAME_MS)
+// Mean square of a window with any of the tone in it; the noise alone is about 5500
+#define TONE_ENERGY 1e5
+// Largest difference between a decoded packet and its input window, in dB
+#define MAX_ENERGY_ERROR_DB 3
+
+// Every third frame is loud, so the order of the decoded packets is visible in their energy
+static bool IsLoud(int frame) {
+    return frame % 3 == 0;
+}
+
+static double Energy(const int16_t* pcm, size_t samples) {
+    double sum = 0;
+    for (size_t i = 0; i < samples; i++) {
+        sum += (double)pcm[i] * pcm[i];
+    }
+    return sum / samples;
+}
+
+int main() {
+    OpusPreroll preroll(SAMPLE_RATE, FRAME_MS, MAX_PACKETS);
+    if (!preroll.ready()) {
+        printf("FAIL: could not create the encoder\n");
+        return 1;
+    }
+
+    std::vector<int16_t> input(FRAMES * FRAME_SAMPLES);
+    uint32_t seed = 1;
+    double encode_ns = 0;
+    uint64_t allocations = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        int16_t* pcm = &input[frame * FRAME_SAMPLES];
+        for (int i = 0; i < FRAME_SAMPLES; i++) {
+            seed = seed * 1103515245 + 12345;
+            double t = (double)(frame * FRAME_SAMPLES + i) / SAMPLE_RATE;
+            double tone = IsLoud(frame) ? 12000 * sin(2 * M_PI * 440 * t) : 0;
+            pcm[i] = (int16_t)(tone + (int)((seed >> 16) & 0xff) - 128);
+        }
+        uint64_t before = AllocCounter::allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        bool encoded = preroll.Encode(pcm);
+        encode_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        allocations += AllocCounter::allocations.load() - before;
+        if (!encoded) {
+            printf("FAIL: frame %d was not encoded\n", frame);
+            return 1;
+        }
+    }
+    printf("%d frames of %d ms: %.1f us/packet, %zu packets kept, %zu bytes, %llu allocations\n", FRAMES,
+        FRAME_MS, encode_ns / FRAMES / 1000, preroll.packets(), preroll.bytes(), (unsigned long long)allocations);
+
+    bool ok = true;
+    if (allocations != 0) {
+        printf("FAIL: Encode() allocated\n");
+        ok = false;
+    }
+
+    std::list<std::vector<uint8_t>> packets;
+    preroll.Take(packets);
+    if (packets.size() != MAX_PACKETS || preroll.packets() != 0 || preroll.bytes() != 0) {
+        printf("FAIL: took %zu packets, %zu left\n", packets.size(), preroll.packets());
+        return 1;
+    }
+
+    // The packets are the last MAX_PACKETS frames, oldest first, each delayed by the lookahead
+    // of an encoder with the settings of OpusPreroll
+    int error;
+    OpusEncoder* encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+    opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(0));
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+    opus_encoder_destroy(encoder);
+
+    OpusDecoder* decoder = opus_decoder_create(SAMPLE_RATE, 1, &error);
+    std::vector<int16_t> decoded(FRAME_SAMPLES);
+    int frame = FRAMES - MAX_PACKETS;
+    int mismatches = 0;
+    double max_error_db = 0;
+    for (auto& packet : packets) {
+        int samples = opus_decode(decoder, packet.data(), packet.size(), decoded.data(), FRAME_SAMPLES, 0);
+        if (samples != FRAME_SAMPLES) {
+            printf("FAIL: packet of frame %d decoded to %d samples\n", frame, samples);
+            ok = false;
+            break;
+        }
+        // The decoder starts cold on the first packet
+        if (frame > FRAMES - MAX_PACKETS) {
+            double energy = Energy(decoded.data(), samples);
+            double expected = Energy(&input[frame * FRAME_SAMPLES - lookahead], FRAME_SAMPLES);
+            if (expected > TONE_ENERGY) {
+                double error_db = std::abs(10 * log10(energy / expected));
+                max_error_db = std::max(max_error_db, error_db);
+                if (error_db > MAX_ENERGY_ERROR_DB) {
+                    mismatches++;
+                }
+            } else if (energy > TONE_ENERGY) {
+                mismatches++;
+            }
+        }
+        frame++;
+    }
+    opus_decoder_destroy(decoder);
+    printf("%s, lookahead %d samples: decoded energy within %.2f dB of the input, %d frames out of order\n",
+        opus_get_version_string(), (int)lookahead, max_error_db, mismatches);
+    if (mismatches != 0) {
+        printf("FAIL: the decoded packets do not follow the input frames\n");
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
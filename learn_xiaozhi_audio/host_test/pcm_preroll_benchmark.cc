@@ -0,0 +1,90 @@
+// Memory and allocations of the wake word pre-roll in steady state: PcmPreroll against
+// the list of vectors it replaced. Exits with 1 when PcmPreroll allocates after
+// construction, its memory grows, or a snapshot does not hold the newest samples.
+#include "alloc_counter.h"
+#include "pcm_preroll.h"
+
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <vector>
+
+// One AFE fetch of 16kHz audio, 2s of history, and 10 minutes of detection
+#define CHUNK_SAMPLES 512
+#define PREROLL_SAMPLES (2000 * 16)
+#define CHUNKS (10 * 60 * 16000 / CHUNK_SAMPLES)
+
+struct Result {
+    uint64_t allocations;
+    int64_t min_bytes;
+    int64_t max_bytes;
+    double ns_per_chunk;
+};
+
+template <typename Store>
+static Result Measure(Store store) {
+    std::vector<int16_t> chunk(CHUNK_SAMPLES);
+    // Fill the history first, the steady state starts once the oldest chunk is dropped
+    for (int i = 0; i < PREROLL_SAMPLES / CHUNK_SAMPLES + 1; i++) {
+        store(chunk.data(), i);
+    }
+    Result result = {0, INT64_MAX, 0, 0};
+    uint64_t allocations = AllocCounter::allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CHUNKS; i++) {
+        chunk[0] = i;
+        store(chunk.data(), i);
+        int64_t bytes = AllocCounter::live_bytes.load();
+        result.min_bytes = std::min(result.min_bytes, bytes);
+        result.max_bytes = std::max(result.max_bytes, bytes);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    result.allocations = AllocCounter::allocations.load() - allocations;
+    result.ns_per_chunk = elapsed / CHUNKS;
+    return result;
+}
+
+static void Print(const char* name, const Result& result) {
+    printf("%-24s %8.2f allocations/chunk, live bytes %lld..%lld, %8.1f ns/chunk\n", name,
+        (double)result.allocations / CHUNKS, (long long)result.min_bytes, (long long)result.max_bytes,
+        result.ns_per_chunk);
+}
+
+int main() {
+    // What StoreWakeWordData used to do
+    std::list<std::vector<int16_t>> chunks;
+    auto list_result = Measure([&chunks](const int16_t* data, int) {
+        chunks.emplace_back(data, data + CHUNK_SAMPLES);
+        while (chunks.size() > PREROLL_SAMPLES / CHUNK_SAMPLES) {
+            chunks.pop_front();
+        }
+    });
+    chunks.clear();
+    Print("std::list<std::vector>", list_result);
+
+    PcmPreroll preroll(PREROLL_SAMPLES);
+    auto preroll_result = Measure([&preroll](const int16_t* data, int) {
+        preroll.Write(data, CHUNK_SAMPLES);
+    });
+    Print("PcmPreroll", preroll_result);
+
+    bool ok = true;
+    if (preroll_result.allocations != 0 || preroll_result.min_bytes != preroll_result.max_bytes) {
+        printf("FAIL: PcmPreroll allocated in steady state\n");
+        ok = false;
+    }
+
+    // The newest chunk starts CHUNK_SAMPLES from the end and holds the last index written
+    PcmSpan spans[2];
+    int count = preroll.Snapshot(PREROLL_SAMPLES, spans);
+    std::vector<int16_t> snapshot;
+    for (int i = 0; i < count; i++) {
+        snapshot.insert(snapshot.end(), spans[i].data, spans[i].data + spans[i].samples);
+    }
+    if (snapshot.size() != PREROLL_SAMPLES || snapshot[PREROLL_SAMPLES - CHUNK_SAMPLES] != (int16_t)(CHUNKS - 1)) {
+        printf("FAIL: snapshot of %zu samples in %d spans does not end with the newest chunk\n",
+            snapshot.size(), count);
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+// Runs a WAV file through the capture and playback path of the firmware on the host:
+// WavAudioCodec -> AudioAgc -> Resampler to 16kHz -> DummyAudioProcessor (VadDetector)
+// -> PcmPreroll and a ChunkQueue into a stub wake word model -> SpscRingBuffer
+// -> Resampler to the output rate -> output gain (AudioKernels) -> WavAudioCodec.
+// Frames are read, processed and played back in 30 ms steps like Application::OnAudioInput().
+// Reports the real-time factor, the time per frame of every stage, and the allocations
+// once the pipeline is warm, which must be none.
+//   pipeline_runner [input.wav [output.wav [model_us]]]
+// Without an input a deterministic 48kHz stereo file with five speech-like bursts is generated,
+// followed by a loud chunk after the audio that must not be read.
+// model_us is the cost of one stub model call, busy-waited, to try out a model budget.
+#include "alloc_counter.h"
+#include "wav_io.h"
+#include "wav_audio_codec.h"
+#include "audio_agc.h"
+#include "audio_kernels.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "dummy_audio_processor.h"
+#include "pcm_preroll.h"
+#include "chunk_queue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define FRAME_MS 30
+#define FRAME_SAMPLES (16000 / 1000 * FRAME_MS)
+#define PLAYBACK_FRAME_SAMPLES (16000 / 1000 * 20)
+// Frames run before the allocations are counted, the first ones size the scratch buffers
+#define WARMUP_FRAMES 10
+#define PREROLL_SAMPLES (16000 * 2)
+#define WAKENET_CHUNK 512
+#define WAKENET_QUEUE_CHUNKS 8
+
+#define SYNTHETIC_RATE 48000
+#define SYNTHETIC_CHANNELS 2
+#define SYNTHETIC_SECONDS 10
+#define SYNTHETIC_BURSTS 5
+
+using Clock = std::chrono::steady_clock;
+
+// Stands in for an esp-sr model interface (esp_wn_iface_t and friends): fixed chunks in,
+// a detection index out. Replace it to try another model or cost.
+class StubModel {
+public:
+    virtual ~StubModel() = default;
+    virtual size_t chunk_size() const = 0;
+    // 0 for nothing, else the index of the detected word, starting at 1
+    virtual int Detect(const int16_t* chunk) = 0;
+};
+
+// "Detects" a word at the start of every loud run, spending cost_us per chunk
+class EnergyModel : public StubModel {
+public:
+    explicit EnergyModel(int cost_us) : cost_us_(cost_us) {}
+
+    size_t chunk_size() const override { return WAKENET_CHUNK; }
+
+    int Detect(const int16_t* chunk) override {
+        auto until = Clock::now() + std::chrono::microseconds(cost_us_);
+        int64_t energy = 0;
+        for (size_t i = 0; i < WAKENET_CHUNK; i++) {
+            energy += (int32_t)chunk[i] * chunk[i];
+        }
+        bool loud = energy / WAKENET_CHUNK > 1000 * 1000;
+        int detected = loud && !loud_ ? 1 : 0;
+        loud_ = loud;
+        while (Clock::now() < until) {
+        }
+        return detected;
+    }
+
+private:
+    int cost_us_;
+    bool loud_ = false;
+};
+
+// Time per frame of one stage, in nanoseconds
+struct StageTime {
+    const char* name;
+    uint64_t count = 0;
+    double total_ns = 0;
+    double max_ns = 0;
+
+    void Record(Clock::time_point start, Clock::time_point end) {
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        count++;
+        total_ns += ns;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    void Print() const {
+        double average = count ? total_ns / count : 0;
+        printf("  %-12s avg %8.2f us  max %8.2f us  %6.3f%% of the frame time\n", name,
+            average / 1000, max_ns / 1000, average / (FRAME_MS * 1e6) * 100);
+    }
+};
+
+// Tone bursts with noise, one second on and one off after a quiet second
+static bool WriteSyntheticInput(const char* path) {
+    WavData wav;
+    wav.sample_rate = SYNTHETIC_RATE;
+    wav.channels = SYNTHETIC_CHANNELS;
+    wav.samples.resize(SYNTHETIC_RATE * SYNTHETIC_SECONDS * SYNTHETIC_CHANNELS);
+    uint32_t seed = 1;
+    for (size_t frame = 0; frame < wav.samples.size() / SYNTHETIC_CHANNELS; frame++) {
+        double t = (double)frame / SYNTHETIC_RATE;
+        bool burst = t >= 1 && (int)(t - 1) % 2 == 0 && (int)(t - 1) / 2 < SYNTHETIC_BURSTS;
+        for (int channel = 0; channel < SYNTHETIC_CHANNELS; channel++) {
+            seed = seed * 1103515245 + 12345;
+            double noise = (int)((seed >> 16) & 0xff) - 128;
+            double tone = burst ? 6000 * sin(2 * M_PI * (220 + 110 * channel) * t) : 0;
+            wav.samples[frame * SYNTHETIC_CHANNELS + channel] = (int16_t)(tone + noise);
+        }
+    }
+    if (!WriteWav(path, wav)) {
+        return false;
+    }
+
+    // Metadata after the data chunk, it would be heard as two seconds of loud noise
+    FILE* file = fopen(path, "r+b");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> trailer(SYNTHETIC_RATE * 2 * SYNTHETIC_CHANNELS * sizeof(int16_t), 0x5a);
+    uint32_t trailer_size = trailer.size();
+    uint32_t riff_size = 36 + wav.samples.size() * sizeof(int16_t) + 8 + trailer_size;
+    fseek(file, 0, SEEK_END);
+    fwrite("LIST", 1, 4, file);
+    fwrite(&trailer_size, 4, 1, file);
+    fwrite(trailer.data(), 1, trailer.size(), file);
+    fseek(file, 4, SEEK_SET);
+    fwrite(&riff_size, 4, 1, file);
+    return fclose(file) == 0;
+}
+
+int main(int argc, char** argv) {
+    const char* input_path = argc > 1 ? argv[1] : "pipeline_input.wav";
+    const char* output_path = argc > 2 ? argv[2] : "pipeline_output.wav";
+    int model_us = argc > 3 ? atoi(argv[3]) : 0;
+    bool synthetic = argc <= 1;
+    if (synthetic && !WriteSyntheticInput(input_path)) {
+        printf("FAIL: could not write %s\n", input_path);
+        return 1;
+    }
+
+    int64_t start_live_bytes = AllocCounter::live_bytes.load();
+    int speech_starts = 0;
+    int detections = 0;
+    uint64_t played = 0;
+    uint64_t processed = 0;
+    Clock::duration run_time;
+    uint64_t allocations = 0;
+    uint64_t frames = 0;
+    int input_rate, input_channels;
+    {
+        WavAudioCodec codec(input_path, output_path);
+        if (codec.failed()) {
+            printf("FAIL: could not open %s or %s\n", input_path, output_path);
+            return 1;
+        }
+        codec.Start();
+        input_rate = codec.input_sample_rate();
+        input_channels = codec.input_channels();
+        int channels = input_channels;
+
+        AudioAgc agc;
+        Resampler input_resampler;
+        input_resampler.Configure(input_rate, 16000, channels);
+        Resampler output_resampler;
+        output_resampler.Configure(16000, codec.output_sample_rate(), 1);
+        int32_t output_gain = AudioKernels::VolumeToGain(codec.output_volume());
+
+        DummyAudioProcessor processor;
+        processor.Initialize(&codec);
+        PcmPreroll preroll(PREROLL_SAMPLES);
+        EnergyModel model(model_us);
+        ChunkQueue chunks(model.chunk_size(), WAKENET_QUEUE_CHUNKS);
+        SpscRingBuffer<int16_t> audio_buffer(16000);
+        processor.OnVadStateChange([&speech_starts](bool speaking, uint64_t) {
+            speech_starts += speaking ? 1 : 0;
+        });
+        processor.OnOutputView([&](const int16_t* data, size_t samples) {
+            preroll.Write(data, samples);
+            chunks.Push(data, samples, 1);
+            audio_buffer.Write(data, samples);
+        });
+        processor.Start();
+
+        std::vector<int16_t> input(input_resampler.GetInputFrames(FRAME_SAMPLES) * channels);
+        std::vector<int16_t> frame(FRAME_SAMPLES * channels);
+        std::vector<int16_t> playback(PLAYBACK_FRAME_SAMPLES);
+        std::vector<int16_t> resampled(output_resampler.GetOutputFrames(PLAYBACK_FRAME_SAMPLES) + 1);
+        std::vector<int32_t> gained(resampled.size());
+        std::vector<int16_t> output(resampled.size());
+        StageTime stages[] = {{"read"}, {"agc"}, {"resample"}, {"processor"}, {"wake word"}, {"playback"}};
+
+        uint64_t warm_allocations = 0;
+        auto run_start = Clock::now();
+        while (true) {
+            if (frames == WARMUP_FRAMES) {
+                warm_allocations = AllocCounter::allocations.load();
+            }
+            auto t0 = Clock::now();
+            if (!codec.InputData(input)) {
+                break;
+            }
+            auto t1 = Clock::now();
+            agc.Process(input.data(), channels, false, input.size() / channels);
+            auto t2 = Clock::now();
+            int resampled_frames = input_resampler.Process(input.data(), input.size() / channels,
+                frame.data(), FRAME_SAMPLES);
+            auto t3 = Clock::now();
+            processor.Feed(frame.data(), resampled_frames * channels);
+            auto t4 = Clock::now();
+            while (const int16_t* chunk = chunks.Front()) {
+                detections += model.Detect(chunk) != 0 ? 1 : 0;
+                chunks.Pop();
+            }
+            auto t5 = Clock::now();
+            // Streaming playback in 20 ms frames, as with CONFIG_USE_STREAMING_PLAYBACK
+            while (audio_buffer.Available() >= PLAYBACK_FRAME_SAMPLES) {
+                audio_buffer.Read(playback.data(), PLAYBACK_FRAME_SAMPLES);
+                int n = output_resampler.Process(playback.data(), PLAYBACK_FRAME_SAMPLES,
+                    resampled.data(), resampled.size());
+                AudioKernels::ApplyGain(resampled.data(), gained.data(), n, output_gain);
+                AudioKernels::ShiftToInt16(gained.data(), output.data(), n, 16);
+                codec.OutputData(output.data(), n);
+                played += PLAYBACK_FRAME_SAMPLES;
+            }
+            auto t6 = Clock::now();
+
+            stages[0].Record(t0, t1);
+            stages[1].Record(t1, t2);
+            stages[2].Record(t2, t3);
+            stages[3].Record(t3, t4);
+            stages[4].Record(t4, t5);
+            stages[5].Record(t5, t6);
+            frames++;
+        }
+        run_time = Clock::now() - run_start;
+        if (frames > WARMUP_FRAMES) {
+            allocations = AllocCounter::allocations.load() - warm_allocations;
+        }
+        processor.Stop();
+
+        codec.Report();
+        double audio_ms = (double)frames * FRAME_MS;
+        double run_ms = std::chrono::duration<double, std::milli>(run_time).count();
+        printf("%s: %d Hz, %d channels, %llu frames of %d ms\n", input_path, input_rate, input_channels,
+            (unsigned long long)frames, FRAME_MS);
+        printf("Real-time factor %.4f (%.1f ms for %.0f ms of audio), %llu allocations after %d warm-up frames\n",
+            run_ms / audio_ms, run_ms, audio_ms, (unsigned long long)allocations, WARMUP_FRAMES);
+        printf("Time per frame:\n");
+        for (auto& stage : stages) {
+            stage.Print();
+        }
+        auto stats = processor.stats();
+        processed = stats.output_bytes / sizeof(int16_t);
+        printf("Processor: %u frames out, %u dropped, %u bytes copied; %d speech starts, %d wake words, "
+            "%u chunks dropped, %llu samples played\n", stats.output_frames, stats.dropped_frames, stats.copied_bytes,
+            speech_starts, detections, chunks.dropped(), (unsigned long long)played);
+    }
+    int64_t leaked = AllocCounter::live_bytes.load() - start_live_bytes;
+
+    bool ok = true;
+    if (allocations != 0) {
+        printf("FAIL: the warm pipeline allocated\n");
+        ok = false;
+    }
+    if (leaked != 0) {
+        printf("FAIL: %lld bytes still allocated after the run\n", (long long)leaked);
+        ok = false;
+    }
+    WavData output;
+    if (!ReadWav(output_path, output) || output.samples.empty()) {
+        printf("FAIL: %s is not a valid WAV file with audio\n", output_path);
+        ok = false;
+    }
+    if (synthetic) {
+        // Every burst is one speech run and one detection, nothing after the data chunk was
+        // read, and everything but the last partial playback frame was played back
+        if (speech_starts != SYNTHETIC_BURSTS || detections != SYNTHETIC_BURSTS) {
+            printf("FAIL: expected %d speech starts and wake words\n", SYNTHETIC_BURSTS);
+            ok = false;
+        }
+        if (frames != SYNTHETIC_SECONDS * 1000 / FRAME_MS) {
+            printf("FAIL: %llu frames were read\n", (unsigned long long)frames);
+            ok = false;
+        }
+        if (played + PLAYBACK_FRAME_SAMPLES <= processed) {
+            printf("FAIL: only %llu samples were played\n", (unsigned long long)played);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// Cost in ns per output sample and SNR of Resampler against a float reference sine,
+// for the ratios the codecs use. Exits with 1 when a ratio falls below its SNR bound.
+#include "resampler.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define BLOCK_MS 20
+#define SECONDS 10
+#define TONE_HZ 1000.0
+#define AMPLITUDE 16384.0
+
+struct Case {
+    int input_sample_rate;
+    int output_sample_rate;
+    double min_snr_db;
+};
+
+// Fits a * sin + b * cos + c at the tone frequency in double precision; everything the fit
+// does not explain is noise, distortion or aliasing
+static double MeasureSnr(const std::vector<int16_t>& output, int sample_rate, size_t skip) {
+    double w = 2 * M_PI * TONE_HZ / sample_rate;
+    size_t n = output.size() - skip;
+    double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, mean = 0;
+    for (size_t i = skip; i < output.size(); i++) {
+        double s = sin(w * i), c = cos(w * i);
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += output[i] * s;
+        yc += output[i] * c;
+        mean += output[i];
+    }
+    mean /= n;
+    double det = ss * cc - sc * sc;
+    double a = (ys * cc - yc * sc) / det;
+    double b = (yc * ss - ys * sc) / det;
+    double signal = 0, noise = 0;
+    for (size_t i = skip; i < output.size(); i++) {
+        double reference = a * sin(w * i) + b * cos(w * i) + mean;
+        signal += (reference - mean) * (reference - mean);
+        noise += (output[i] - reference) * (output[i] - reference);
+    }
+    return 10 * log10(signal / std::max(noise, 1e-9));
+}
+
+static bool Run(const Case& c) {
+    Resampler resampler;
+    resampler.Configure(c.input_sample_rate, c.output_sample_rate);
+
+    size_t input_frames = (size_t)c.input_sample_rate * SECONDS;
+    std::vector<int16_t> input(input_frames);
+    for (size_t i = 0; i < input_frames; i++) {
+        input[i] = lround(AMPLITUDE * sin(2 * M_PI * TONE_HZ * i / c.input_sample_rate));
+    }
+
+    // Same call pattern as Application::ReadAudio: a fixed output block per call
+    int block = c.output_sample_rate * BLOCK_MS / 1000;
+    std::vector<int16_t> output;
+    output.reserve((size_t)c.output_sample_rate * SECONDS);
+    std::vector<int16_t> scratch(block);
+    size_t consumed = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        size_t needed = resampler.GetInputFrames(block);
+        if (consumed + needed > input_frames) {
+            break;
+        }
+        int produced = resampler.Process(&input[consumed], needed, scratch.data(), block);
+        consumed += needed;
+        output.insert(output.end(), scratch.begin(), scratch.begin() + produced);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    double ns_per_sample = elapsed / output.size();
+    double snr = MeasureSnr(output, c.output_sample_rate, c.output_sample_rate / 100);
+    bool ok = snr >= c.min_snr_db;
+    printf("%6d -> %6d Hz: %8.1f ns/sample, SNR %5.1f dB (min %.0f) %s\n", c.input_sample_rate,
+        c.output_sample_rate, ns_per_sample, snr, c.min_snr_db, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main() {
+    const Case cases[] = {
+        {16000, 16000, 60},
+        {24000, 16000, 60},
+        {48000, 16000, 60},
+        {44100, 16000, 60},
+        {16000, 24000, 60},
+        {16000, 48000, 60},
+        {22050, 16000, 60},
+    };
+    bool ok = true;
+    for (auto& c : cases) {
+        ok = Run(c) && ok;
+    }
+    return ok ? 0 : 1;
+}
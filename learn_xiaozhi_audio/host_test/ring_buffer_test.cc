@@ -0,0 +1,178 @@
+// SpscRingBuffer between a producer and a consumer thread, the way the codec tasks and the
+// application share it. Every element is its position in the produced stream, frames are
+// 1 to 64 elements long and the capacity is no multiple of them, so the positions wrap at
+// every possible offset. Both sides alternate the copying calls with the span calls.
+//  - lossless: each side waits until a whole frame fits or is there; every element arrives
+//    once and in order, and nothing is counted as an overrun or an underrun;
+//  - lossy: neither side waits for the other, both only yield after every frame like two
+//    tasks of one priority, and the consumer stalls for a millisecond now and then; elements arrive in order with gaps exactly where the producer
+//    dropped, and the counters match what the two sides saw.
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define CAPACITY 1000
+#define FRAMES 2000000
+#define MAX_FRAME 64
+
+struct Result {
+    // Seen by the producer
+    uint64_t produced = 0;
+    uint32_t short_writes = 0;
+    uint64_t dropped = 0;
+    // Seen by the consumer
+    uint64_t received = 0;
+    uint32_t short_reads = 0;
+    // Elements missing before a received one
+    uint64_t gaps = 0;
+    uint32_t expected = 0;
+    uint64_t out_of_order = 0;
+};
+
+// Frame lengths from a fixed sequence, the same on every run
+static inline size_t FrameLength(uint64_t frame) {
+    return 1 + (frame * 2654435761u >> 7) % MAX_FRAME;
+}
+
+static bool Run(bool lossless) {
+    SpscRingBuffer<uint32_t> ring(CAPACITY);
+    Result result;
+    std::atomic<bool> done{false};
+
+    std::thread producer([&]() {
+        uint32_t frame[MAX_FRAME];
+        uint32_t next = 0;
+        for (uint64_t i = 0; i < FRAMES; i++) {
+            size_t length = FrameLength(i);
+            for (size_t j = 0; j < length; j++) {
+                frame[j] = next++;
+            }
+            if (lossless) {
+                while (ring.Free() < length) {
+                    std::this_thread::yield();
+                }
+            }
+            size_t written;
+            if (i % 2 == 0) {
+                written = ring.Write(frame, length);
+            } else {
+                // The TX path: fill the spans in place
+                written = 0;
+                uint32_t* span;
+                size_t n;
+                while (written < length && (n = std::min(ring.GetWriteSpan(&span), length - written)) > 0) {
+                    memcpy(span, frame + written, n * sizeof(uint32_t));
+                    ring.CommitWrite(n);
+                    written += n;
+                }
+                if (written < length) {
+                    // Only Write() drops and counts, a span writer keeps the rest for later:
+                    // it is produced again with the next frame
+                    next -= length - written;
+                    result.produced += written;
+                    continue;
+                }
+            }
+            result.produced += length;
+            if (written < length) {
+                result.short_writes++;
+                result.dropped += length - written;
+            }
+            if (!lossless) {
+                std::this_thread::yield();
+            }
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    std::thread consumer([&]() {
+        uint32_t frame[MAX_FRAME];
+        uint32_t expected = 0;
+        auto take = [&](const uint32_t* data, size_t n) {
+            for (size_t j = 0; j < n; j++) {
+                if (data[j] < expected) {
+                    result.out_of_order++;
+                } else {
+                    result.gaps += data[j] - expected;
+                }
+                expected = data[j] + 1;
+            }
+            result.received += n;
+        };
+        for (uint64_t i = 0;; i++) {
+            bool finished = done.load(std::memory_order_acquire);
+            size_t length = FrameLength(i + 7);
+            if (lossless && ring.Available() < length) {
+                if (finished && ring.Available() == 0) {
+                    break;
+                }
+                if (!finished) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                length = ring.Available();
+            }
+            if (i % 3 == 0) {
+                // The RX path: process in place and release
+                const uint32_t* span;
+                size_t n = std::min(ring.GetReadSpan(&span), length);
+                take(span, n);
+                ring.CommitRead(n);
+                if (!lossless && n == 0 && finished) {
+                    break;
+                }
+            } else {
+                size_t n = ring.Read(frame, length);
+                take(frame, n);
+                if (n < length) {
+                    result.short_reads++;
+                    if (!lossless && finished && ring.Available() == 0) {
+                        break;
+                    }
+                }
+            }
+            if (!lossless) {
+                if (i % 10000 == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                std::this_thread::yield();
+            }
+        }
+        result.expected = expected;
+    });
+
+    producer.join();
+    consumer.join();
+    // Dropped after the last element received
+    result.gaps += result.produced - result.expected;
+
+    bool ok = result.out_of_order == 0 && result.received + result.dropped == result.produced &&
+        result.gaps == result.dropped && ring.overruns() == result.short_writes &&
+        ring.dropped() == result.dropped && ring.underruns() == result.short_reads;
+    if (lossless) {
+        ok = ok && result.short_writes == 0 && result.short_reads == 0 && result.gaps == 0;
+    } else {
+        // Both sides must have run dry, or the lossy case checked nothing
+        ok = ok && result.short_writes > 0 && result.short_reads > 0;
+    }
+    printf("%-8s %10llu elements received, %8llu dropped in %6u overruns, %7u underruns, %llu out of order %s\n",
+        lossless ? "lossless" : "lossy", (unsigned long long)result.received, (unsigned long long)result.dropped,
+        (unsigned)ring.overruns(), (unsigned)ring.underruns(), (unsigned long long)result.out_of_order,
+        ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main() {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = Run(true);
+    ok = Run(false) && ok;
+    printf("%d frames per case in %.1f s\n", FRAMES,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 2);
+    return ok ? 0 : 1;
+}
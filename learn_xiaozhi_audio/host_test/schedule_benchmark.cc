@@ -0,0 +1,293 @@
+// Application::Schedule() before and after TaskQueue, with the main loop in its own thread
+// woken through a stand-in for the event group:
+//  - list: a std::function pushed onto a std::list under a mutex, the main loop moves the
+//    whole list out and runs it, as Schedule() and MainEventLoop() did before;
+//  - queue: an InlineTask pushed onto a TaskQueue<MainTask, 32> without a lock, the main
+//    loop pops and runs one at a time, as they do now.
+// Allocations per call, counted by alloc_counter.h from one thread, for the captures of the
+// call sites: [this] like the clock timer, [this, wake_word, threshold] like the wake word
+// callback, and a 96-byte capture that needs a pool block, with at most 16 tasks queued and
+// with a full queue, which runs out of pool blocks. Then the schedule-to-run latency
+// with PRODUCERS threads scheduling [this]-sized tasks at once; a full queue is retried.
+// Checks that every task runs once and in the order of its producer, and that the queue does
+// not allocate.
+#include "alloc_counter.h"
+#include "task_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PRODUCERS 3
+#define TASKS_PER_PRODUCER 100000
+#define CALLS 10000
+
+using Clock = std::chrono::steady_clock;
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// xEventGroupSetBits() and xEventGroupWaitBits() with one bit and clear on exit
+class EventBit {
+public:
+    void Set() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        set_ = true;
+        cv_.notify_one();
+    }
+
+    // False once stopped and nothing is set
+    bool Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return set_ || stopped_; });
+        bool was_set = set_;
+        set_ = false;
+        return was_set;
+    }
+
+    void Stop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        cv_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool set_ = false;
+    bool stopped_ = false;
+};
+
+class ListScheduler {
+public:
+    void Schedule(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        main_tasks_.push_back(std::move(callback));
+        event_.Set();
+    }
+
+    void Loop() {
+        while (event_.Wait()) {
+            RunAll();
+        }
+        RunAll();
+    }
+
+    void Stop() { event_.Stop(); }
+
+private:
+    std::mutex mutex_;
+    std::list<std::function<void()>> main_tasks_;
+    EventBit event_;
+
+    void RunAll() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::list<std::function<void()>> tasks = std::move(main_tasks_);
+        lock.unlock();
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+};
+
+class QueueScheduler {
+public:
+    bool Schedule(InlineTask callback) {
+        MainTask task{std::move(callback)};
+        if (!main_tasks_.Push(std::move(task))) {
+            return false;
+        }
+        event_.Set();
+        return true;
+    }
+
+    void Loop() {
+        while (event_.Wait()) {
+            RunAll();
+        }
+        RunAll();
+    }
+
+    void Stop() { event_.Stop(); }
+
+private:
+    struct MainTask {
+        InlineTask callback;
+    };
+    TaskQueue<MainTask, 32> main_tasks_;
+    EventBit event_;
+    MainTask task_;
+
+    void RunAll() {
+        while (main_tasks_.Pop(task_)) {
+            task_.callback();
+            task_.callback.Reset();
+        }
+    }
+};
+
+// Keeps the callbacks from being optimized away
+static volatile uint64_t sink;
+static std::atomic<uint64_t> tasks_run{0};
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+// Schedules and runs CALLS tasks from one thread, returns allocations per call.
+// With a backlog the caller waits while that many tasks are queued, else it only waits for a full queue.
+template <typename Scheduler, typename MakeTask>
+static double AllocationsPerCall(MakeTask&& make_task, uint64_t backlog = 0) {
+    Scheduler scheduler;
+    std::thread loop(&Scheduler::Loop, &scheduler);
+    // Everything scheduled before has run, Loop() finished it
+    const uint64_t start = tasks_run.load();
+    const int warmup = 100;
+    uint64_t allocations = 0;
+    // The first calls warm up the thread and the std::list or queue, they are not counted
+    for (int i = -warmup; i < CALLS; i++) {
+        // Building the lambdas allocates nothing, the wake word fits the small string buffer
+        uint64_t before = AllocCounter::allocations.load();
+        while (!scheduler.Schedule(make_task(i + warmup))) {
+            std::this_thread::yield();
+        }
+        if (i >= 0) {
+            allocations += AllocCounter::allocations.load() - before;
+        }
+        while (backlog > 0 && start + warmup + i + 1 - tasks_run.load() >= backlog) {
+            std::this_thread::yield();
+        }
+    }
+    scheduler.Stop();
+    loop.join();
+    return (double)allocations / CALLS;
+}
+
+struct Latency {
+    std::vector<int64_t> ns;
+    uint64_t out_of_order = 0;
+    uint64_t retries = 0;
+};
+
+template <typename Scheduler>
+static Latency ScheduleToRun() {
+    Scheduler scheduler;
+    Latency latency;
+    latency.ns.reserve(PRODUCERS * TASKS_PER_PRODUCER);
+    // Only written by the main loop
+    uint32_t next[PRODUCERS] = {};
+    std::thread loop(&Scheduler::Loop, &scheduler);
+    std::atomic<uint64_t> retries{0};
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&, p]() {
+            for (uint32_t i = 0; i < TASKS_PER_PRODUCER; i++) {
+                auto callback = [&latency, &next, p, i, scheduled = NowNs()]() {
+                    latency.ns.push_back(NowNs() - scheduled);
+                    latency.out_of_order += next[p] != i;
+                    next[p] = i + 1;
+                };
+                while (!scheduler.Schedule(callback)) {
+                    retries++;
+                    std::this_thread::yield();
+                }
+                if (i % 16 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    scheduler.Stop();
+    loop.join();
+    latency.retries = retries.load();
+    return latency;
+}
+
+// The list path never refuses a task
+struct ListSchedulerAdapter : ListScheduler {
+    template <typename F>
+    bool Schedule(F&& callback) {
+        ListScheduler::Schedule(std::forward<F>(callback));
+        return true;
+    }
+};
+
+static void PrintLatency(const char* name, Latency& latency) {
+    auto& ns = latency.ns;
+    std::sort(ns.begin(), ns.end());
+    auto at = [&ns](double q) { return ns.empty() ? 0.0 : ns[std::min(ns.size() - 1, (size_t)(q * ns.size()))] / 1000.0; };
+    printf("%-6s %8zu tasks, schedule to run p50 %8.1f us, p99 %8.1f us, max %9.1f us, %llu retries on a full queue\n",
+        name, ns.size(), at(0.5), at(0.99), ns.empty() ? 0.0 : ns.back() / 1000.0, (unsigned long long)latency.retries);
+}
+
+int main() {
+    bool ok = true;
+    void* self = &ok;
+    std::string wake_word = "hi esp";
+    float threshold = 0.9f;
+    struct Large {
+        char bytes[96];
+    } large = {};
+
+    auto clock_task = [self](int i) {
+        return [self, i]() {
+            sink = sink + (uintptr_t)self + i;
+            tasks_run++;
+        };
+    };
+    auto wake_word_task = [self, &wake_word, threshold](int) {
+        return [self, wake_word, threshold]() {
+            sink = sink + (uintptr_t)self + wake_word.size() + (int)threshold;
+            tasks_run++;
+        };
+    };
+    auto large_task = [&large](int i) {
+        return [large, i]() {
+            sink = sink + large.bytes[i % 96];
+            tasks_run++;
+        };
+    };
+
+    double list_clock = AllocationsPerCall<ListSchedulerAdapter>(clock_task);
+    double queue_clock = AllocationsPerCall<QueueScheduler>(clock_task);
+    double list_wake = AllocationsPerCall<ListSchedulerAdapter>(wake_word_task);
+    double queue_wake = AllocationsPerCall<QueueScheduler>(wake_word_task);
+    double list_large = AllocationsPerCall<ListSchedulerAdapter>(large_task, InlineTask::kPoolBlocks);
+    double queue_large = AllocationsPerCall<QueueScheduler>(large_task, InlineTask::kPoolBlocks);
+    uint32_t heap_before_burst = InlineTask::heap_allocations();
+    double list_burst = AllocationsPerCall<ListSchedulerAdapter>(large_task);
+    double queue_burst = AllocationsPerCall<QueueScheduler>(large_task);
+    printf("%-32s %10s %10s\n", "allocations per Schedule()", "list", "queue");
+    printf("%-32s %10.2f %10.2f\n", "[this, i], 16 bytes", list_clock, queue_clock);
+    printf("%-32s %10.2f %10.2f\n", "[this, wake_word, threshold]", list_wake, queue_wake);
+    printf("%-32s %10.2f %10.2f\n", "96 bytes, up to 16 queued", list_large, queue_large);
+    // The pool has fewer blocks than the queue has entries, a longer backlog goes to the heap
+    printf("%-32s %10.2f %10.2f\n", "96 bytes, up to 32 queued", list_burst, queue_burst);
+    ok = Check(queue_clock == 0 && queue_wake == 0 && queue_large == 0, "the queue allocates for none of them") && ok;
+    ok = Check(list_clock >= 1 && list_wake >= 1 && list_large >= 1, "the list allocates a node or more per call") && ok;
+    ok = Check(heap_before_burst == 0 && InlineTask::pooled() == 0,
+        "no capture went to the heap within the pool, every block came back") && ok;
+
+    Latency list = ScheduleToRun<ListSchedulerAdapter>();
+    Latency queue = ScheduleToRun<QueueScheduler>();
+    PrintLatency("list", list);
+    PrintLatency("queue", queue);
+    ok = Check(list.ns.size() == PRODUCERS * TASKS_PER_PRODUCER && queue.ns.size() == PRODUCERS * TASKS_PER_PRODUCER,
+        "every task ran once") && ok;
+    ok = Check(list.out_of_order == 0 && queue.out_of_order == 0, "in the order its producer scheduled it") && ok;
+    return ok ? 0 : 1;
+}
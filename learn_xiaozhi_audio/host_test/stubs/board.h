@@ -0,0 +1,6 @@
+#ifndef _BOARD_H
+#define _BOARD_H
+
+// The host runner has no board, the codec is created directly
+
+#endif // _BOARD_H
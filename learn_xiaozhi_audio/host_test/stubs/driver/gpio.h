@@ -0,0 +1,10 @@
+#ifndef _DRIVER_GPIO_H
+#define _DRIVER_GPIO_H
+
+// Host stand-in, only the pin numbers the codec constructors take
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+} gpio_num_t;
+
+#endif // _DRIVER_GPIO_H
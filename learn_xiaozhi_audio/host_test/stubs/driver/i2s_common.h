@@ -0,0 +1,156 @@
+#ifndef _DRIVER_I2S_COMMON_H
+#define _DRIVER_I2S_COMMON_H
+
+// Host stand-in for the I2S channels. There are two ports with a TX and an RX channel
+// each; the test sets what a read returns and where the written data goes through the
+// source and sink of a channel, see i2s_host_channel(). Reads and writes never block.
+#include <esp_err.h>
+#include <driver/gpio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#define I2S_GPIO_UNUSED GPIO_NUM_NC
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1 = 1,
+    I2S_NUM_MAX,
+} i2s_port_t;
+
+typedef enum {
+    I2S_ROLE_MASTER,
+    I2S_ROLE_SLAVE,
+} i2s_role_t;
+
+typedef enum {
+    I2S_DIR_RX = 0,
+    I2S_DIR_TX = 1,
+} i2s_dir_t;
+
+typedef enum {
+    I2S_DATA_BIT_WIDTH_8BIT = 8,
+    I2S_DATA_BIT_WIDTH_16BIT = 16,
+    I2S_DATA_BIT_WIDTH_24BIT = 24,
+    I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+
+typedef enum {
+    I2S_SLOT_BIT_WIDTH_AUTO = 0,
+    I2S_SLOT_BIT_WIDTH_16BIT = 16,
+    I2S_SLOT_BIT_WIDTH_32BIT = 32,
+} i2s_slot_bit_width_t;
+
+typedef enum {
+    I2S_SLOT_MODE_MONO = 1,
+    I2S_SLOT_MODE_STEREO = 2,
+} i2s_slot_mode_t;
+
+typedef enum {
+    I2S_CLK_SRC_DEFAULT,
+} i2s_clock_src_t;
+
+typedef enum {
+    I2S_MCLK_MULTIPLE_128 = 128,
+    I2S_MCLK_MULTIPLE_256 = 256,
+} i2s_mclk_multiple_t;
+
+typedef struct {
+    i2s_port_t id;
+    i2s_role_t role;
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_num;
+    bool auto_clear_after_cb;
+    bool auto_clear_before_cb;
+    int intr_priority;
+} i2s_chan_config_t;
+
+#define I2S_CHANNEL_DEFAULT_CONFIG(i2s_num, i2s_role) {                         \
+    .id = i2s_num,                                                              \
+    .role = i2s_role,                                                           \
+    .dma_desc_num = 6,                                                          \
+    .dma_frame_num = 240,                                                       \
+    .auto_clear_after_cb = false,                                               \
+    .auto_clear_before_cb = false,                                              \
+    .intr_priority = 0,                                                         \
+}
+
+typedef struct {
+    void* data;
+    size_t size;
+} i2s_event_data_t;
+
+struct i2s_channel_obj_t {
+    i2s_chan_config_t config = {};
+    bool created = false;
+    bool enabled = false;
+    // Fills a read of `bytes`, zeros when not set
+    std::function<void(void* dest, size_t bytes)> source;
+    // Takes what was written, dropped when not set
+    std::function<void(const void* src, size_t bytes)> sink;
+    // Caps the bytes a single read returns, 0 for no cap
+    size_t max_read_bytes = 0;
+};
+typedef struct i2s_channel_obj_t* i2s_chan_handle_t;
+
+inline i2s_channel_obj_t* i2s_host_channel(i2s_port_t port, i2s_dir_t dir) {
+    static i2s_channel_obj_t channels[I2S_NUM_MAX][2];
+    return &channels[port][dir];
+}
+
+// Creating a channel resets it, source and sink included
+inline esp_err_t i2s_new_channel(const i2s_chan_config_t* config, i2s_chan_handle_t* tx_handle,
+    i2s_chan_handle_t* rx_handle) {
+    for (auto dir : {I2S_DIR_TX, I2S_DIR_RX}) {
+        auto handle = dir == I2S_DIR_TX ? tx_handle : rx_handle;
+        if (handle == nullptr) {
+            continue;
+        }
+        auto channel = i2s_host_channel(config->id, dir);
+        *channel = i2s_channel_obj_t();
+        channel->config = *config;
+        channel->created = true;
+        *handle = channel;
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t i2s_channel_enable(i2s_chan_handle_t handle) {
+    handle->enabled = true;
+    return ESP_OK;
+}
+
+inline esp_err_t i2s_channel_disable(i2s_chan_handle_t handle) {
+    handle->enabled = false;
+    return ESP_OK;
+}
+
+inline esp_err_t i2s_channel_read(i2s_chan_handle_t handle, void* dest, size_t size, size_t* bytes_read,
+    uint32_t timeout_ms) {
+    (void)timeout_ms;
+    if (handle->max_read_bytes > 0) {
+        size = std::min(size, handle->max_read_bytes);
+    }
+    if (handle->source) {
+        handle->source(dest, size);
+    } else {
+        memset(dest, 0, size);
+    }
+    *bytes_read = size;
+    return ESP_OK;
+}
+
+inline esp_err_t i2s_channel_write(i2s_chan_handle_t handle, const void* src, size_t size, size_t* bytes_written,
+    uint32_t timeout_ms) {
+    (void)timeout_ms;
+    if (handle->sink) {
+        handle->sink(src, size);
+    }
+    *bytes_written = size;
+    return ESP_OK;
+}
+
+#endif // _DRIVER_I2S_COMMON_H
@@ -0,0 +1,7 @@
+#ifndef _DRIVER_I2S_PDM_H
+#define _DRIVER_I2S_PDM_H
+
+// Host stand-in, SOC_I2S_SUPPORTS_PDM_RX is not defined so the PDM microphone is not built
+#include <driver/i2s_common.h>
+
+#endif // _DRIVER_I2S_PDM_H
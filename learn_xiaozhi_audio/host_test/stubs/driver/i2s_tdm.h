@@ -0,0 +1,7 @@
+#ifndef _DRIVER_I2S_TDM_H
+#define _DRIVER_I2S_TDM_H
+
+// Host stand-in, SOC_I2S_SUPPORTS_TDM is not defined so the TDM microphone array is not built
+#include <driver/i2s_common.h>
+
+#endif // _DRIVER_I2S_TDM_H
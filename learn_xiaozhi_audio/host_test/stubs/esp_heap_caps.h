@@ -0,0 +1,59 @@
+#ifndef _ESP_HEAP_CAPS_H
+#define _ESP_HEAP_CAPS_H
+
+// Host stand-in for the capability allocator. It goes through operator new, so the
+// allocation counters of the benchmarks see these buffers too.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// Every block starts with its size, for heap_caps_realloc()
+constexpr size_t kHeapCapsHeader = alignof(std::max_align_t);
+
+inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    auto block = static_cast<unsigned char*>(::operator new(size + kHeapCapsHeader, std::nothrow));
+    if (block == nullptr) {
+        return nullptr;
+    }
+    *reinterpret_cast<size_t*>(block) = size;
+    return block + kHeapCapsHeader;
+}
+
+inline void heap_caps_free(void* ptr) {
+    if (ptr != nullptr) {
+        ::operator delete(static_cast<unsigned char*>(ptr) - kHeapCapsHeader);
+    }
+}
+
+// Always moves the block, like a realloc that can not grow in place
+inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) {
+    void* block = heap_caps_malloc(size, caps);
+    if (block == nullptr || ptr == nullptr) {
+        return block;
+    }
+    size_t old_size = *reinterpret_cast<size_t*>(static_cast<unsigned char*>(ptr) - kHeapCapsHeader);
+    memcpy(block, ptr, std::min(size, old_size));
+    heap_caps_free(ptr);
+    return block;
+}
+
+// There is no fixed heap on the host
+inline size_t heap_caps_get_free_size(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
+
+inline size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    (void)caps;
+    return 0;
+}
+
+#endif // _ESP_HEAP_CAPS_H
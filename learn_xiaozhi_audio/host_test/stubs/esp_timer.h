@@ -0,0 +1,13 @@
+#ifndef _ESP_TIMER_H
+#define _ESP_TIMER_H
+
+// Host stand-in for the microsecond timer
+#include <chrono>
+#include <cstdint>
+
+inline int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // _ESP_TIMER_H
@@ -0,0 +1,18 @@
+#ifndef _FREERTOS_H
+#define _FREERTOS_H
+
+// Host stand-in for the FreeRTOS types used by the audio code, one tick per millisecond.
+// Like the real header it pulls in the configuration.
+#include <sdkconfig.h>
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+
+#endif // _FREERTOS_H
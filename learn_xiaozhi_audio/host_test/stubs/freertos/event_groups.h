@@ -0,0 +1,8 @@
+#ifndef _FREERTOS_EVENT_GROUPS_H
+#define _FREERTOS_EVENT_GROUPS_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct EventGroupDef_t* EventGroupHandle_t;
+
+#endif // _FREERTOS_EVENT_GROUPS_H
@@ -0,0 +1,26 @@
+#ifndef _FREERTOS_TASK_H
+#define _FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct tskTaskControlBlock* TaskHandle_t;
+
+// Offline runs go as fast as the host allows, nothing waits
+inline void vTaskDelay(TickType_t ticks) {
+    (void)ticks;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return nullptr;
+}
+
+inline BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry, uint32_t bits_to_clear_on_exit,
+    uint32_t* notification_value, TickType_t ticks_to_wait) {
+    (void)bits_to_clear_on_entry;
+    (void)bits_to_clear_on_exit;
+    (void)notification_value;
+    (void)ticks_to_wait;
+    return pdFALSE;
+}
+
+#endif // _FREERTOS_TASK_H
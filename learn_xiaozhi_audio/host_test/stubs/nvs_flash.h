@@ -0,0 +1,9 @@
+#ifndef _NVS_FLASH_H
+#define _NVS_FLASH_H
+
+// Host stand-in, only the handle type Settings keeps; see host_settings.cc
+#include <cstdint>
+
+typedef uint32_t nvs_handle_t;
+
+#endif // _NVS_FLASH_H
@@ -0,0 +1,10 @@
+#ifndef _SDKCONFIG_H
+#define _SDKCONFIG_H
+
+// Host stand-in for the generated configuration, the Kconfig.projbuild defaults
+#define CONFIG_VAD_ATTACK_MS 30
+#define CONFIG_VAD_HANGOVER_MS 300
+// The stub vTaskDelay() does not wait, so WavAudioCodec runs as fast as it can
+#define CONFIG_WAV_AUDIO_SPEED 100
+
+#endif // _SDKCONFIG_H
@@ -0,0 +1,196 @@
+// VadDetector with the Kconfig defaults, 30 ms attack and 300 ms hangover at 16kHz.
+//  - Update(), as AfeAudioProcessor drives it with the AFE decision per 512-sample chunk
+//    and as Process() does per 10 ms frame: speech starts on the frame that completes the
+//    attack and ends on the one that completes the hangover, not a frame earlier; a run
+//    broken by one frame starts over; the events carry the first sample of the run;
+//  - Process() on a simulated 16kHz stream fed in uneven pieces, mono and with a second
+//    channel that must be ignored: tone bursts start and end on known samples, a burst
+//    shorter than the attack and loud hiss are not speech, pauses shorter than the
+//    hangover do not end it.
+// Then cycles (TSC on x86, else ns) per 10 ms frame of Process(), and the real-time factor.
+#include "vad_detector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#define CYCLE_UNIT "TSC cycles"
+#else
+#define CYCLES() (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count()
+#define CYCLE_UNIT "ns"
+#endif
+
+#define SAMPLE_RATE 16000
+#define FRAME 160
+#define AFE_CHUNK 512
+#define ATTACK (SAMPLE_RATE * CONFIG_VAD_ATTACK_MS / 1000)
+#define HANGOVER (SAMPLE_RATE * CONFIG_VAD_HANGOVER_MS / 1000)
+#define BENCHMARK_SECONDS 600
+
+// Keeps the benchmark loop from being optimized away
+static volatile bool sink;
+
+struct Event {
+    bool speaking;
+    uint64_t sample;
+    // position() when the event was raised
+    uint64_t at;
+
+    bool operator==(const Event& other) const {
+        return speaking == other.speaking && sample == other.sample && at == other.at;
+    }
+};
+
+static bool Check(bool condition, const char* what) {
+    printf("%-72s %s\n", what, condition ? "ok" : "FAIL");
+    return condition;
+}
+
+static void Record(VadDetector& vad, std::vector<Event>& events) {
+    vad.OnStateChange([&vad, &events](bool speaking, uint64_t sample) {
+        events.push_back({speaking, sample, vad.position()});
+    });
+}
+
+// Runs of speech (true) or silence, in blocks of `block` samples
+static void Feed(VadDetector& vad, std::initializer_list<std::pair<bool, int>> runs, size_t block) {
+    for (auto& run : runs) {
+        for (int i = 0; i < run.second; i++) {
+            vad.Update(run.first, block);
+        }
+    }
+}
+
+static bool UpdateTiming(size_t block) {
+    bool ok = true;
+    VadDetector vad(SAMPLE_RATE);
+    std::vector<Event> events;
+    Record(vad, events);
+    const int attack = (ATTACK + block - 1) / block;
+    const int hangover = (HANGOVER + block - 1) / block;
+    char what[96];
+
+    // One block short of the attack, broken by silence, then one block short again
+    Feed(vad, {{false, 3}, {true, attack - 1}, {false, 1}, {true, attack - 1}}, block);
+    snprintf(what, sizeof(what), "%zu-sample blocks: a run one block short of the attack is no speech", block);
+    ok = Check(events.empty() && !vad.speaking(), what) && ok;
+    // The next block completes it: speaking from the first block of the run
+    uint64_t start = (3 + attack) * block;
+    Feed(vad, {{true, 1}}, block);
+    ok = Check(events.size() == 1 && events[0] == Event{true, start, start + attack * block},
+        "  speaking on the block that completes the attack, from the run's first sample") && ok;
+
+    // Pauses one block short of the hangover keep it speaking
+    Feed(vad, {{true, 5}, {false, hangover - 1}, {true, 1}, {false, hangover - 1}, {true, 2}}, block);
+    ok = Check(events.size() == 1 && vad.speaking(), "  a pause one block short of the hangover does not end it") && ok;
+    uint64_t end = vad.position();
+    Feed(vad, {{false, hangover - 1}}, block);
+    ok = Check(events.size() == 1, "  nor does silence until one block before the hangover") && ok;
+    Feed(vad, {{false, 1}}, block);
+    ok = Check(events.size() == 2 && events[1] == Event{false, end, end + hangover * block},
+        "  silence on the block that completes it, from the last speech sample") && ok;
+
+    vad.Reset();
+    events.clear();
+    Feed(vad, {{true, attack}}, block);
+    ok = Check(events.size() == 1 && events[0] == Event{true, 0, attack * block},
+        "  Reset() starts the positions over") && ok;
+    return ok;
+}
+
+// Bursts of a 300 Hz tone in low noise, fed in pieces of 1 to 997 frames
+static bool ProcessTimestamps(int channels) {
+    struct Burst {
+        uint64_t start;
+        uint64_t end;
+    };
+    // Whole seconds of frames, the short one is under the attack, the gap under the hangover
+    const Burst speech[] = {{16000, 32000}, {40000, 40000 + ATTACK - FRAME}, {56000, 64000}, {64000 + HANGOVER - FRAME,
+        80000}};
+    const uint64_t hiss_start = 96000, hiss_end = 112000;
+    const uint64_t total = 128000;
+
+    std::vector<int16_t> pcm(total * channels);
+    uint32_t seed = 7;
+    for (uint64_t n = 0; n < total; n++) {
+        bool tone = false;
+        for (auto& burst : speech) {
+            tone = tone || (n >= burst.start && n < burst.end);
+        }
+        seed = seed * 1664525 + 1013904223;
+        int noise = (int)(seed >> 24) - 128;
+        double value = tone ? 3000 * sin(2 * M_PI * 300 * n / SAMPLE_RATE) : noise / 4;
+        if (n >= hiss_start && n < hiss_end) {
+            // Loud, but it crosses zero at almost every sample
+            value = (n % 2 ? 1 : -1) * (2000 + noise * 8);
+        }
+        pcm[n * channels] = (int16_t)value;
+        for (int c = 1; c < channels; c++) {
+            // A loud second channel, the detector only listens to the first
+            pcm[n * channels + c] = (int16_t)(8000 * sin(2 * M_PI * 200 * n / SAMPLE_RATE));
+        }
+    }
+
+    VadDetector vad(SAMPLE_RATE);
+    std::vector<Event> events;
+    Record(vad, events);
+    for (uint64_t n = 0, piece = 1; n < total; piece = piece * 31 % 997 + 1) {
+        uint64_t frames = std::min<uint64_t>(piece, total - n);
+        vad.Process(pcm.data() + n * channels, frames * channels, channels);
+        n += frames;
+    }
+
+    // The bursts are whole frames: the first and the third, joined over the short gap
+    std::vector<Event> expected = {
+        {true, 16000, 16000 + ATTACK}, {false, 32000, 32000 + HANGOVER},
+        {true, 56000, 56000 + ATTACK}, {false, 80000, 80000 + HANGOVER},
+    };
+    bool ok = events == expected;
+    for (auto& event : events) {
+        printf("  %-9s from sample %6llu, raised at %6llu\n", event.speaking ? "speaking" : "silence",
+            (unsigned long long)event.sample, (unsigned long long)event.at);
+    }
+    return Check(ok, channels == 1 ? "Process(): sample-accurate events on a mono stream" :
+        "Process(): the same with a loud second channel") && ok;
+}
+
+static void Benchmark() {
+    const size_t samples = SAMPLE_RATE * BENCHMARK_SECONDS;
+    // Three seconds, a whole number of 30 ms pieces
+    std::vector<int16_t> pcm(SAMPLE_RATE * 3);
+    uint32_t seed = 3;
+    for (size_t n = 0; n < pcm.size(); n++) {
+        seed = seed * 1664525 + 1013904223;
+        bool tone = n % 16000 < 8000;
+        pcm[n] = (int16_t)(tone ? 3000 * sin(2 * M_PI * 300 * n / SAMPLE_RATE) : (int)(seed >> 24) - 128);
+    }
+    VadDetector vad(SAMPLE_RATE);
+    int changes = 0;
+    vad.OnStateChange([&changes](bool, uint64_t) { changes++; });
+    auto start = std::chrono::steady_clock::now();
+    uint64_t cycles = CYCLES();
+    // 30 ms pieces, as the audio loop feeds the processor
+    for (size_t n = 0; n < samples; n += 480) {
+        vad.Process(pcm.data() + n % pcm.size(), 480);
+        sink = vad.speaking();
+    }
+    cycles = CYCLES() - cycles;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double frames = (double)samples / FRAME;
+    printf("Process(): %.0f %s and %.1f ns per 10 ms frame, real-time factor %.6f, %d state changes\n",
+        cycles / frames, CYCLE_UNIT, seconds * 1e9 / frames, seconds / BENCHMARK_SECONDS, changes);
+}
+
+int main() {
+    bool ok = UpdateTiming(FRAME);
+    ok = UpdateTiming(AFE_CHUNK) && ok;
+    ok = ProcessTimestamps(1) && ok;
+    ok = ProcessTimestamps(2) && ok;
+    Benchmark();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,339 @@
+// Detection rate and CPU use of the multi-model wake word loop over a WAV corpus.
+// WakeNet does not run on the host, so stub models stand in for it: each listens for its
+// words as tones, a word's score is the share of the chunk energy at its frequency, and it
+// fires when the score rises to the word's threshold. Around them everything is done as in
+// WakeWordDetect with the direct interface: per-word thresholds from Settings("wake_word")
+// in 1/1000, 400 to 999 or the model default; the first microphone at 16kHz cut into
+// chunks by a ChunkQueue; every model sees every chunk, the first one to fire wins and
+// detection stops for the file; the time each model spends in Detect() is its CPU share.
+//   wake_word_benchmark [corpus.txt [model_us]]
+// corpus.txt has one "file.wav word" per line, "-" as the word for audio without one.
+// Without a corpus a synthetic one is written to the working directory and checked: every
+// word found and no false accepts, then again with "gamma" set to 999, which must lose gamma
+// and nothing else. model_us is busy-waited per chunk and model, to try out a model budget.
+// Reports the detection rate, wrong words and false accepts, and the CPU of 1, 2 and 3 models.
+#include "wav_io.h"
+#include "chunk_queue.h"
+#include "resampler.h"
+#include "settings.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define FRAME_MS 30
+#define FRAME_SAMPLES (16000 / 1000 * FRAME_MS)
+#define WAKENET_CHUNK 512
+#define WAKENET_QUEUE_CHUNKS 8
+#define WAKENET_MAX_MODELS 3
+// Stands in for the threshold a WakeNet model is created with
+#define MODEL_DEFAULT_THRESHOLD 0.6f
+// Mean square below which a chunk scores 0, about -50 dBFS
+#define SCORE_FLOOR 100.0
+
+using Clock = std::chrono::steady_clock;
+
+struct StubWord {
+    const char* word;
+    double frequency;
+};
+
+struct StubModelInfo {
+    const char* name;
+    std::vector<StubWord> words;
+};
+
+static const StubModelInfo kModels[WAKENET_MAX_MODELS] = {
+    {"wn_stub_a", {{"alpha", 700}, {"beta", 1100}}},
+    {"wn_stub_b", {{"gamma", 1500}}},
+    {"wn_stub_c", {{"delta", 1900}}},
+};
+
+class StubModel {
+public:
+    StubModel(const StubModelInfo& info, int cost_us) : info_(info), cost_us_(cost_us) {
+        LoadThresholds();
+        above_.assign(info_.words.size(), false);
+    }
+
+    std::string word(int index) const { return info_.words[index].word; }
+    float threshold(int index) const { return thresholds_[index] > 0 ? thresholds_[index] : MODEL_DEFAULT_THRESHOLD; }
+
+    // 0 for nothing, else the index of the detected word, starting at 1, like detect()
+    int Detect(const int16_t* chunk) {
+        auto until = Clock::now() + std::chrono::microseconds(cost_us_);
+        double energy = 0;
+        for (size_t i = 0; i < WAKENET_CHUNK; i++) {
+            energy += (double)chunk[i] * chunk[i];
+        }
+        int detected = 0;
+        for (size_t w = 0; w < info_.words.size(); w++) {
+            double score = energy / WAKENET_CHUNK < SCORE_FLOOR ? 0 : Goertzel(chunk, info_.words[w].frequency) / energy;
+            bool above = score >= threshold(w);
+            if (above && !above_[w] && detected == 0) {
+                detected = w + 1;
+            }
+            above_[w] = above;
+        }
+        while (Clock::now() < until) {
+        }
+        return detected;
+    }
+
+private:
+    const StubModelInfo& info_;
+    int cost_us_;
+    std::vector<float> thresholds_;
+    std::vector<bool> above_;
+
+    // The way WakeWordDetect::LoadThresholds() reads them
+    void LoadThresholds() {
+        Settings settings("wake_word", false);
+        for (auto& word : info_.words) {
+            int permille = settings.GetInt(std::string(word.word).substr(0, 15), 0);
+            if (permille != 0 && (permille < 400 || permille > 999)) {
+                permille = 0;
+            }
+            thresholds_.push_back(permille / 1000.0f);
+        }
+    }
+
+    // Power at the frequency, scaled so that a pure tone scores its whole energy
+    static double Goertzel(const int16_t* chunk, double frequency) {
+        double coefficient = 2 * cos(2 * M_PI * frequency / 16000);
+        double s1 = 0, s2 = 0;
+        for (size_t i = 0; i < WAKENET_CHUNK; i++) {
+            double s0 = chunk[i] + coefficient * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        return 2 * (s1 * s1 + s2 * s2 - coefficient * s1 * s2) / WAKENET_CHUNK;
+    }
+};
+
+struct CorpusFile {
+    std::string path;
+    // Empty for audio without a wake word
+    std::string word;
+};
+
+struct CorpusResult {
+    int positives = 0;
+    int detected = 0;
+    int wrong_word = 0;
+    int negatives = 0;
+    int false_accepts = 0;
+    // Audio that went through the models, detection stops at the first wake word of a file
+    double detected_seconds = 0;
+    std::vector<double> detect_seconds;
+    std::vector<std::string> missed;
+};
+
+// The detected word, or an empty string
+static std::string DetectFile(const WavData& wav, Resampler& resampler, std::vector<StubModel>& models,
+    CorpusResult& result) {
+    resampler.Reset();
+    ChunkQueue chunks(WAKENET_CHUNK, WAKENET_QUEUE_CHUNKS);
+    std::vector<int16_t> frame(FRAME_SAMPLES * wav.channels);
+    const size_t input_frames = resampler.GetInputFrames(FRAME_SAMPLES);
+    const size_t total_frames = wav.samples.size() / wav.channels;
+
+    for (size_t position = 0; position + input_frames <= total_frames; position += input_frames) {
+        int n = resampler.Process(wav.samples.data() + position * wav.channels, input_frames, frame.data(),
+            FRAME_SAMPLES);
+        // WakeNet listens to the first microphone only
+        chunks.Push(frame.data(), n * wav.channels, wav.channels);
+        const int16_t* chunk;
+        while ((chunk = chunks.Front()) != nullptr) {
+            StubModel* detected_model = nullptr;
+            int detected_index = 0;
+            for (size_t m = 0; m < models.size(); m++) {
+                auto start = Clock::now();
+                int index = models[m].Detect(chunk);
+                result.detect_seconds[m] += std::chrono::duration<double>(Clock::now() - start).count();
+                if (index > 0 && detected_model == nullptr) {
+                    detected_model = &models[m];
+                    detected_index = index;
+                }
+            }
+            chunks.Pop();
+            result.detected_seconds += WAKENET_CHUNK / 16000.0;
+            if (detected_model != nullptr) {
+                return detected_model->word(detected_index - 1);
+            }
+        }
+    }
+    return std::string();
+}
+
+static bool RunCorpus(const std::vector<CorpusFile>& corpus, size_t model_count, int model_us, CorpusResult& result) {
+    // One resampler per input format, configured once
+    static std::map<std::pair<int, int>, Resampler> resamplers;
+    result.detect_seconds.assign(model_count, 0);
+    for (auto& file : corpus) {
+        WavData wav;
+        if (!ReadWav(file.path.c_str(), wav) || wav.samples.empty()) {
+            printf("FAIL: could not read %s\n", file.path.c_str());
+            return false;
+        }
+        // Fresh models for every file, as detection restarts after a wake word
+        std::vector<StubModel> models;
+        for (size_t m = 0; m < model_count; m++) {
+            models.emplace_back(kModels[m], model_us);
+        }
+        auto& resampler = resamplers[{wav.sample_rate, wav.channels}];
+        if (!resampler.configured()) {
+            resampler.Configure(wav.sample_rate, 16000, wav.channels);
+        }
+        std::string word = DetectFile(wav, resampler, models, result);
+        if (file.word.empty()) {
+            result.negatives++;
+            result.false_accepts += word.empty() ? 0 : 1;
+        } else {
+            result.positives++;
+            if (word == file.word) {
+                result.detected++;
+            } else {
+                result.wrong_word += word.empty() ? 0 : 1;
+                result.missed.push_back(file.path);
+            }
+        }
+    }
+    return true;
+}
+
+static void Print(const CorpusResult& result) {
+    printf("  detected %d of %d (%.1f%%), %d wrong words; %d false accepts in %d files without a word\n",
+        result.detected, result.positives, result.positives ? 100.0 * result.detected / result.positives : 0,
+        result.wrong_word, result.false_accepts, result.negatives);
+    for (auto& path : result.missed) {
+        printf("  missed %s\n", path.c_str());
+    }
+}
+
+// A tone burst for every word, in noise, at 16kHz mono and 48kHz stereo; chords of two words,
+// another tone, noise bursts and quiet audio without one
+static bool WriteSyntheticCorpus(std::vector<CorpusFile>& corpus) {
+    struct {
+        std::vector<double> tones;
+        const char* word;
+        double level;
+    } items[] = {
+        {{700}, "alpha", 4000}, {{700}, "alpha", 1500},
+        {{1100}, "beta", 4000}, {{1100}, "beta", 1500},
+        {{1500}, "gamma", 4000}, {{1500}, "gamma", 1500},
+        {{700, 1100}, "", 6000}, {{2400}, "", 8000}, {{}, "", 6000}, {{}, "", 0},
+    };
+    uint32_t seed = 1;
+    int index = 0;
+    for (auto& item : items) {
+        for (int rate : {16000, 48000}) {
+            WavData wav;
+            wav.sample_rate = rate;
+            wav.channels = rate == 16000 ? 1 : 2;
+            size_t frames = (size_t)rate * 3;
+            wav.samples.resize(frames * wav.channels);
+            for (size_t frame = 0; frame < frames; frame++) {
+                double t = (double)frame / rate;
+                bool burst = t >= 1 && t < 1.6;
+                for (int channel = 0; channel < wav.channels; channel++) {
+                    seed = seed * 1103515245 + 12345;
+                    double noise = (int)((seed >> 16) & 0x3ff) - 512;
+                    double signal = 0;
+                    if (burst && item.tones.empty()) {
+                        // Broadband: the noise, louder
+                        signal = noise * item.level / 512;
+                    }
+                    for (double tone : item.tones) {
+                        signal += burst ? item.level * sin(2 * M_PI * tone * t) : 0;
+                    }
+                    // The second channel is the reference, the detector must not hear it
+                    wav.samples[frame * wav.channels + channel] = (int16_t)(channel ? 6000 * sin(2 * M_PI * 1500 * t) :
+                        signal + noise);
+                }
+            }
+            char path[64];
+            snprintf(path, sizeof(path), "wake_word_corpus_%02d.wav", index++);
+            if (!WriteWav(path, wav)) {
+                printf("FAIL: could not write %s\n", path);
+                return false;
+            }
+            corpus.push_back({path, item.word});
+        }
+    }
+    return true;
+}
+
+static bool ReadCorpus(const char* list, std::vector<CorpusFile>& corpus) {
+    std::ifstream file(list);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::stringstream ss(line);
+        CorpusFile entry;
+        if (!(ss >> entry.path >> entry.word)) {
+            continue;
+        }
+        if (entry.word == "-") {
+            entry.word.clear();
+        }
+        corpus.push_back(entry);
+    }
+    return !corpus.empty();
+}
+
+int main(int argc, char** argv) {
+    bool synthetic = argc <= 1;
+    int model_us = argc > 2 ? atoi(argv[2]) : 0;
+    std::vector<CorpusFile> corpus;
+    if (synthetic ? !WriteSyntheticCorpus(corpus) : !ReadCorpus(argv[1], corpus)) {
+        printf("FAIL: no corpus in %s\n", synthetic ? "the working directory" : argv[1]);
+        return 1;
+    }
+
+    bool ok = true;
+    CorpusResult all;
+    printf("%zu files, every model:\n", corpus.size());
+    if (!RunCorpus(corpus, WAKENET_MAX_MODELS, model_us, all)) {
+        return 1;
+    }
+    Print(all);
+
+    // The marginal cost of every model, all of them see every chunk
+    printf("%-8s %14s %14s\n", "models", "CPU total", "last model");
+    for (size_t count = 1; count <= WAKENET_MAX_MODELS; count++) {
+        CorpusResult result;
+        RunCorpus(corpus, count, model_us, result);
+        double total = 0;
+        for (double seconds : result.detect_seconds) {
+            total += seconds;
+        }
+        printf("%-8zu %13.4f%% %13.4f%%\n", count, 100 * total / result.detected_seconds,
+            100 * result.detect_seconds[count - 1] / result.detected_seconds);
+    }
+
+    if (synthetic) {
+        ok = all.detected == all.positives && all.wrong_word == 0 && all.false_accepts == 0;
+        printf("every word found, none in the audio without one %s\n", ok ? "ok" : "FAIL");
+
+        Settings("wake_word", true).SetInt("gamma", 999);
+        CorpusResult strict;
+        printf("gamma at 999:\n");
+        RunCorpus(corpus, WAKENET_MAX_MODELS, model_us, strict);
+        Print(strict);
+        bool gamma_only = strict.detected == all.detected - 4 && strict.missed.size() == 4 &&
+            strict.wrong_word == 0 && strict.false_accepts == 0;
+        printf("a per-word threshold only changes its own word %s\n", gamma_only ? "ok" : "FAIL");
+        ok = ok && gamma_only;
+        Settings("wake_word", true).EraseKey("gamma");
+    }
+    return ok ? 0 : 1;
+}
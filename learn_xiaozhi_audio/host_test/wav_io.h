@@ -0,0 +1,90 @@
+#ifndef WAV_IO_H
+#define WAV_IO_H
+
+// Whole 16-bit PCM WAV files in memory, for the host tests and tools
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+struct WavData {
+    int sample_rate = 16000;
+    int channels = 1;
+    // Interleaved
+    std::vector<int16_t> samples;
+};
+
+// Walks the chunks up to "data", only PCM 16-bit is accepted
+inline bool ReadWav(const char* path, WavData& wav) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = false;
+    bool has_format = false;
+    char riff[12];
+    if (fread(riff, 1, sizeof(riff), file) == sizeof(riff) &&
+        memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0) {
+        char id[4];
+        uint32_t size;
+        while (fread(id, 1, 4, file) == 4 && fread(&size, 4, 1, file) == 1) {
+            if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+                uint8_t format[16];
+                if (fread(format, 1, sizeof(format), file) != sizeof(format)) {
+                    break;
+                }
+                uint16_t tag = format[0] | format[1] << 8;
+                uint16_t bits = format[14] | format[15] << 8;
+                wav.channels = format[2] | format[3] << 8;
+                wav.sample_rate = format[4] | format[5] << 8 | format[6] << 16 | format[7] << 24;
+                if (tag != 1 || bits != 16 || wav.channels == 0) {
+                    break;
+                }
+                has_format = true;
+                fseek(file, size - 16 + (size & 1), SEEK_CUR);
+            } else if (memcmp(id, "data", 4) == 0) {
+                wav.samples.resize(size / sizeof(int16_t));
+                wav.samples.resize(fread(wav.samples.data(), sizeof(int16_t), wav.samples.size(), file));
+                wav.samples.resize(wav.samples.size() - wav.samples.size() % (has_format ? wav.channels : 1));
+                ok = has_format;
+                break;
+            } else {
+                fseek(file, size + (size & 1), SEEK_CUR);
+            }
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+inline bool WriteWav(const char* path, const WavData& wav) {
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint32_t data_size = wav.samples.size() * sizeof(int16_t);
+    uint32_t riff_size = data_size + 36;
+    uint32_t fmt_size = 16;
+    uint16_t format = 1;
+    uint16_t channels = wav.channels;
+    uint32_t sample_rate = wav.sample_rate;
+    uint32_t byte_rate = sample_rate * channels * sizeof(int16_t);
+    uint16_t block_align = channels * sizeof(int16_t);
+    uint16_t bits = 16;
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&riff_size, 4, 1, file);
+    fwrite("WAVEfmt ", 1, 8, file);
+    fwrite(&fmt_size, 4, 1, file);
+    fwrite(&format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&sample_rate, 4, 1, file);
+    fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align, 2, 1, file);
+    fwrite(&bits, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&data_size, 4, 1, file);
+    bool ok = fwrite(wav.samples.data(), sizeof(int16_t), wav.samples.size(), file) == wav.samples.size();
+    return fclose(file) == 0 && ok;
+}
+
+#endif // WAV_IO_H
@@ -6,7 +6,17 @@
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
 
+#if CONFIG_USE_AUDIO_DMA_TUNER
+#include "audio_dma_tuner.h"
+#endif
+#if CONFIG_USE_WAV_AUDIO_CODEC
+#include "wav_audio_codec.h"
+#endif
+
+#include <cassert>
+#include <cinttypes>
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -15,24 +25,75 @@
 
 #define TAG "Application"
 
+// Input frames hold up to 32ms of 16kHz audio per channel, the largest AFE feed chunk
+#define AUDIO_INPUT_FRAME_SAMPLES 512
+#define AUDIO_INPUT_FRAME_COUNT 4
+
+#if defined(CONFIG_IDF_TARGET_ESP32C6)
+// No PSRAM, keep about 1.5s of 16kHz audio
+#define AUDIO_BUFFER_SAMPLES (24 * 1024)
+#else
+// About 20s of 16kHz audio in PSRAM
+#define AUDIO_BUFFER_SAMPLES (20 * 16000)
+#endif
+
+// Playback is drained from the audio buffer in frames of this duration
+#define AUDIO_OUTPUT_FRAME_MS 20
+
+
+// Allowed edges and the audio path switches of every state, the LED and display follow in
+// UpdateStateIndicators() once the background work is done
+constexpr DeviceStateInfo<Application> Application::kDeviceStates[] = {
+    {kDeviceStateUnknown, DeviceStateMask(kDeviceStateStarting), nullptr, nullptr},
+    {kDeviceStateStarting, DeviceStateMask(kDeviceStateWifiConfiguring, kDeviceStateActivating, kDeviceStateIdle,
+        kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateWifiConfiguring, DeviceStateMask(kDeviceStateActivating, kDeviceStateIdle, kDeviceStateFatalError),
+        nullptr, nullptr},
+    {kDeviceStateIdle, DeviceStateMask(kDeviceStateWifiConfiguring, kDeviceStateConnecting, kDeviceStateListening,
+        kDeviceStateSpeaking, kDeviceStateUpgrading, kDeviceStateActivating, kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateConnecting, DeviceStateMask(kDeviceStateIdle, kDeviceStateListening, kDeviceStateSpeaking,
+        kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateListening, DeviceStateMask(kDeviceStateIdle, kDeviceStateSpeaking, kDeviceStateFatalError),
+        &Application::ExitListening, &Application::EnterListening},
+    {kDeviceStateSpeaking, DeviceStateMask(kDeviceStateIdle, kDeviceStateListening, kDeviceStateFatalError),
+        nullptr, nullptr},
+    {kDeviceStateUpgrading, DeviceStateMask(kDeviceStateIdle, kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateActivating, DeviceStateMask(kDeviceStateWifiConfiguring, kDeviceStateIdle, kDeviceStateListening,
+        kDeviceStateUpgrading, kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateFatalError, DeviceStateMask(), nullptr, nullptr},
+};
+
+struct StateIndicator {
+    // nullptr leaves the display as it is
+    const char* status;
+    const char* emotion;
+    const char* role;
+    const char* message;
+};
 
-static const char* const STATE_STRINGS[] = {
-    "unknown",
-    "starting",
-    "configuring",
-    "idle",
-    "connecting",
-    "listening",
-    "speaking",
-    "upgrading",
-    "activating",
-    "fatal_error",
-    "invalid_state"
+static constexpr StateIndicator kStateIndicators[kDeviceStateCount] = {
+    {Lang::Strings::STANDBY, "neutral", "system", "待命中..."},                                   // unknown
+    {nullptr, nullptr, nullptr, nullptr},                                                        // starting
+    {nullptr, nullptr, nullptr, nullptr},                                                        // configuring
+    {Lang::Strings::STANDBY, "neutral", "system", "待命中..."},                                   // idle
+    {Lang::Strings::CONNECTING, "neutral", "system", ""},                                         // connecting
+    {Lang::Strings::LISTENING, "loving", "user", "Audio Demo: 聆听用户说话并同步播放..."},           // listening
+    {Lang::Strings::SPEAKING, "laughing", "assistant", "Audio Demo: 等待用户按下speak按键..."},      // speaking
+    {nullptr, nullptr, nullptr, nullptr},                                                        // upgrading
+    {nullptr, nullptr, nullptr, nullptr},                                                        // activating
+    {nullptr, nullptr, nullptr, nullptr},                                                        // fatal_error
 };
 
 Application::Application() {
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 8);
+    // Transitions complete through its bits, without it the first one would never end
+    assert(event_group_ != nullptr);
+#if CONFIG_BACKGROUND_TASK_PINNED
+    background_task_ = new BackgroundTask(4096 * 8, CONFIG_BACKGROUND_TASK_WORKERS, true);
+#else
+    background_task_ = new BackgroundTask(4096 * 8, CONFIG_BACKGROUND_TASK_WORKERS);
+#endif
+    audio_buffer_ = new SpscRingBuffer<int16_t>(AUDIO_BUFFER_SAMPLES);
 
     esp_timer_create_args_t clock_timer_args = {
         .callback = [](void* arg) {
@@ -46,6 +107,21 @@ Application::Application() {
     };
     esp_timer_create(&clock_timer_args, &clock_timer_handle_);
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
+
+    esp_timer_create_args_t output_drain_timer_args = {
+        .callback = [](void* arg) {
+            Application* app = (Application*)arg;
+            if (app->output_drain_.Expired(esp_timer_get_time(), OUTPUT_DRAIN_TIMEOUT_MS * 1000LL)) {
+                ESP_LOGW(TAG, "Speaker drain timed out");
+                xEventGroupSetBits(app->event_group_, OUTPUT_DRAINED_EVENT);
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "output_drain",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&output_drain_timer_args, &output_drain_timer_handle_);
 }
 
 Application::~Application() {
@@ -53,9 +129,22 @@ Application::~Application() {
         esp_timer_stop(clock_timer_handle_);
         esp_timer_delete(clock_timer_handle_);
     }
+    if (output_drain_timer_handle_ != nullptr) {
+        esp_timer_stop(output_drain_timer_handle_);
+        esp_timer_delete(output_drain_timer_handle_);
+    }
     if (background_task_ != nullptr) {
         delete background_task_;
     }
+    if (audio_buffer_ != nullptr) {
+        delete audio_buffer_;
+    }
+    if (input_frames_ != nullptr) {
+        input_frames_->Retire();
+    }
+    if (audio_processor_ != nullptr) {
+        delete audio_processor_;
+    }
     vEventGroupDelete(event_group_);
 }
 
@@ -86,19 +175,19 @@ void Application::ToggleChatState() {
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
             SetDeviceState(kDeviceStateListening);
-        });
+        }, kTaskPriorityHigh, STATE_CHANGE_DEADLINE_MS, "toggle_chat_state");
     }
 }
 
 void Application::StartListening(){
     Schedule([this]() {
         SetDeviceState(kDeviceStateListening);
-    });
+    }, kTaskPriorityHigh, STATE_CHANGE_DEADLINE_MS, "start_listening");
 }
 void Application::StopListening(){
     Schedule([this]() {
         SetDeviceState(kDeviceStateSpeaking);
-    });
+    }, kTaskPriorityHigh, STATE_CHANGE_DEADLINE_MS, "stop_listening");
 }
 
 void Application::Start() {
@@ -112,7 +201,16 @@ void Application::Start() {
     auto codec = board.GetAudioCodec();
 
     codec->Start();
+#if CONFIG_USE_AUDIO_DMA_TUNER
+    if (AudioDmaTuner(codec).Run()) {
+        Reboot();
+    }
+#endif
     ResetDecoder();
+    if (codec->input_sample_rate() != 16000) {
+        input_resampler_.Configure(codec->input_sample_rate(), 16000, codec->input_channels());
+    }
+    input_frames_ = new AudioFramePool(AUDIO_INPUT_FRAME_COUNT, AUDIO_INPUT_FRAME_SAMPLES * codec->input_channels());
 
     #if CONFIG_USE_AUDIO_PROCESSOR
         xTaskCreatePinnedToCore([](void* arg) {
@@ -131,63 +229,198 @@ void Application::Start() {
     // Initialize the protocol
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
+#if CONFIG_USE_AUDIO_FRONT_END
+    audio_front_end_.Initialize(codec);
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+    audio_processor_ = new AfeAudioProcessor(&audio_front_end_);
+#else
+    audio_processor_ = new DummyAudioProcessor();
+#endif
+    audio_processor_->Initialize(codec);
+    audio_processor_->OnOutputView([this](const int16_t* data, size_t samples) {
+        // Processed 16kHz mono, stored instead of the raw capture
+        StoreCapturedAudio(data, samples, 1);
+    });
+    audio_processor_->OnVadStateChange([this](bool speaking, uint64_t sample) {
+        voice_detected_ = speaking;
+        ESP_LOGI(TAG, "Speech %s at %" PRIu64 " ms", speaking ? "started" : "ended", sample / 16);
+    });
+
 #if CONFIG_USE_WAKE_WORD_DETECT
+#if CONFIG_USE_AUDIO_FRONT_END
+    wake_word_detect_.Initialize(codec, &audio_front_end_);
+#else
     wake_word_detect_.Initialize(codec);
-    wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
-        Schedule([this, &wake_word]() {
-            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
-        });
+#endif
+    wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word, float threshold) {
+        Schedule([this, wake_word, threshold]() {
+            ESP_LOGI(TAG, "Wake word detected: %s (threshold %.3f)", wake_word.c_str(), threshold);
+        }, kTaskPriorityHigh, STATE_CHANGE_DEADLINE_MS, "wake_word_detected");
     });
     wake_word_detect_.StartDetection();
 #endif
 
     SetDeviceState(kDeviceStateActivating);
+#if CONFIG_USE_WAV_AUDIO_CODEC
+    // Offline run: process the whole file as one listening turn
+    SetDeviceState(kDeviceStateListening);
+#endif
 
     MainEventLoop();
 }
 
-// The Audio Loop is used to input and output audio data
+// The Audio Loop is used to input and output audio data.
+// It sleeps until the codec pipeline tasks or a state change notify it, and the codec
+// only sends the events the current state needs, so an idle device never wakes it.
+// Capture and playback run in their own codec tasks, this loop never blocks on I2S.
 void Application::AudioLoop() {
     auto codec = Board::GetInstance().GetAudioCodec();
+    output_frame_.resize(AUDIO_OUTPUT_FRAME_MS * codec->output_sample_rate() / 1000);
+    codec->SetEventTask(xTaskGetCurrentTaskHandle());
+    UpdateAudioEvents();
     while (true) {
-        OnAudioInput();
-        if (codec->output_enabled()) {
-            OnAudioOutput();
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+        audio_loop_wakeups_++;
+
+        if (events & AUDIO_LOOP_STATE_CHANGED) {
+            // Start playback right away instead of waiting for the next TX event
+            events |= AUDIO_CODEC_EVENT_OUTPUT_READY;
+        }
+        // Before any new capture is stored, so only the unplayed tail of the last turn is lost
+        if (discard_playback_.exchange(false)) {
+            size_t stale = audio_buffer_->Available();
+            audio_buffer_->Clear();
+            if (playback_active_) {
+                FinishPlayback();
+            }
+            if (stale > 0) {
+                ESP_LOGI(TAG, "Discarded %zu unplayed samples", stale);
+            }
+        }
+        if (events & AUDIO_CODEC_EVENT_INPUT_READY) {
+            while (OnAudioInput()) {
+            }
+        }
+        if ((events & AUDIO_CODEC_EVENT_OUTPUT_READY) && codec->output_enabled()) {
+            // Top up the codec TX queue, one frame at a time
+            while (codec->output_space() >= output_frame_.size() && OnAudioOutput()) {
+            }
+        }
+        UpdateAudioEvents();
+        // Checked after the mask is set, so an OUTPUT_EMPTY event can not be missed in between
+        if (output_drain_.waiting() && codec->output_empty() && output_drain_.Drained()) {
+            xEventGroupSetBits(event_group_, OUTPUT_DRAINED_EVENT);
         }
     }
 }
 
-void Application::OnAudioInput() {
+void Application::UpdateAudioEvents() {
+    uint32_t mask = 0;
+    bool listening = device_state_ == kDeviceStateListening;
+    if (listening) {
+        mask |= AUDIO_CODEC_EVENT_INPUT_READY;
+    }
+#if CONFIG_USE_AUDIO_FRONT_END
+    if (audio_front_end_.IsRunning()) {
+        mask |= AUDIO_CODEC_EVENT_INPUT_READY;
+    }
+#elif CONFIG_USE_WAKE_WORD_DETECT
+    if (wake_word_detect_.IsDetectionRunning()) {
+        mask |= AUDIO_CODEC_EVENT_INPUT_READY;
+    }
+#endif
+#if CONFIG_USE_STREAMING_PLAYBACK
+    if (listening) {
+        mask |= AUDIO_CODEC_EVENT_OUTPUT_READY;
+    }
+#endif
+    if (device_state_ == kDeviceStateSpeaking && audio_buffer_->Available() > 0) {
+        mask |= AUDIO_CODEC_EVENT_OUTPUT_READY;
+    }
+    if (output_drain_.waiting()) {
+        mask |= AUDIO_CODEC_EVENT_OUTPUT_EMPTY;
+    }
+    Board::GetInstance().GetAudioCodec()->SetEventMask(mask);
+}
+
+// Returns false once the codec has no complete frame queued.
+// The frame is captured once into a pooled buffer and every consumer reads it in place.
+bool Application::OnAudioInput() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    //When at the state of kDeviceStateListening, the processor runs
+    bool processing = audio_processor_->IsRunning();
+    size_t samples = processing ? audio_processor_->GetFeedSize() : 0;
 #if CONFIG_USE_WAKE_WORD_DETECT
-    std::vector<int16_t> data;
-    if (wake_word_detect_.IsDetectionRunning()) {  
-        int samples = wake_word_detect_.GetFeedSize();
-        if (samples > 0) {
-            ReadAudio(data, 16000, samples);
-            wake_word_detect_.Feed(data);
-        }
+    // The wake word chunk sets the frame size: the dummy processor re-frames any size,
+    // the AFE one shares the front end with the detector
+    bool detecting = wake_word_detect_.IsDetectionRunning();
+    if (detecting) {
+        samples = wake_word_detect_.GetFeedSize();
     }
-    if(device_state_ == kDeviceStateListening
-    #if defined(CONFIG_IDF_TARGET_ESP32C6)
-    && demo_audio_raw_data_.size() < 24*1024
-    #endif
-    ){
-        demo_audio_raw_data_.insert(demo_audio_raw_data_.end(), data.begin(), data.end());
+#else
+    bool detecting = false;
+#endif
+    if ((!processing && !detecting) || samples == 0) {
+        return false;
+    }
+    AudioFrame frame = input_frames_->Acquire(samples);
+    if (!frame) {
+        ESP_LOGE(TAG, "No input frame for %zu samples", samples);
+        return false;
+    }
+    int64_t start_time = esp_timer_get_time();
+    if (!ReadAudio(frame, 16000)) {
+        return false;
     }
-    if(data.size()) return;
+    int64_t read_time = esp_timer_get_time();
+    input_read_time_.Record(read_time - start_time);
+    input_bytes_copied_ += frame.size() * sizeof(int16_t);
+
+    if (processing) {
+        audio_processor_->Feed(frame.data(), frame.size());
+    }
+#if CONFIG_USE_WAKE_WORD_DETECT
+#if CONFIG_USE_AUDIO_PROCESSOR
+    // One feed serves both consumers of the shared front end
+    if (detecting && !processing) {
 #else
-    //When at the state of kDeviceStateListening, start sampling the data
-    if (device_state_ == kDeviceStateListening) {
-        int samples = 30 * Board::GetInstance().GetAudioCodec()->input_sample_rate() / 1000; //sample duration 30ms
-        if (samples > 0) {
-            std::vector<int16_t> audio_data_smp;
-            ReadAudio(audio_data_smp, 16000, samples);
-            demo_audio_raw_data_.insert(demo_audio_raw_data_.end(), audio_data_smp.begin(), audio_data_smp.end());
-            return;
+    if (detecting) {
+#endif
+        wake_word_detect_.Feed(frame.data(), frame.size());
+    }
+#endif
+    input_feed_time_.Record(esp_timer_get_time() - read_time);
+    return true;
+}
+
+// The demo plays back the first microphone only, other microphones and the reference are skipped
+void Application::StoreCapturedAudio(const int16_t* data, size_t samples, int channels) {
+    size_t frames = samples / channels;
+    if (channels == 1) {
+        audio_buffer_->Write(data, frames);
+    } else {
+        size_t written = 0;
+        while (written < frames) {
+            int16_t* span;
+            size_t n = std::min(audio_buffer_->GetWriteSpan(&span), frames - written);
+            if (n == 0) {
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                span[i] = data[(written + i) * channels];
+            }
+            audio_buffer_->CommitWrite(n);
+            written += n;
         }
     }
-#endif    
-    vTaskDelay(pdMS_TO_TICKS(30)); //Avoid to run while loop w/ dummy function
+    input_bytes_copied_ += frames * sizeof(int16_t);
+    input_bytes_captured_ += samples * sizeof(int16_t);
+    if (capture_pending_) {
+        capture_pending_ = false;
+        ESP_LOGI(TAG, "First input frame after %" PRId64 " us", esp_timer_get_time() - capture_request_time_);
+    }
 }
 
 void Application::ResetDecoder() {
@@ -196,40 +429,126 @@ void Application::ResetDecoder() {
     codec->EnableOutput(true);
 }
 
-void Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
+// Fills the whole frame at the requested rate, or returns false without consuming anything
+bool Application::ReadAudio(AudioFrame& frame, int sample_rate) {
     auto codec = Board::GetInstance().GetAudioCodec();
     if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
-            return;
-        }
-    } else {
-        data.resize(samples);
-        if (!codec->InputData(data)) {
-            return;
+        // Read at the codec rate into the scratch buffer, then resample to the requested rate
+        int channels = codec->input_channels();
+        input_buffer_.resize(input_resampler_.GetInputFrames(frame.size() / channels) * channels);
+        if (!codec->InputData(input_buffer_)) {
+            return false;
         }
+        int frames = input_resampler_.Process(input_buffer_.data(), input_buffer_.size() / channels,
+            frame.data(), frame.size() / channels);
+        frame.resize(frames * channels);
+        return frames > 0;
     }
+    return codec->InputData(frame.data(), frame.size());
 }
 
-void Application::OnAudioOutput() {
-    if(!demo_audio_raw_data_.size()){
-        return; 
+// Queues one frame for the codec, returns false when there is nothing to play
+bool Application::OnAudioOutput() {
+#if CONFIG_USE_STREAMING_PLAYBACK
+    // Play back while listening, the speaking state drains what is left
+    bool streaming = device_state_ == kDeviceStateListening;
+#else
+    bool streaming = false;
+#endif
+    size_t frame_samples = output_frame_.size();
+    if ((device_state_ != kDeviceStateSpeaking && !streaming) ||
+        audio_buffer_->Available() < (streaming ? frame_samples : 1)) {
+        if (playback_active_ && !streaming) {
+            FinishPlayback();
+        }
+        return false;
     }
-    if (device_state_ == kDeviceStateSpeaking) {
-        Board::GetInstance().GetAudioCodec()->OutputData(demo_audio_raw_data_);
-        demo_audio_raw_data_.clear();
+
+    // Frames go to the codec TX queue, which never blocks; the TX task paces the DMA.
+    // While streaming only whole frames are played, the speaking state also flushes the tail.
+    auto codec = Board::GetInstance().GetAudioCodec();
+    const int16_t* data;
+    size_t samples = audio_buffer_->GetReadSpan(&data);
+    if (samples >= frame_samples) {
+        samples = frame_samples;
+        codec->OutputData(data, samples);
+        audio_buffer_->CommitRead(samples);
+    } else {
+        // The frame wraps around the end of the ring buffer
+        samples = audio_buffer_->Read(output_frame_.data(), std::min(frame_samples, audio_buffer_->Available()));
+        codec->OutputData(output_frame_.data(), samples);
+    }
+
+    auto now = esp_timer_get_time();
+    if (!playback_active_) {
+        playback_active_ = true;
+        ESP_LOGI(TAG, "First output frame after %" PRId64 " us", now - playback_request_time_);
+    } else {
+        output_jitter_.Record(now - last_output_time_ - AUDIO_OUTPUT_FRAME_MS * 1000);
+    }
+    last_output_time_ = now;
+
+    if (!streaming && audio_buffer_->Available() == 0) {
+        FinishPlayback();
+        return false;
     }
+    return true;
+}
+
+void Application::FinishPlayback() {
+    playback_active_ = false;
+    output_jitter_.Print(TAG, "Output frame jitter");
+    output_jitter_.Reset();
 }
 
 void Application::OnClockTimer() {
     clock_ticks_++;
 
+#if CONFIG_USE_WAV_AUDIO_CODEC
+    auto wav_codec = static_cast<WavAudioCodec*>(Board::GetInstance().GetAudioCodec());
+    if (wav_codec->finished() && device_state_ == kDeviceStateListening) {
+        Schedule([this, wav_codec]() {
+            wav_codec->Report();
+            if (wav_codec->failed()) {
+                SetDeviceState(kDeviceStateIdle);
+                return;
+            }
+            input_read_time_.Print(TAG, "Input read");
+            input_feed_time_.Print(TAG, "Input feed");
+            // Play what was stored into the output file
+            SetDeviceState(kDeviceStateSpeaking);
+        }, kTaskPriorityNormal, 0, "wav_report");
+    }
+#endif
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintRealTimeStats(pdMS_TO_TICKS(1000));
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
-        ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
+        ESP_LOGI(TAG, "Free internal: %d minimal internal: %d", free_sram, min_free_sram);
+        ESP_LOGI(TAG, "Audio buffer overruns: %" PRIu32 " (%" PRIu32 " samples dropped) underruns: %" PRIu32,
+            audio_buffer_->overruns(), audio_buffer_->dropped(), audio_buffer_->underruns());
+        ESP_LOGI(TAG, "Audio loop wakeups in the last 10s: %" PRIu32, audio_loop_wakeups_.exchange(0));
+        ESP_LOGI(TAG, "Capture path copied %" PRIu32 " bytes for %" PRIu32 " bytes of audio, input frames exhausted: %" PRIu32,
+            input_bytes_copied_.exchange(0), input_bytes_captured_.exchange(0), input_frames_->exhausted());
+        auto processor = audio_processor_->stats();
+        ESP_LOGI(TAG, "Audio processor in: %" PRIu32 " chunks %" PRIu32 " bytes, out: %" PRIu32 " frames %" PRIu32 " bytes, "
+            "copied: %" PRIu32 " bytes, dropped: %" PRIu32 " frames",
+            processor.input_chunks, processor.input_bytes, processor.output_frames, processor.output_bytes,
+            processor.copied_bytes, processor.dropped_frames);
+        auto codec = Board::GetInstance().GetAudioCodec();
+        auto input = codec->input_stats();
+        auto output = codec->output_stats();
+        ESP_LOGI(TAG, "Codec input frames: %" PRIu32 " dropped: %" PRIu32 " late: %" PRIu32 ", output frames: %" PRIu32 " dropped: %" PRIu32 " late: %" PRIu32,
+            input.frames, input.dropped, input.late, output.frames, output.dropped, output.late);
+        if (auto agc = codec->input_agc()) {
+            // Q16 gain, 65536 is unity
+            ESP_LOGI(TAG, "Input AGC gain: %" PRId32 "/65536 peak: %" PRId32 " clipped: %" PRIu32, agc->gain(), agc->peak(), agc->clipped());
+        }
+        ESP_LOGI(TAG, "Scheduled tasks dropped: %" PRIu32 "/%" PRIu32 "/%" PRIu32 ", heap captures: %" PRIu32 ", pooled captures: %d",
+            main_tasks_dropped_[kTaskPriorityHigh].load(), main_tasks_dropped_[kTaskPriorityNormal].load(),
+            main_tasks_dropped_[kTaskPriorityLow].load(), InlineTask::heap_allocations(), InlineTask::pooled());
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (device_state_ == kDeviceStateIdle) {
@@ -239,92 +558,244 @@ void Application::OnClockTimer() {
                 char time_str[64];
                 strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
                 Board::GetInstance().GetDisplay()->SetStatus(time_str);
-            });
+            }, kTaskPriorityLow, 0, "clock_status");
         }
     }
 }
 
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+bool Application::ScheduleTask(InlineTask callback, TaskPriority priority, int deadline_ms, const char* name) {
+    auto now = esp_timer_get_time();
+    MainTask task{std::move(callback), name, now, deadline_ms > 0 ? now + deadline_ms * 1000LL : 0};
+    if (!main_tasks_[priority].Push(std::move(task))) {
+        main_tasks_dropped_[priority]++;
+        return false;
+    }
+    if (xPortInIsrContext()) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xEventGroupSetBitsFromISR(event_group_, SCHEDULE_EVENT, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    } else {
+        xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+    }
+    return true;
+}
+
+void Application::DumpTaskStats() {
+    Schedule([this]() {
+        static const char* const lane_names[] = {"high", "normal", "low"};
+        for (int i = 0; i < kTaskPriorityCount; i++) {
+            ESP_LOGI(TAG, "Lane %s dropped: %" PRIu32, lane_names[i], main_tasks_dropped_[i].load());
+            schedule_latency_[i].Print(TAG, lane_names[i]);
+        }
+        transition_latency_.Print(TAG, "State transitions");
+        ESP_LOGI(TAG, "Illegal state transitions: %" PRIu32, state_queue_.illegal());
+        ESP_LOGI(TAG, "%-24s %8s %6s %10s %10s %10s", "Task", "Runs", "Late", "Avg(us)", "Max(us)", "MaxLate");
+        for (auto& stats : task_stats_) {
+            if (stats.name == nullptr) {
+                break;
+            }
+            ESP_LOGI(TAG, "%-24s %8" PRIu32 " %6" PRIu32 " %10" PRId64 " %10" PRId64 " %10" PRId64, stats.name, stats.runs, stats.late,
+                stats.total_us / stats.runs, stats.max_us, stats.max_late_us);
+        }
+    }, kTaskPriorityLow, 0, "dump_task_stats");
+}
+
+// Higher lanes first, so a slow low priority task delays a state change by at most its own run time
+int Application::PopMainTask(MainTask& task) {
+    for (int lane = 0; lane < kTaskPriorityCount; lane++) {
+        if (main_tasks_[lane].Pop(task)) {
+            return lane;
+        }
+    }
+    return -1;
+}
+
+void Application::RunMainTask(MainTask& task, int lane) {
+    auto start = esp_timer_get_time();
+    schedule_latency_[lane].Record(start - task.scheduled_time);
+    task.callback();
+    auto run_time = esp_timer_get_time() - start;
+
+    TaskStats* stats = nullptr;
+    for (auto& entry : task_stats_) {
+        if (entry.name == nullptr || entry.name == task.name || strcmp(entry.name, task.name) == 0) {
+            stats = &entry;
+            break;
+        }
+    }
+    if (stats == nullptr) {
+        // Table full, fold the rest into the last entry
+        stats = &task_stats_[kMaxTaskStats - 1];
+    } else if (stats->name == nullptr) {
+        stats->name = task.name;
+    }
+    stats->runs++;
+    stats->total_us += run_time;
+    stats->max_us = std::max(stats->max_us, run_time);
+    if (task.deadline_us != 0 && start > task.deadline_us) {
+        stats->late++;
+        stats->max_late_us = std::max(stats->max_late_us, start - task.deadline_us);
     }
-    xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
 
 // The Main Loop controls the chat state and websocket connection
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
 void Application::MainEventLoop() {
+    MainTask task;
     while (true) {
-        auto bits = xEventGroupWaitBits(event_group_, SCHEDULE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+        auto bits = xEventGroupWaitBits(event_group_,
+            SCHEDULE_EVENT | OUTPUT_DRAINED_EVENT | STATE_INDICATORS_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
 
+        // Before the lanes: a transition waiting for these holds back the queued state requests
+        if (bits & OUTPUT_DRAINED_EVENT) {
+            OnOutputDrained();
+        }
+        if (bits & STATE_INDICATORS_EVENT) {
+            UpdateStateIndicators();
+            CompleteTransitionAction();
+        }
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            std::list<std::function<void()>> tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
+            for (int lane; (lane = PopMainTask(task)) >= 0;) {
+                RunMainTask(task, lane);
+                task.callback.Reset();
             }
         }
     }
 }
 
-
+// Safe from any task: the transition is queued and run on the main loop, one at a time
 void Application::SetDeviceState(DeviceState state) {
-    if (device_state_ == state) {
+    if (state < 0 || state >= kDeviceStateCount) {
+        state_queue_.CountIllegal();
+        ESP_LOGE(TAG, "Invalid state %d", (int)state);
         return;
     }
-    
-    clock_ticks_ = 0;
+    if (!state_queue_.Push(state, esp_timer_get_time())) {
+        ESP_LOGE(TAG, "State request queue full, %s dropped", DeviceStateName(state));
+        return;
+    }
+    Schedule([this]() {
+        RunStateRequests();
+    }, kTaskPriorityHigh, STATE_CHANGE_DEADLINE_MS, "device_state");
+}
+
+void Application::RunStateRequests() {
+    static_assert(IsValidDeviceStateTable(kDeviceStates), "kDeviceStates needs one row per state in enum order");
+    DeviceStateQueue::Request request;
+    DeviceStateQueue::Next next;
+    while ((next = state_queue_.Pop(kDeviceStates, device_state_, request)) != DeviceStateQueue::kNextNone) {
+        if (next == DeviceStateQueue::kNextRejected) {
+            ESP_LOGW(TAG, "Illegal transition %s -> %s rejected", DeviceStateName(device_state_),
+                DeviceStateName(request.state));
+            continue;
+        }
+        BeginTransition(request);
+    }
+}
+
+// Switches the audio paths right away; the LED, display and speaker drain follow as actions,
+// and the next queued transition starts once all of them have completed
+void Application::BeginTransition(const DeviceStateQueue::Request& request) {
+    auto state = request.state;
     auto previous_state = device_state_;
+    state_queue_.Begin(request, previous_state, esp_timer_get_time());
+
+    clock_ticks_ = 0;
+    if (state == kDeviceStateSpeaking || state == kDeviceStateListening) {
+        playback_request_time_ = esp_timer_get_time();
+    }
+    if (previous_state == kDeviceStateSpeaking || state == kDeviceStateListening) {
+        discard_playback_ = true;
+    }
+    // Run before the audio loop picks its events for the new state
+    if (auto on_exit = kDeviceStates[previous_state].on_exit) {
+        (this->*on_exit)(state);
+    }
+    if (auto on_enter = kDeviceStates[state].on_enter) {
+        (this->*on_enter)(previous_state);
+    }
     device_state_ = state;
-    ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+    if (audio_loop_task_handle_ != nullptr) {
+        xTaskNotify(audio_loop_task_handle_, AUDIO_LOOP_STATE_CHANGED, eSetBits);
+    }
+    ESP_LOGI(TAG, "STATE: %s", DeviceStateName(device_state_));
 
-    auto& board = Board::GetInstance();
-    auto display = board.GetDisplay();
-    auto led = board.GetLed();
-    led->OnStateChanged();
-    switch (state) {
-        case kDeviceStateUnknown:
-        case kDeviceStateIdle:
-            display->SetStatus(Lang::Strings::STANDBY);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "待命中...");
-            break;
-        case kDeviceStateConnecting:
-            display->SetStatus(Lang::Strings::CONNECTING);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "");
-            break;
-        case kDeviceStateListening:
-        #if CONFIG_USE_WAKE_WORD_DETECT
-            if(!wake_word_detect_.IsDetectionRunning()){
-                ESP_LOGI(TAG, "Restart wake up word detection.");
-                wake_word_detect_.StartDetection();
-            }
-        #endif
-            display->SetStatus(Lang::Strings::LISTENING);
-            display->SetEmotion("loving");
-            display->SetChatMessage("user", "Audio Demo: 聆听用户说话并同步播放...");
-            if (previous_state == kDeviceStateSpeaking) {
-                // FIXME: Wait for the speaker to empty the buffer
-                vTaskDelay(pdMS_TO_TICKS(120));
-            }
-            break;
-        case kDeviceStateSpeaking:
-            display->SetStatus(Lang::Strings::SPEAKING);
-            display->SetEmotion("laughing");
-            display->SetChatMessage("assistant", "Audio Demo: 等待用户按下speak按键...");
-            break;
-        default:
-            // Do nothing
-            break;
+    // The indicators change once the background work of the previous state is done
+    background_task_->OnCompletion([this]() {
+        xEventGroupSetBits(event_group_, STATE_INDICATORS_EVENT);
+    });
+}
+
+// Switches the shared front end from wake word to communication mode
+void Application::EnterListening(DeviceState previous) {
+    capture_request_time_ = esp_timer_get_time();
+    capture_pending_ = true;
+#if CONFIG_USE_AUDIO_PROCESSOR && CONFIG_USE_WAKE_WORD_DETECT
+    wake_word_detect_.StopDetection();
+#endif
+    bool wait_for_speaker = false;
+#if !CONFIG_USE_STREAMING_PLAYBACK
+    // Keep the tail of the reply out of the recording: capture starts once the speaker is empty
+    wait_for_speaker = previous == kDeviceStateSpeaking;
+#endif
+    if (wait_for_speaker) {
+        state_queue_.AddAction();
+        output_drain_.Start(esp_timer_get_time());
+        // Restarted for every wait, a timer left from the last one does not end this one early
+        esp_timer_stop(output_drain_timer_handle_);
+        esp_timer_start_once(output_drain_timer_handle_, OUTPUT_DRAIN_TIMEOUT_MS * 1000LL);
+    } else {
+        audio_processor_->Start();
+    }
+#if CONFIG_USE_WAKE_WORD_DETECT && !CONFIG_USE_AUDIO_PROCESSOR
+    if(!wake_word_detect_.IsDetectionRunning()){
+        ESP_LOGI(TAG, "Restart wake up word detection.");
+        wake_word_detect_.StartDetection();
+    }
+#endif
+}
+
+void Application::ExitListening(DeviceState next) {
+    audio_processor_->Stop();
+#if CONFIG_USE_AUDIO_PROCESSOR && CONFIG_USE_WAKE_WORD_DETECT
+    wake_word_detect_.StartDetection();
+#endif
+}
+
+void Application::OnOutputDrained() {
+    esp_timer_stop(output_drain_timer_handle_);
+    ESP_LOGI(TAG, "Speaker drained after %" PRId64 " us", esp_timer_get_time() - output_drain_.start_time());
+    if (device_state_ == kDeviceStateListening) {
+        audio_processor_->Start();
     }
+    CompleteTransitionAction();
 }
 
+void Application::CompleteTransitionAction() {
+    if (!state_queue_.CompleteAction()) {
+        return;
+    }
+    auto now = esp_timer_get_time();
+    auto& request = state_queue_.request();
+    transition_latency_.Record(now - request.request_time);
+    ESP_LOGI(TAG, "Transition %s -> %s: queued %" PRId64 " us, actions %" PRId64 " us", DeviceStateName(state_queue_.from()),
+        DeviceStateName(device_state_), state_queue_.start_time() - request.request_time,
+        now - state_queue_.start_time());
+    RunStateRequests();
+}
+
+void Application::UpdateStateIndicators() {
+    auto& board = Board::GetInstance();
+    board.GetLed()->OnStateChanged();
+    auto& indicator = kStateIndicators[device_state_];
+    if (indicator.status != nullptr) {
+        auto display = board.GetDisplay();
+        display->SetStatus(indicator.status);
+        display->SetEmotion(indicator.emotion);
+        display->SetChatMessage(indicator.role, indicator.message);
+    }
+}
 
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
@@ -8,29 +8,51 @@
 
 #include <string>
 #include <mutex>
-#include <list>
 #include <vector>
+#include <atomic>
 
 #include "background_task.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "audio_frame.h"
+#include "latency_histogram.h"
+#include "task_queue.h"
+#include "device_state.h"
+#include "device_state_queue.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
 #endif
+#if CONFIG_USE_AUDIO_FRONT_END
+#include "audio_front_end.h"
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+#include "afe_audio_processor.h"
+#else
+#include "dummy_audio_processor.h"
+#endif
 
-enum DeviceState {
-    kDeviceStateUnknown,
-    kDeviceStateStarting,
-    kDeviceStateWifiConfiguring,
-    kDeviceStateIdle,
-    kDeviceStateConnecting,
-    kDeviceStateListening,
-    kDeviceStateSpeaking,
-    kDeviceStateUpgrading,
-    kDeviceStateActivating,
-    kDeviceStateFatalError
+// Main loop lanes, a task only runs when the lanes above it are empty
+enum TaskPriority {
+    kTaskPriorityHigh,
+    kTaskPriorityNormal,
+    kTaskPriorityLow,
+    kTaskPriorityCount
 };
 
 #define SCHEDULE_EVENT (1 << 0)
+// Completions of transition actions, kept out of the task lanes so they can not be dropped;
+// each action runs at most once per transition, so a bit is never needed twice
+#define OUTPUT_DRAINED_EVENT (1 << 1)
+#define STATE_INDICATORS_EVENT (1 << 2)
+
+// Button and wake word state changes should start within this time
+#define STATE_CHANGE_DEADLINE_MS 20
+// Longest wait for the speaker to play out before listening starts anyway
+#define OUTPUT_DRAIN_TIMEOUT_MS 500
+
+// Audio loop notification bit, next to the AUDIO_CODEC_EVENT_* bits
+#define AUDIO_LOOP_STATE_CHANGED (1 << 2)
 
 class Application {
 public:
@@ -45,7 +67,26 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    // Safe from any task or timer; never allocates for captures of up to InlineTask::kInlineSize
+    // bytes. An ISR may only queue callables that are InlineTask::kIsrSafe, e.g. lambdas capturing
+    // pointers and integers; anything else is refused there before it is constructed.
+    // Returns false when refused or when the lane is full, both count as dropped.
+    // A task that starts more than deadline_ms after being scheduled is counted as late,
+    // name must be a string literal, the run-time stats are kept per name.
+    template <typename F>
+    bool Schedule(F&& callback, TaskPriority priority = kTaskPriorityNormal, int deadline_ms = 0,
+            const char* name = "task") {
+        if constexpr (!InlineTask::kIsrSafe<std::decay_t<F>>) {
+            if (xPortInIsrContext()) {
+                main_tasks_dropped_[priority]++;
+                return false;
+            }
+        }
+        return ScheduleTask(InlineTask(std::forward<F>(callback)), priority, deadline_ms, name);
+    }
+    // Logs the run-time stats of every task name from the main loop
+    void DumpTaskStats();
+    // Queues the transition, it runs on the main loop after the ones queued before
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "");
     void DismissAlert();
@@ -61,12 +102,48 @@ private:
     Application();
     ~Application();
 
+#if CONFIG_USE_AUDIO_FRONT_END
+    // Fed once, shared by the wake word detector and the audio processor
+    AudioFrontEnd audio_front_end_;
+#endif
 #if CONFIG_USE_WAKE_WORD_DETECT
     WakeWordDetect wake_word_detect_;
 #endif
+    AudioProcessor* audio_processor_ = nullptr;
 
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    bool ScheduleTask(InlineTask callback, TaskPriority priority, int deadline_ms, const char* name);
+    struct MainTask {
+        InlineTask callback;
+        const char* name = nullptr;
+        int64_t scheduled_time = 0;
+        // 0 when the task has no deadline
+        int64_t deadline_us = 0;
+    };
+    // Only touched by the main loop
+    struct TaskStats {
+        const char* name = nullptr;
+        uint32_t runs = 0;
+        uint32_t late = 0;
+        int64_t total_us = 0;
+        int64_t max_us = 0;
+        int64_t max_late_us = 0;
+    };
+    static constexpr int kMaxTaskStats = 16;
+    TaskQueue<MainTask, 32> main_tasks_[kTaskPriorityCount];
+    std::atomic<uint32_t> main_tasks_dropped_[kTaskPriorityCount] = {};
+    // From Schedule() to the start of the callback, per lane
+    LatencyHistogram schedule_latency_[kTaskPriorityCount];
+    TaskStats task_stats_[kMaxTaskStats];
+
+    // Device state transitions, run one at a time by the main loop
+    DeviceStateQueue state_queue_;
+    // Listening after speaking waits for the speaker, ended by the codec or the timer
+    OutputDrainWait output_drain_;
+    esp_timer_handle_t output_drain_timer_handle_ = nullptr;
+    LatencyHistogram transition_latency_;
+    // Allowed edges and entry/exit actions, one row per state in enum order
+    static const DeviceStateInfo<Application> kDeviceStates[kDeviceStateCount];
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
@@ -79,12 +156,48 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_loop_task_handle_ = nullptr;
     BackgroundTask* background_task_ = nullptr;
-    std::vector<int16_t> demo_audio_raw_data_;
+    // Captured audio waiting for playback, written by OnAudioInput and drained by OnAudioOutput
+    SpscRingBuffer<int16_t>* audio_buffer_ = nullptr;
+    std::vector<int16_t> output_frame_;
+    // Playback metrics: first-sample latency and frame-to-frame jitter
+    int64_t playback_request_time_ = 0;
+    int64_t last_output_time_ = 0;
+    bool playback_active_ = false;
+    // Set by a transition that abandons playback or starts a new capture, the audio loop
+    // (the consumer of audio_buffer_) then drops whatever is left
+    std::atomic<bool> discard_playback_{false};
+    LatencyHistogram output_jitter_;
+    // Time spent per input frame reading (and resampling) and feeding the consumers
+    LatencyHistogram input_read_time_;
+    LatencyHistogram input_feed_time_;
+    // Capture metrics: latency from entering the listening state to the first captured frame
+    int64_t capture_request_time_ = 0;
+    bool capture_pending_ = false;
+    std::atomic<uint32_t> audio_loop_wakeups_{0};
+    // Captured frames, shared in place by the wake word detector and the recorder
+    AudioFramePool* input_frames_ = nullptr;
+    std::atomic<uint32_t> input_bytes_copied_{0};
+    std::atomic<uint32_t> input_bytes_captured_{0};
+    Resampler input_resampler_;
+    std::vector<int16_t> input_buffer_;
 
     void MainEventLoop();
-    void OnAudioInput();
-    void OnAudioOutput();
-    void ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
+    void RunStateRequests();
+    void BeginTransition(const DeviceStateQueue::Request& request);
+    void CompleteTransitionAction();
+    void OnOutputDrained();
+    void UpdateStateIndicators();
+    void EnterListening(DeviceState previous);
+    void ExitListening(DeviceState next);
+    // Returns the lane the task came from, -1 when all lanes are empty
+    int PopMainTask(MainTask& task);
+    void RunMainTask(MainTask& task, int lane);
+    bool OnAudioInput();
+    void StoreCapturedAudio(const int16_t* data, size_t samples, int channels);
+    bool OnAudioOutput();
+    void FinishPlayback();
+    void UpdateAudioEvents();
+    bool ReadAudio(AudioFrame& frame, int sample_rate);
     void ResetDecoder();
     void OnClockTimer();
     void AudioLoop();
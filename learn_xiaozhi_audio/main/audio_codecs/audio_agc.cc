@@ -0,0 +1,89 @@
+#include "audio_agc.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+AudioAgc::AudioAgc() : AudioAgc(Config()) {
+}
+
+AudioAgc::AudioAgc(const Config& config) : config_(config) {
+}
+
+// Scales a sample by a Q16 gain and saturates it, counting the clipped samples
+static inline int16_t ScaleSample(int32_t sample, int32_t gain, uint32_t& clipped) {
+    int64_t value = ((int64_t)sample * gain) >> 16;
+    if (value > INT16_MAX) {
+        clipped++;
+        return INT16_MAX;
+    }
+    if (value < -INT16_MAX) {
+        clipped++;
+        return -INT16_MAX;
+    }
+    return (int16_t)value;
+}
+
+void AudioAgc::Process(const int32_t* in, int channels, const int16_t* reference, int16_t* out, size_t frames, int shift) {
+    if (frames == 0) {
+        return;
+    }
+    int32_t target = gain();
+    // Q16 gain, stepped per frame so the ramp needs no division per sample
+    int32_t step = (target - applied_gain_) / (int32_t)frames;
+    int32_t gain = applied_gain_;
+    int32_t peak = 0;
+    uint32_t clipped = 0;
+    for (size_t i = 0; i < frames; i++) {
+        gain += step;
+        for (int c = 0; c < channels; c++) {
+            int32_t sample = *in++ >> shift;
+            peak = std::max(peak, std::abs(sample));
+            *out++ = ScaleSample(sample, gain, clipped);
+        }
+        if (reference != nullptr) {
+            *out++ = reference[i];
+        }
+    }
+    applied_gain_ = target;
+    Update(peak, clipped);
+}
+
+void AudioAgc::Process(int16_t* data, int channels, bool has_reference, size_t frames) {
+    if (frames == 0) {
+        return;
+    }
+    int mic_channels = has_reference ? channels - 1 : channels;
+    int32_t target = gain();
+    int32_t step = (target - applied_gain_) / (int32_t)frames;
+    int32_t gain = applied_gain_;
+    int32_t peak = 0;
+    uint32_t clipped = 0;
+    for (size_t i = 0; i < frames; i++) {
+        gain += step;
+        for (int c = 0; c < mic_channels; c++) {
+            int32_t sample = data[c];
+            peak = std::max(peak, std::abs(sample));
+            data[c] = ScaleSample(sample, gain, clipped);
+        }
+        data += channels;
+    }
+    applied_gain_ = target;
+    Update(peak, clipped);
+}
+
+void AudioAgc::Update(int32_t peak, uint32_t clipped) {
+    peak_.store(peak, std::memory_order_relaxed);
+    if (clipped > 0) {
+        clipped_.fetch_add(clipped, std::memory_order_relaxed);
+    }
+    int32_t gain = applied_gain_;
+    if (peak > 0 && ((int64_t)peak * gain >> 16) > config_.target_peak) {
+        // Limiter: the next frame reaches the target at most
+        gain = (int64_t)config_.target_peak * kUnityGain / peak;
+    } else if (peak >= config_.noise_floor) {
+        gain += std::max(gain >> config_.release_shift, 1);
+        // Never release past the gain that would put this frame on target
+        gain = std::min<int64_t>(gain, (int64_t)config_.target_peak * kUnityGain / peak);
+    }
+    gain_.store(std::clamp(gain, config_.min_gain, config_.max_gain), std::memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#ifndef _AUDIO_AGC_H
+#define _AUDIO_AGC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// Fixed-point automatic gain control and limiter for captured audio.
+// One pass per frame converts the samples to 16 bits with the current gain, ramped from the
+// previous frame's gain to avoid steps, and measures the frame peak. The peak then sets the
+// gain of the next frame: it drops at once when the frame would exceed the target level and
+// recovers slowly, and quiet frames below the noise floor never raise it.
+// All microphone channels share one gain, the reference channel is passed unchanged.
+class AudioAgc {
+public:
+    // Q16 gain on top of `shift`, 1.0 reproduces the plain shift
+    static constexpr int32_t kUnityGain = 1 << 16;
+
+    struct Config {
+        // Peak level the gain aims for, -6 dBFS
+        int32_t target_peak = 16384;
+        int32_t min_gain = kUnityGain / 16;
+        int32_t max_gain = kUnityGain * 16;
+        // Frames quieter than this (before gain) keep the current gain
+        int32_t noise_floor = 64;
+        // The gain grows by gain >> release_shift per frame, about 0.07 dB with 7
+        int release_shift = 7;
+    };
+
+    AudioAgc();
+    explicit AudioAgc(const Config& config);
+
+    // 32-bit I2S slots to 16 bits, interleaving a reference sample per frame when not null
+    void Process(const int32_t* in, int channels, const int16_t* reference, int16_t* out, size_t frames, int shift);
+    // 16-bit samples in place, the reference channel (the last one) is left alone when present
+    void Process(int16_t* data, int channels, bool has_reference, size_t frames);
+
+    inline int32_t gain() const { return gain_.load(std::memory_order_relaxed); }
+    inline uint32_t clipped() const { return clipped_.load(std::memory_order_relaxed); }
+    inline int32_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+private:
+    Config config_;
+    std::atomic<int32_t> gain_{kUnityGain};
+    std::atomic<int32_t> peak_{0};
+    std::atomic<uint32_t> clipped_{0};
+    // Gain the last frame ended with, the next one ramps from here
+    int32_t applied_gain_ = kUnityGain;
+
+    void Update(int32_t peak, uint32_t clipped);
+};
+
+#endif // _AUDIO_AGC_H
@@ -1,29 +1,65 @@
 #include "audio_codec.h"
 #include "board.h"
 #include "settings.h"
+#include "audio_kernels.h"
 
 #include <esp_log.h>
+#include <esp_attr.h>
 #include <cstring>
+#include <algorithm>
 #include <driver/i2s_common.h>
 
 #define TAG "AudioCodec"
 
 AudioCodec::AudioCodec() {
+    Settings settings("audio", false);
+    dma_desc_num_ = std::clamp<int>(settings.GetInt("dma_desc_num", AUDIO_CODEC_DMA_DESC_NUM),
+        AUDIO_CODEC_DMA_DESC_NUM_MIN, AUDIO_CODEC_DMA_DESC_NUM_MAX);
+    dma_frame_num_ = std::clamp<int>(settings.GetInt("dma_frame_num", AUDIO_CODEC_DMA_FRAME_NUM),
+        AUDIO_CODEC_DMA_FRAME_NUM_MIN, AUDIO_CODEC_DMA_FRAME_NUM_MAX);
+    ESP_LOGI(TAG, "DMA geometry: %d x %d frames", dma_desc_num_, dma_frame_num_);
 }
 
 AudioCodec::~AudioCodec() {
+    if (rx_task_ != nullptr) {
+        vTaskDelete(rx_task_);
+    }
+    if (tx_task_ != nullptr) {
+        vTaskDelete(tx_task_);
+    }
+    delete rx_queue_;
+    delete tx_queue_;
+    delete tx_drain_;
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
-    Write(data.data(), data.size());
+    OutputData(data.data(), data.size());
+}
+
+void AudioCodec::OutputData(const int16_t* data, size_t samples) {
+    if (tx_queue_->Write(data, samples) < samples) {
+        tx_dropped_++;
+    }
+    xTaskNotifyGive(tx_task_);
 }
 
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
-        return true;
+    return InputData(data.data(), data.size());
+}
+
+bool AudioCodec::InputData(int16_t* data, size_t samples) {
+    if (rx_queue_->Available() < samples) {
+        return false;
     }
-    return false;
+    return rx_queue_->Read(data, samples) > 0;
+}
+
+size_t AudioCodec::output_space() const {
+    return tx_queue_ != nullptr ? tx_queue_->Free() : 0;
+}
+
+bool AudioCodec::output_empty() const {
+    return tx_queue_ == nullptr || (tx_queue_->Available() == 0 && (tx_drain_ == nullptr || tx_drain_->drained()));
 }
 
 void AudioCodec::Start() {
@@ -33,17 +69,160 @@ void AudioCodec::Start() {
         ESP_LOGW(TAG, "Output volume value (%d) is too small, setting to default (10)", output_volume_);
         output_volume_ = 10;
     }
+    output_gain_ = AudioKernels::VolumeToGain(output_volume_);
 
-    ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
-    ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
+    // File-backed codecs have no I2S channels
+    if (rx_handle_ != nullptr && tx_handle_ != nullptr) {
+        tx_drain_ = new DmaDrainCounter(dma_desc_num_);
+        // DMA callbacks can only be registered before the channels are enabled
+        i2s_event_callbacks_t rx_callbacks = {};
+        rx_callbacks.on_recv_q_ovf = OnInputOverflow;
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(rx_handle_, &rx_callbacks, this));
+        i2s_event_callbacks_t tx_callbacks = {};
+        tx_callbacks.on_send_q_ovf = OnOutputUnderflow;
+        tx_callbacks.on_sent = OnOutputSent;
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(tx_handle_, &tx_callbacks, this));
+
+        ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
+        ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
+    }
 
     EnableInput(true);
     EnableOutput(true);
+
+    rx_frame_.resize(dma_frame_num_ * input_channels_);
+    rx_queue_ = new SpscRingBuffer<int16_t>(AUDIO_CODEC_RX_QUEUE_FRAMES * rx_frame_.size());
+    tx_queue_ = new SpscRingBuffer<int16_t>(AUDIO_CODEC_TX_QUEUE_FRAMES * dma_frame_num_ * output_channels_);
+
+    // Capture and playback never wait for each other, on dual-core chips they also run on different cores
+    xTaskCreatePinnedToCore([](void* arg) {
+        auto codec = (AudioCodec*)arg;
+        codec->InputTask();
+        vTaskDelete(NULL);
+    }, "audio_input", 4096, this, 9, &rx_task_, 0);
+    xTaskCreatePinnedToCore([](void* arg) {
+        auto codec = (AudioCodec*)arg;
+        codec->OutputTask();
+        vTaskDelete(NULL);
+    }, "audio_output", 4096, this, 9, &tx_task_, portNUM_PROCESSORS > 1 ? 1 : 0);
     ESP_LOGI(TAG, "Audio codec started");
 }
 
+void AudioCodec::SetEventTask(TaskHandle_t task) {
+    event_task_ = task;
+}
+
+void AudioCodec::SetEventMask(uint32_t mask) {
+    uint32_t previous = event_mask_.exchange(mask);
+    if ((mask & AUDIO_CODEC_EVENT_INPUT_READY) && !(previous & AUDIO_CODEC_EVENT_INPUT_READY) && rx_task_ != nullptr) {
+        // Resume capture without the frames queued before the pause. The caller is the
+        // consumer of InputData(), the only side that may clear the queue.
+        rx_queue_->Clear();
+        xTaskNotifyGive(rx_task_);
+    }
+}
+
+void AudioCodec::NotifyEvent(uint32_t event) {
+    if (event_task_ != nullptr && (event_mask_.load(std::memory_order_relaxed) & event) != 0) {
+        xTaskNotify(event_task_, event, eSetBits);
+    }
+}
+
+void AudioCodec::InputTask() {
+    while (true) {
+        if ((event_mask_ & AUDIO_CODEC_EVENT_INPUT_READY) == 0) {
+            // Nobody listens, stop reading until the mask asks for input again
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        int samples = Read(rx_frame_.data(), rx_frame_.size());
+        if (samples <= 0 || (event_mask_ & AUDIO_CODEC_EVENT_INPUT_READY) == 0) {
+            // Paused during the read, the frame would be stale on resume
+            continue;
+        }
+        if (rx_queue_->Free() < (size_t)samples) {
+            rx_dropped_++;
+        } else {
+            rx_queue_->Write(rx_frame_.data(), samples);
+            rx_frames_++;
+        }
+        NotifyEvent(AUDIO_CODEC_EVENT_INPUT_READY);
+    }
+}
+
+void AudioCodec::OutputTask() {
+    while (true) {
+        const int16_t* data;
+        size_t samples = tx_queue_->GetReadSpan(&data);
+        if (samples == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // Blocks until the DMA has room, which paces this task at the output sample rate
+        samples = std::min<size_t>(samples, dma_frame_num_ * output_channels_);
+        Write(data, samples);
+        tx_queue_->CommitRead(samples);
+        tx_frames_++;
+        NotifyEvent(AUDIO_CODEC_EVENT_OUTPUT_READY);
+        if (tx_drain_ != nullptr) {
+            tx_drain_->OnWritten();
+        } else if (tx_queue_->Available() == 0) {
+            // File-backed codecs write synchronously, the audio is out once Write() returns
+            NotifyEvent(AUDIO_CODEC_EVENT_OUTPUT_EMPTY);
+        }
+    }
+}
+
+uint32_t AudioCodec::pipeline_run_time() const {
+    uint32_t run_time = 0;
+    for (auto task : {rx_task_, tx_task_}) {
+        if (task != nullptr) {
+            TaskStatus_t status;
+            vTaskGetInfo(task, &status, pdFALSE, eRunning);
+            run_time += status.ulRunTimeCounter;
+        }
+    }
+    return run_time;
+}
+
+bool IRAM_ATTR AudioCodec::OnInputOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = static_cast<AudioCodec*>(user_ctx);
+    // Overflows while capture is paused are expected
+    if (codec->event_mask_.load(std::memory_order_relaxed) & AUDIO_CODEC_EVENT_INPUT_READY) {
+        codec->rx_late_++;
+    }
+    return false;
+}
+
+bool IRAM_ATTR AudioCodec::OnOutputUnderflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = static_cast<AudioCodec*>(user_ctx);
+    // The DMA ran dry although audio was waiting in the queue
+    if (codec->tx_queue_ != nullptr && codec->tx_queue_->Available() > 0) {
+        codec->tx_late_++;
+    }
+    return false;
+}
+
+bool IRAM_ATTR AudioCodec::OnOutputSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) {
+    auto codec = static_cast<AudioCodec*>(user_ctx);
+    // Also called for the buffers of silence ahead of the audio, only the drain point counts
+    if (!codec->tx_drain_->OnSent()) {
+        return false;
+    }
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (codec->tx_queue_->Available() == 0 && codec->event_task_ != nullptr &&
+        (codec->event_mask_.load(std::memory_order_relaxed) & AUDIO_CODEC_EVENT_OUTPUT_EMPTY) != 0) {
+        xTaskNotifyFromISR(codec->event_task_, AUDIO_CODEC_EVENT_OUTPUT_EMPTY, eSetBits, &higher_priority_task_woken);
+    }
+    return higher_priority_task_woken == pdTRUE;
+}
+
 void AudioCodec::SetOutputVolume(int volume) {
     output_volume_ = volume;
+    output_gain_ = AudioKernels::VolumeToGain(output_volume_);
     ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
     
     Settings settings("audio", true);
@@ -3,16 +3,45 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/task.h>
 #include <driver/i2s_std.h>
 
 #include <vector>
 #include <string>
 #include <functional>
+#include <atomic>
 
 #include "board.h"
+#include "ring_buffer.h"
+#include "audio_agc.h"
+#include "dma_drain_counter.h"
 
+// Default DMA geometry, overridden by "dma_desc_num" / "dma_frame_num" in Settings("audio")
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
+#define AUDIO_CODEC_DMA_DESC_NUM_MIN 2
+#define AUDIO_CODEC_DMA_DESC_NUM_MAX 16
+#define AUDIO_CODEC_DMA_FRAME_NUM_MIN 32
+// A DMA buffer holds at most 4092 bytes, that is 511 stereo frames of 32 bits
+#define AUDIO_CODEC_DMA_FRAME_NUM_MAX 511
+
+// DMA frames buffered between the RX/TX pipeline tasks and the application
+#define AUDIO_CODEC_RX_QUEUE_FRAMES 16
+#define AUDIO_CODEC_TX_QUEUE_FRAMES 8
+
+// Task notification bits sent by the pipeline tasks, see SetEventTask()
+#define AUDIO_CODEC_EVENT_INPUT_READY (1 << 0)
+#define AUDIO_CODEC_EVENT_OUTPUT_READY (1 << 1)
+// The TX queue and the DMA ran out of audio, bit 2 is left to the event task
+#define AUDIO_CODEC_EVENT_OUTPUT_EMPTY (1 << 3)
+
+struct AudioPipelineStats {
+    uint32_t frames;
+    // Frames (partly) thrown away because the queue to or from the application was full
+    uint32_t dropped;
+    // DMA buffers lost because the pipeline task did not keep up
+    uint32_t late;
+};
 
 class AudioCodec {
 public:
@@ -24,8 +53,26 @@ public:
     virtual void EnableOutput(bool enable);
 
     void Start();
+    // Notify `task` when a frame was queued by the RX task or dequeued by the TX task,
+    // for the events enabled in the mask only. Capture runs only while the mask asks for input;
+    // the mask is set by the consumer of InputData(), and resuming capture drops what was queued.
+    void SetEventTask(TaskHandle_t task);
+    void SetEventMask(uint32_t mask);
+    // Queue audio for the TX task, whatever does not fit is dropped
     void OutputData(std::vector<int16_t>& data);
+    void OutputData(const int16_t* data, size_t samples);
+    // Dequeue captured audio, fails without consuming anything if not enough is queued
+    bool InputData(int16_t* data, size_t samples);
     bool InputData(std::vector<int16_t>& data);
+    size_t output_space() const;
+    // Everything queued was played, see DmaDrainCounter for how late this may be reported
+    bool output_empty() const;
+    AudioPipelineStats input_stats() const { return {rx_frames_, rx_dropped_, rx_late_}; }
+    AudioPipelineStats output_stats() const { return {tx_frames_, tx_dropped_, tx_late_}; }
+    // Run time counter of the pipeline tasks, to estimate their CPU load
+    uint32_t pipeline_run_time() const;
+    // Gain control of the captured audio, nullptr when the codec has none
+    virtual const AudioAgc* input_agc() const { return nullptr; }
 
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
@@ -36,6 +83,8 @@ public:
     inline int output_volume() const { return output_volume_; }
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
+    inline int dma_desc_num() const { return dma_desc_num_; }
+    inline int dma_frame_num() const { return dma_frame_num_; }
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -50,9 +99,43 @@ protected:
     int input_channels_ = 1;
     int output_channels_ = 1;
     int output_volume_ = 70;
+    // Q16 output gain derived from output_volume_, only recomputed when the volume changes
+    int32_t output_gain_ = 0;
+    // DMA geometry loaded from the settings when the codec is constructed, before the channels are created
+    int dma_desc_num_ = AUDIO_CODEC_DMA_DESC_NUM;
+    int dma_frame_num_ = AUDIO_CODEC_DMA_FRAME_NUM;
+
+    // Samples held by the whole DMA ring of one channel
+    inline size_t dma_buffer_samples() const { return dma_desc_num_ * dma_frame_num_; }
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+
+private:
+    TaskHandle_t event_task_ = nullptr;
+    std::atomic<uint32_t> event_mask_{0};
+
+    // Full-duplex pipeline: each direction has its own task and queue
+    TaskHandle_t rx_task_ = nullptr;
+    TaskHandle_t tx_task_ = nullptr;
+    SpscRingBuffer<int16_t>* rx_queue_ = nullptr;
+    SpscRingBuffer<int16_t>* tx_queue_ = nullptr;
+    std::vector<int16_t> rx_frame_;
+    uint32_t rx_frames_ = 0;
+    uint32_t rx_dropped_ = 0;
+    uint32_t rx_late_ = 0;
+    uint32_t tx_frames_ = 0;
+    uint32_t tx_dropped_ = 0;
+    uint32_t tx_late_ = 0;
+    // Whether the DMA has played what the TX task wrote, nullptr without I2S channels
+    DmaDrainCounter* tx_drain_ = nullptr;
+
+    void InputTask();
+    void OutputTask();
+    void NotifyEvent(uint32_t event);
+    static bool OnInputOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool OnOutputUnderflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
+    static bool OnOutputSent(i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx);
 };
 
 #endif // _AUDIO_CODEC_H
@@ -0,0 +1,179 @@
+#include "audio_dma_tuner.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cinttypes>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "AudioDmaTuner"
+
+#define TUNE_DURATION_MS 5000
+#define CLICK_INTERVAL_MS 500
+#define CLICK_SAMPLES 16
+#define CLICK_LEVEL 24000
+#define CLICK_THRESHOLD 8000
+// Geometries above this load lose to any geometry below it
+#define CPU_LIMIT_PERMILLE 300
+
+struct DmaGeometry {
+    int desc_num;
+    int frame_num;
+};
+
+static const DmaGeometry kCandidates[] = {
+    {3, 240}, {4, 240}, {6, 240}, {8, 240},
+    {4, 120}, {6, 120}, {8, 120},
+    {2, 480}, {4, 480},
+};
+static const int kCandidateCount = sizeof(kCandidates) / sizeof(kCandidates[0]);
+
+bool AudioDmaTuner::Result::IsBetterThan(const Result& other) const {
+    if (underruns != other.underruns) {
+        return underruns < other.underruns;
+    }
+    bool overloaded = cpu_permille > CPU_LIMIT_PERMILLE;
+    if (overloaded != (other.cpu_permille > CPU_LIMIT_PERMILLE)) {
+        return !overloaded;
+    }
+    if (latency_ms != other.latency_ms) {
+        return latency_ms < other.latency_ms;
+    }
+    return cpu_permille < other.cpu_permille;
+}
+
+AudioDmaTuner::AudioDmaTuner(AudioCodec* codec) : codec_(codec) {
+}
+
+static void SelectGeometry(Settings& settings, const DmaGeometry& geometry) {
+    settings.SetInt("dma_desc_num", geometry.desc_num);
+    settings.SetInt("dma_frame_num", geometry.frame_num);
+}
+
+bool AudioDmaTuner::Run() {
+    Settings settings("audio", true);
+    int step = settings.GetInt("dma_tune_step", -1);
+    if (step < 0) {
+        if (settings.GetInt("dma_tuned", 0)) {
+            return false;
+        }
+        ESP_LOGI(TAG, "Start tuning %d DMA geometries", kCandidateCount);
+        settings.SetInt("dma_tune_step", 0);
+        settings.EraseKey("dma_tune_best");
+        SelectGeometry(settings, kCandidates[0]);
+        return true;
+    }
+    if (step >= kCandidateCount) {
+        settings.EraseKey("dma_tune_step");
+        return false;
+    }
+
+    Result result = Measure();
+    ESP_LOGI(TAG, "Geometry %d x %d: underruns %" PRIu32 " cpu %d.%d%% latency %d ms",
+        codec_->dma_desc_num(), codec_->dma_frame_num(), result.underruns,
+        result.cpu_permille / 10, result.cpu_permille % 10, result.latency_ms);
+
+    int best = settings.GetInt("dma_tune_best", -1);
+    Result best_result = {
+        (uint32_t)settings.GetInt("dma_tune_urun"),
+        (int)settings.GetInt("dma_tune_cpu"),
+        (int)settings.GetInt("dma_tune_lat"),
+    };
+    if (best < 0 || result.IsBetterThan(best_result)) {
+        best = step;
+        settings.SetInt("dma_tune_best", best);
+        settings.SetInt("dma_tune_urun", result.underruns);
+        settings.SetInt("dma_tune_cpu", result.cpu_permille);
+        settings.SetInt("dma_tune_lat", result.latency_ms);
+    }
+
+    step++;
+    if (step < kCandidateCount) {
+        settings.SetInt("dma_tune_step", step);
+        SelectGeometry(settings, kCandidates[step]);
+    } else {
+        ESP_LOGI(TAG, "Tuning done, best geometry %d x %d", kCandidates[best].desc_num, kCandidates[best].frame_num);
+        settings.EraseKey("dma_tune_step");
+        settings.SetInt("dma_tuned", 1);
+        SelectGeometry(settings, kCandidates[best]);
+    }
+    return true;
+}
+
+// Keeps the TX queue full of silence with a click every CLICK_INTERVAL_MS, and times
+// each click until the first microphone picks it up
+AudioDmaTuner::Result AudioDmaTuner::Measure() {
+    codec_->SetEventTask(xTaskGetCurrentTaskHandle());
+    codec_->SetEventMask(AUDIO_CODEC_EVENT_INPUT_READY | AUDIO_CODEC_EVENT_OUTPUT_READY);
+
+    auto input_before = codec_->input_stats();
+    auto output_before = codec_->output_stats();
+    uint32_t run_time_before = codec_->pipeline_run_time();
+
+    std::vector<int16_t> output(codec_->dma_frame_num() * codec_->output_channels(), 0);
+    std::vector<int16_t> input(codec_->dma_frame_num() * codec_->input_channels());
+    int input_channels = codec_->input_channels();
+    int64_t start_time = esp_timer_get_time();
+    int64_t now = start_time;
+    int64_t click_time = 0;
+    int64_t next_click = start_time + CLICK_INTERVAL_MS * 1000;
+    int64_t latency_total = 0;
+    int latency_count = 0;
+
+    while (now - start_time < TUNE_DURATION_MS * 1000) {
+        xTaskNotifyWait(0, UINT32_MAX, nullptr, pdMS_TO_TICKS(100));
+        now = esp_timer_get_time();
+
+        while (codec_->output_space() >= output.size()) {
+            bool click = click_time == 0 && now >= next_click;
+            if (click) {
+                std::fill_n(output.begin(), std::min<size_t>(CLICK_SAMPLES, output.size()), CLICK_LEVEL);
+                click_time = now;
+                next_click = now + CLICK_INTERVAL_MS * 1000;
+            }
+            codec_->OutputData(output);
+            if (click) {
+                std::fill(output.begin(), output.end(), 0);
+            }
+        }
+
+        while (codec_->InputData(input)) {
+            if (click_time == 0) {
+                continue;
+            }
+            for (size_t i = 0; i < input.size(); i += input_channels) {
+                if (abs(input[i]) > CLICK_THRESHOLD) {
+                    latency_total += now - click_time;
+                    latency_count++;
+                    click_time = 0;
+                    break;
+                }
+            }
+            if (click_time != 0 && now - click_time > CLICK_INTERVAL_MS * 1000) {
+                // Not heard, try the next one
+                click_time = 0;
+            }
+        }
+    }
+
+    codec_->SetEventMask(0);
+    int64_t elapsed = esp_timer_get_time() - start_time;
+    auto input_after = codec_->input_stats();
+    auto output_after = codec_->output_stats();
+
+    Result result;
+    result.underruns = (input_after.late - input_before.late) + (input_after.dropped - input_before.dropped) +
+        (output_after.late - output_before.late);
+    // The run time counter ticks in microseconds
+    result.cpu_permille = (int64_t)(codec_->pipeline_run_time() - run_time_before) * 1000 / elapsed;
+    if (latency_count > 0) {
+        result.latency_ms = latency_total / latency_count / 1000;
+    } else {
+        // No echo from the speaker, fall back to the depth of the queues a sample passes
+        int frames = (AUDIO_CODEC_TX_QUEUE_FRAMES + codec_->dma_desc_num() + 1) * codec_->dma_frame_num();
+        result.latency_ms = frames * 1000 / codec_->output_sample_rate();
+        ESP_LOGW(TAG, "No click heard, estimated latency from the queue depth");
+    }
+    return result;
+}
@@ -0,0 +1,35 @@
+#ifndef _AUDIO_DMA_TUNER_H
+#define _AUDIO_DMA_TUNER_H
+
+#include "audio_codec.h"
+
+// Sweeps the I2S DMA geometry. The channels are only created once, so every candidate
+// takes a boot: the tuner measures the geometry the codec was built with, stores the
+// result in Settings("audio") and selects the next candidate. After the last candidate
+// the best geometry is kept and the tuner stays off.
+class AudioDmaTuner {
+public:
+    struct Result {
+        uint32_t underruns;
+        // CPU time of the codec pipeline tasks, in 1/1000 of one core
+        int cpu_permille;
+        // From queuing a click to hearing it on the first microphone
+        int latency_ms;
+
+        bool IsBetterThan(const Result& other) const;
+    };
+
+    explicit AudioDmaTuner(AudioCodec* codec);
+    virtual ~AudioDmaTuner() = default;
+
+    // Returns true when the device has to reboot to apply a new geometry
+    bool Run();
+
+protected:
+    AudioCodec* codec_;
+
+    // Measures the geometry the codec runs with, replaced by a simulation in host_test
+    virtual Result Measure();
+};
+
+#endif // _AUDIO_DMA_TUNER_H
@@ -0,0 +1,141 @@
+#include "audio_kernels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace AudioKernels {
+
+// Largest gain for which int16 * gain always fits in int32 (and in two int16 madd halves)
+#define UNITY_GAIN 65536
+#define MADD_MAX_GAIN (INT16_MAX * 2)
+
+int32_t VolumeToGain(int volume) {
+    if (volume <= 0) {
+        return 0;
+    }
+    return int64_t(volume) * volume * UNITY_GAIN / 10000;
+}
+
+void ApplyGainScalar(const int16_t* in, int32_t* out, size_t samples, int32_t gain) {
+    for (size_t i = 0; i < samples; i++) {
+        int64_t temp = int64_t(in[i]) * gain;
+        if (temp > INT32_MAX) {
+            out[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            out[i] = INT32_MIN;
+        } else {
+            out[i] = static_cast<int32_t>(temp);
+        }
+    }
+}
+
+void ApplyGain(const int16_t* in, int32_t* out, size_t samples, int32_t gain) {
+    if (gain < 0 || gain > UNITY_GAIN) {
+        // Only here can the product leave the int32 range
+        ApplyGainScalar(in, out, samples, gain);
+        return;
+    }
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (gain == UNITY_GAIN) {
+        // Unity gain is a plain shift into the high half
+        for (; i + 8 <= samples; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(_mm_setzero_si128(), x));
+            _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(_mm_setzero_si128(), x));
+        }
+    } else if (gain <= MADD_MAX_GAIN) {
+        // in * gain == in * g1 + in * g2 with both halves in int16 range
+        int16_t g1 = gain > INT16_MAX ? INT16_MAX : gain;
+        int16_t g2 = gain - g1;
+        __m128i g = _mm_set_epi16(g2, g1, g2, g1, g2, g1, g2, g1);
+        for (; i + 8 <= samples; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_madd_epi16(_mm_unpacklo_epi16(x, x), g));
+            _mm_storeu_si128((__m128i*)(out + i + 4), _mm_madd_epi16(_mm_unpackhi_epi16(x, x), g));
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= samples; i += 8) {
+        int16x8_t x = vld1q_s16(in + i);
+        vst1q_s32(out + i, vmulq_n_s32(vmovl_s16(vget_low_s16(x)), gain));
+        vst1q_s32(out + i + 4, vmulq_n_s32(vmovl_s16(vget_high_s16(x)), gain));
+    }
+#else
+    for (; i + 4 <= samples; i += 4) {
+        int32_t a = in[i], b = in[i + 1], c = in[i + 2], d = in[i + 3];
+        out[i] = a * gain;
+        out[i + 1] = b * gain;
+        out[i + 2] = c * gain;
+        out[i + 3] = d * gain;
+    }
+#endif
+    for (; i < samples; i++) {
+        out[i] = int32_t(in[i]) * gain;
+    }
+}
+
+void ShiftToInt16Scalar(const int32_t* in, int16_t* out, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        out[i] = ClipInt16(in[i] >> shift);
+    }
+}
+
+void ShiftToInt16(const int32_t* in, int16_t* out, size_t samples, int shift) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i floor = _mm_set1_epi16(-INT16_MAX);
+    for (; i + 8 <= samples; i += 8) {
+        __m128i lo = _mm_sra_epi32(_mm_loadu_si128((const __m128i*)(in + i)), count);
+        __m128i hi = _mm_sra_epi32(_mm_loadu_si128((const __m128i*)(in + i + 4)), count);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_max_epi16(_mm_packs_epi32(lo, hi), floor));
+    }
+#elif defined(__ARM_NEON)
+    int32x4_t count = vdupq_n_s32(-shift);
+    int16x8_t floor = vdupq_n_s16(-INT16_MAX);
+    for (; i + 8 <= samples; i += 8) {
+        int16x4_t lo = vqmovn_s32(vshlq_s32(vld1q_s32(in + i), count));
+        int16x4_t hi = vqmovn_s32(vshlq_s32(vld1q_s32(in + i + 4), count));
+        vst1q_s16(out + i, vmaxq_s16(vcombine_s16(lo, hi), floor));
+    }
+#else
+    for (; i + 4 <= samples; i += 4) {
+        int32_t a = in[i] >> shift, b = in[i + 1] >> shift, c = in[i + 2] >> shift, d = in[i + 3] >> shift;
+        out[i] = ClipInt16(a);
+        out[i + 1] = ClipInt16(b);
+        out[i + 2] = ClipInt16(c);
+        out[i + 3] = ClipInt16(d);
+    }
+#endif
+    for (; i < samples; i++) {
+        out[i] = ClipInt16(in[i] >> shift);
+    }
+}
+
+void InterleaveToInt16(const int32_t* in, int channels, const int16_t* reference, int16_t* out, size_t frames, int shift) {
+    if (reference == nullptr) {
+        // The I2S DMA already interleaves the slots
+        ShiftToInt16(in, out, frames * channels, shift);
+        return;
+    }
+    if (channels == 1) {
+        for (size_t i = 0; i < frames; i++) {
+            out[2 * i] = ClipInt16(in[i] >> shift);
+            out[2 * i + 1] = reference[i];
+        }
+        return;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        for (int c = 0; c < channels; c++) {
+            *out++ = ClipInt16(*in++ >> shift);
+        }
+        *out++ = reference[i];
+    }
+}
+
+}
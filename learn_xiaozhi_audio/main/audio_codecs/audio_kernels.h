@@ -0,0 +1,35 @@
+#ifndef _AUDIO_KERNELS_H
+#define _AUDIO_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Sample conversion kernels for the codec hot path.
+// The *Scalar variants are the reference implementations, the others process
+// blocks with SSE2/NEON when available and fall back to unrolled loops that
+// the compiler can schedule well on Xtensa and RISC-V.
+namespace AudioKernels {
+
+// Q16 gain for an output volume of 0-100, (volume / 100)^2 * 65536
+int32_t VolumeToGain(int volume);
+
+// out[i] = saturate_int32(in[i] * gain)
+void ApplyGainScalar(const int16_t* in, int32_t* out, size_t samples, int32_t gain);
+void ApplyGain(const int16_t* in, int32_t* out, size_t samples, int32_t gain);
+
+// out[i] = clamp(in[i] >> shift, -INT16_MAX, INT16_MAX)
+void ShiftToInt16Scalar(const int32_t* in, int16_t* out, size_t samples, int shift);
+void ShiftToInt16(const int32_t* in, int16_t* out, size_t samples, int shift);
+
+// Interleave `frames` frames of `channels` 32-bit samples, shifted and clipped like
+// ShiftToInt16, and append one reference sample per frame when reference is not null
+void InterleaveToInt16(const int32_t* in, int channels, const int16_t* reference, int16_t* out, size_t frames, int shift);
+
+// Clip 32-bit intermediate samples to the symmetric int16 range
+inline int16_t ClipInt16(int32_t value) {
+    return (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+}
+
+}
+
+#endif // _AUDIO_KERNELS_H
@@ -0,0 +1,41 @@
+#ifndef DMA_DRAIN_COUNTER_H
+#define DMA_DRAIN_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Tells when the audio written to the TX DMA ring has been played. The I2S driver hands
+// Write() a buffer the DMA has already sent, which comes round again at the latest after
+// the DMA has sent every buffer of the ring once more. So the audio of a write is out once
+// desc_num buffers were sent after the write returned; whatever the DMA sends in between,
+// audio queued earlier or the silence it plays while idle, does not move that point.
+// While the DMA is kept busy the written buffer is exactly the last of the ring, starting
+// from idle the drain is reported up to desc_num - 1 buffers late, never early.
+class DmaDrainCounter {
+public:
+    explicit DmaDrainCounter(int desc_num) : desc_num_(desc_num) {}
+
+    // Writer, after every write to the DMA
+    inline void OnWritten() {
+        drained_at_.store(sent_.load(std::memory_order_acquire) + desc_num_, std::memory_order_release);
+    }
+    // on_sent callback, for every buffer the DMA sent. Returns true for the one buffer that
+    // completes the drain of the last write.
+    inline bool OnSent() {
+        uint32_t sent = sent_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        return sent == drained_at_.load(std::memory_order_acquire);
+    }
+    // Everything written has been sent
+    inline bool drained() const {
+        return (int32_t)(sent_.load(std::memory_order_acquire) - drained_at_.load(std::memory_order_acquire)) >= 0;
+    }
+
+private:
+    const uint32_t desc_num_;
+    // Buffers sent since the start, wrapping; a buffer lasts milliseconds, so comparing
+    // through a signed difference is safe for years
+    std::atomic<uint32_t> sent_{0};
+    std::atomic<uint32_t> drained_at_{0};
+};
+
+#endif // DMA_DRAIN_COUNTER_H
@@ -1,11 +1,18 @@
 #include "no_audio_codec.h"
+#include "audio_kernels.h"
 
 #include <esp_log.h>
-#include <cmath>
+#include <esp_heap_caps.h>
+#include <algorithm>
 #include <cstring>
 
 #define TAG "NoAudioCodec"
 
+// Scratch buffers hold the whole DMA ring (dma_buffer_samples()), larger requests are processed in chunks.
+// A written sample is played once the TX DMA ring ahead of it has drained,
+// so the reference lags the written audio by the whole ring as well.
+#define REFERENCE_BUFFER_RINGS 4
+
 NoAudioCodec::~NoAudioCodec() {
     if (rx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_disable(rx_handle_));
@@ -13,6 +20,79 @@ NoAudioCodec::~NoAudioCodec() {
     if (tx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_disable(tx_handle_));
     }
+    heap_caps_free(rx_buffer_);
+    heap_caps_free(tx_buffer_);
+    heap_caps_free(reference_frame_);
+    delete reference_;
+}
+
+bool NoAudioCodec::EnableInputReference() {
+    if (input_sample_rate_ != output_sample_rate_) {
+        ESP_LOGW(TAG, "Input reference needs equal sample rates (%d/%d)", input_sample_rate_, output_sample_rate_);
+        return false;
+    }
+    if (reference_ == nullptr) {
+        reference_ = new SpscRingBuffer<int16_t>(dma_buffer_samples() * REFERENCE_BUFFER_RINGS);
+        reference_frame_ = (int16_t*)heap_caps_malloc(dma_buffer_samples() * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    input_reference_ = true;
+    input_channels_ = mic_channels_ + 1;
+    ESP_LOGI(TAG, "Input reference enabled, %d channels", input_channels_);
+    return true;
+}
+
+void NoAudioCodec::PushReference(const int32_t* data, size_t samples) {
+    if (reference_->Available() == 0) {
+        // Playback starts behind the silence already queued in the TX DMA
+        for (size_t delay = dma_buffer_samples(); delay > 0;) {
+            int16_t* span;
+            size_t n = std::min(reference_->GetWriteSpan(&span), delay);
+            memset(span, 0, n * sizeof(int16_t));
+            reference_->CommitWrite(n);
+            delay -= n;
+        }
+    }
+    // Back to int16 after the output gain, which is what the speaker plays
+    while (samples > 0) {
+        int16_t* span;
+        size_t n = std::min(reference_->GetWriteSpan(&span), samples);
+        if (n == 0) {
+            break;
+        }
+        AudioKernels::ShiftToInt16(data, span, n, 16);
+        reference_->CommitWrite(n);
+        data += n;
+        samples -= n;
+    }
+}
+
+const int16_t* NoAudioCodec::PullReference(size_t frames) {
+    // Capture was paused while playing, skip the audio nobody recorded
+    size_t available = reference_->Available();
+    if (available > 2 * dma_buffer_samples()) {
+        reference_->CommitRead(available - dma_buffer_samples());
+    }
+    // Once the written audio runs out the TX DMA plays silence
+    size_t read = reference_->Read(reference_frame_, std::min(frames, reference_->Available()));
+    memset(reference_frame_ + read, 0, (frames - read) * sizeof(int16_t));
+    return reference_frame_;
+}
+
+int32_t* NoAudioCodec::GetScratchBuffer(int32_t*& buffer, size_t& capacity, size_t samples) {
+    if (buffer != nullptr && capacity >= samples) {
+        return buffer;
+    }
+    samples = std::max(samples, dma_buffer_samples());
+    auto new_buffer = (int32_t*)heap_caps_realloc(buffer, samples * sizeof(int32_t), MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (new_buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu scratch samples", samples);
+        return buffer;
+    }
+    buffer = new_buffer;
+    capacity = samples;
+    scratch_allocations_++;
+    ESP_LOGI(TAG, "Scratch buffer resized to %zu samples", samples);
+    return buffer;
 }
 
 NoAudioCodecDuplex::NoAudioCodecDuplex(int input_sample_rate, int output_sample_rate, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
@@ -23,8 +103,8 @@ NoAudioCodecDuplex::NoAudioCodecDuplex(int input_sample_rate, int output_sample_
     i2s_chan_config_t chan_cfg = {
         .id = I2S_NUM_0,
         .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
+        .dma_desc_num = (uint32_t)dma_desc_num_,
+        .dma_frame_num = (uint32_t)dma_frame_num_,
         .auto_clear_after_cb = true,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
@@ -82,8 +162,8 @@ ATK_NoAudioCodecDuplex::ATK_NoAudioCodecDuplex(int input_sample_rate, int output
     i2s_chan_config_t chan_cfg = {
         .id = I2S_NUM_0,
         .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
+        .dma_desc_num = (uint32_t)dma_desc_num_,
+        .dma_frame_num = (uint32_t)dma_frame_num_,
         .auto_clear_after_cb = true,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
@@ -141,8 +221,8 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
     i2s_chan_config_t chan_cfg = {
         .id = (i2s_port_t)0,
         .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
+        .dma_desc_num = (uint32_t)dma_desc_num_,
+        .dma_frame_num = (uint32_t)dma_frame_num_,
         .auto_clear_after_cb = true,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
@@ -210,8 +290,8 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
     i2s_chan_config_t chan_cfg = {
         .id = (i2s_port_t)0,
         .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
+        .dma_desc_num = (uint32_t)dma_desc_num_,
+        .dma_frame_num = (uint32_t)dma_frame_num_,
         .auto_clear_after_cb = true,
         .auto_clear_before_cb = false,
         .intr_priority = 0,
@@ -263,6 +343,12 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
     ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, nullptr, &rx_handle_));
     std_cfg.clk_cfg.sample_rate_hz = (uint32_t)input_sample_rate_;
     std_cfg.slot_cfg.slot_mask = mic_slot_mask;
+    if (mic_slot_mask == I2S_STD_SLOT_BOTH) {
+        // Two microphones sharing the bus, the DMA interleaves left and right
+        std_cfg.slot_cfg.slot_mode = I2S_SLOT_MODE_STEREO;
+        mic_channels_ = 2;
+        input_channels_ = mic_channels_;
+    }
     std_cfg.gpio_cfg.bclk = mic_sck;
     std_cfg.gpio_cfg.ws = mic_ws;
     std_cfg.gpio_cfg.dout = I2S_GPIO_UNUSED;
@@ -271,6 +357,93 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
     ESP_LOGI(TAG, "Simplex channels created");
 }
 
+#if SOC_I2S_SUPPORTS_TDM
+NoAudioCodecSimplexTdm::NoAudioCodecSimplexTdm(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck, gpio_num_t mic_ws, gpio_num_t mic_din, int mic_channels) {
+    duplex_ = false;
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    mic_channels_ = mic_channels;
+    input_channels_ = mic_channels_;
+    // Every DMA buffer carries all slots, keep it within 4092 bytes
+    dma_frame_num_ = std::min(dma_frame_num_, 4092 / (int)sizeof(int32_t) / mic_channels_);
+
+    // Create a new channel for speaker
+    i2s_chan_config_t chan_cfg = {
+        .id = (i2s_port_t)0,
+        .role = I2S_ROLE_MASTER,
+        .dma_desc_num = (uint32_t)dma_desc_num_,
+        .dma_frame_num = (uint32_t)dma_frame_num_,
+        .auto_clear_after_cb = true,
+        .auto_clear_before_cb = false,
+        .intr_priority = 0,
+    };
+    ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx_handle_, nullptr));
+
+    i2s_std_config_t std_cfg = {
+        .clk_cfg = {
+            .sample_rate_hz = (uint32_t)output_sample_rate_,
+            .clk_src = I2S_CLK_SRC_DEFAULT,
+            .mclk_multiple = I2S_MCLK_MULTIPLE_256,
+			#ifdef   I2S_HW_VERSION_2
+				.ext_clk_freq_hz = 0,
+			#endif
+
+        },
+        .slot_cfg = {
+            .data_bit_width = I2S_DATA_BIT_WIDTH_32BIT,
+            .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
+            .slot_mode = I2S_SLOT_MODE_MONO,
+            .slot_mask = I2S_STD_SLOT_LEFT,
+            .ws_width = I2S_DATA_BIT_WIDTH_32BIT,
+            .ws_pol = false,
+            .bit_shift = true,
+            #ifdef   I2S_HW_VERSION_2
+                .left_align = true,
+                .big_endian = false,
+                .bit_order_lsb = false
+            #endif
+
+        },
+        .gpio_cfg = {
+            .mclk = I2S_GPIO_UNUSED,
+            .bclk = spk_bclk,
+            .ws = spk_ws,
+            .dout = spk_dout,
+            .din = I2S_GPIO_UNUSED,
+            .invert_flags = {
+                .mclk_inv = false,
+                .bclk_inv = false,
+                .ws_inv = false
+            }
+        }
+    };
+    ESP_ERROR_CHECK(i2s_channel_init_std_mode(tx_handle_, &std_cfg));
+
+    // Create a new channel for the microphone array, one TDM slot per microphone
+    chan_cfg.id = (i2s_port_t)1;
+    ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, nullptr, &rx_handle_));
+    i2s_tdm_config_t tdm_cfg = {
+        .clk_cfg = I2S_TDM_CLK_DEFAULT_CONFIG((uint32_t)input_sample_rate_),
+        .slot_cfg = I2S_TDM_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_32BIT, I2S_SLOT_MODE_STEREO,
+            (i2s_tdm_slot_mask_t)((1 << mic_channels_) - 1)),
+        .gpio_cfg = {
+            .mclk = I2S_GPIO_UNUSED,
+            .bclk = mic_sck,
+            .ws = mic_ws,
+            .dout = I2S_GPIO_UNUSED,
+            .din = mic_din,
+            .invert_flags = {
+                .mclk_inv = false,
+                .bclk_inv = false,
+                .ws_inv = false
+            }
+        }
+    };
+    ESP_ERROR_CHECK(i2s_channel_init_tdm_mode(rx_handle_, &tdm_cfg));
+    ESP_LOGI(TAG, "Simplex TDM channels created, %d microphones", mic_channels_);
+}
+#endif
+
 NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck, gpio_num_t mic_din) {
     duplex_ = false;
     input_sample_rate_ = input_sample_rate;
@@ -278,8 +451,8 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
 
     // Create a new channel for speaker
     i2s_chan_config_t tx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG((i2s_port_t)1, I2S_ROLE_MASTER);
-    tx_chan_cfg.dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM;
-    tx_chan_cfg.dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM;
+    tx_chan_cfg.dma_desc_num = dma_desc_num_;
+    tx_chan_cfg.dma_frame_num = dma_frame_num_;
     tx_chan_cfg.auto_clear_after_cb = true;
     tx_chan_cfg.auto_clear_before_cb = false;
     tx_chan_cfg.intr_priority = 0;
@@ -330,65 +503,92 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     };
     ESP_ERROR_CHECK(i2s_channel_init_pdm_rx_mode(rx_handle_, &pdm_rx_cfg));
 #else
+    (void)mic_sck;
+    (void)mic_din;
     ESP_LOGE(TAG, "PDM is not supported");
 #endif
     ESP_LOGI(TAG, "Simplex channels created");
 }
 
 int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
-
-    // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    int32_t* buffer = GetScratchBuffer(tx_buffer_, tx_buffer_samples_, dma_buffer_samples());
+    if (buffer == nullptr) {
+        return 0;
     }
 
-    size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
-    return bytes_written / sizeof(int32_t);
+    // output_gain_: 0-65536, cached by SetOutputVolume
+    int written = 0;
+    while (written < samples) {
+        int chunk = std::min<int>(samples - written, tx_buffer_samples_);
+        AudioKernels::ApplyGain(data + written, buffer, chunk, output_gain_);
+        if (reference_ != nullptr) {
+            PushReference(buffer, chunk);
+        }
+
+        size_t bytes_written;
+        ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer, chunk * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+        written += bytes_written / sizeof(int32_t);
+    }
+    return written;
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
-    size_t bytes_read;
-
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
-        ESP_LOGE(TAG, "Read Failed!");
+    int32_t* buffer = GetScratchBuffer(rx_buffer_, rx_buffer_samples_, dma_buffer_samples());
+    if (buffer == nullptr) {
         return 0;
     }
 
-    samples = bytes_read / sizeof(int32_t);
-    for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    // samples counts all input channels, the DMA only delivers the microphone slots
+    int frames = samples / input_channels_;
+    int total = 0;
+    while (total < frames) {
+        int chunk = std::min<int>(frames - total, rx_buffer_samples_ / mic_channels_);
+        size_t bytes_read;
+        if (i2s_channel_read(rx_handle_, buffer, chunk * mic_channels_ * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+            ESP_LOGE(TAG, "Read Failed!");
+            break;
+        }
+
+        chunk = bytes_read / sizeof(int32_t) / mic_channels_;
+        const int16_t* reference = input_reference_ ? PullReference(chunk) : nullptr;
+#if CONFIG_USE_AUDIO_AGC
+        // The AEC needs a fixed gain between the microphone and the reference, see input_agc()
+        if (reference == nullptr) {
+            agc_.Process(buffer, mic_channels_, nullptr, dest + total * input_channels_, chunk, 12);
+        } else {
+            AudioKernels::InterleaveToInt16(buffer, mic_channels_, reference, dest + total * input_channels_, chunk, 12);
+        }
+#else
+        AudioKernels::InterleaveToInt16(buffer, mic_channels_, reference, dest + total * input_channels_, chunk, 12);
+#endif
+        total += chunk;
     }
-    return samples;
+    return total * input_channels_;
 }
 
 int NoAudioCodecSimplexPdm::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    // PDM 解调后的数据位宽为 16 位
-    std::vector<int16_t> bit16_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit16_buffer.data(), samples * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    // PDM 解调后的数据位宽为 16 位，直接读入目标缓冲区
+    if (i2s_channel_read(rx_handle_, dest, samples / input_channels_ * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     // 计算实际读取的样本数
-    samples = bytes_read / sizeof(int16_t);
-
-    // 将 16 位数据直接复制到目标缓冲区
-    memcpy(dest, bit16_buffer.data(), samples * sizeof(int16_t));
+    int frames = bytes_read / sizeof(int16_t);
+    if (!input_reference_) {
+#if CONFIG_USE_AUDIO_AGC
+        agc_.Process(dest, 1, false, frames);
+#endif
+        return frames;
+    }
 
-    return samples;
+    // Interleave the reference in place, back to front so nothing is overwritten before it is moved
+    const int16_t* reference = PullReference(frames);
+    for (int i = frames - 1; i >= 0; i--) {
+        dest[2 * i + 1] = reference[i];
+        dest[2 * i] = dest[i];
+    }
+    return frames * 2;
 }
@@ -5,14 +5,55 @@
 
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
+#include <driver/i2s_tdm.h>
+
+#include <atomic>
 
 class NoAudioCodec : public AudioCodec {
 private:
+    // DMA-capable 32-bit scratch buffers, allocated on first use and kept for the codec lifetime
+    int32_t* rx_buffer_ = nullptr;
+    int32_t* tx_buffer_ = nullptr;
+    size_t rx_buffer_samples_ = 0;
+    size_t tx_buffer_samples_ = 0;
+    std::atomic<uint32_t> scratch_allocations_{0};
+
+    // Loopback of the played samples, written by Write() and consumed by Read()
+    SpscRingBuffer<int16_t>* reference_ = nullptr;
+    int16_t* reference_frame_ = nullptr;
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
 
+    void PushReference(const int32_t* data, size_t samples);
+
+protected:
+    // Microphone slots captured per frame, the reference channel comes on top
+    int mic_channels_ = 1;
+#if CONFIG_USE_AUDIO_AGC
+    // Replaces the fixed 12-bit shift of the 32-bit slots and scales the 16-bit PDM samples,
+    // only while there is no reference channel
+    AudioAgc agc_;
+#endif
+
+    int32_t* GetScratchBuffer(int32_t*& buffer, size_t& capacity, size_t samples);
+    // Fill `frames` reference samples aligned with the microphone frames being read
+    const int16_t* PullReference(size_t frames);
+
 public:
     virtual ~NoAudioCodec();
+
+    // Append the played audio as an extra input channel for AEC. Must be called before Start(),
+    // and only works when input and output share the sample rate.
+    bool EnableInputReference();
+
+    // Number of scratch buffer (re)allocations, stays constant in steady state
+    inline uint32_t scratch_allocations() const { return scratch_allocations_; }
+#if CONFIG_USE_AUDIO_AGC
+    // Off with a reference channel: a varying gain on the microphone alone would look like a
+    // changing echo path to the AEC, so the fixed shift is used instead
+    virtual const AudioAgc* input_agc() const override { return input_reference_ ? nullptr : &agc_; }
+#endif
 };
 
 class NoAudioCodecDuplex : public NoAudioCodec {
@@ -31,6 +72,14 @@ public:
     NoAudioCodecSimplex(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, i2s_std_slot_mask_t spk_slot_mask, gpio_num_t mic_sck, gpio_num_t mic_ws, gpio_num_t mic_din, i2s_std_slot_mask_t mic_slot_mask);
 };
 
+#if SOC_I2S_SUPPORTS_TDM
+// Microphone array on a TDM bus, slots 0 to mic_channels - 1 are captured
+class NoAudioCodecSimplexTdm : public NoAudioCodec {
+public:
+    NoAudioCodecSimplexTdm(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck, gpio_num_t mic_ws, gpio_num_t mic_din, int mic_channels);
+};
+#endif
+
 class NoAudioCodecSimplexPdm : public NoAudioCodec {
 public:
     NoAudioCodecSimplexPdm(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck,  gpio_num_t mic_din);
@@ -0,0 +1,143 @@
+#include "resampler.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+
+#define TAG "Resampler"
+
+// Taps per phase for pass-through or interpolation, multiplied by the decimation factor when downsampling
+#define RESAMPLER_BASE_TAPS 16
+#define RESAMPLER_MAX_TAPS 64
+// Ratios with more phases than this (e.g. 22.05k -> 16k) truncate the phase to the table row below
+#define RESAMPLER_MAX_PHASES 256
+
+static inline int64_t FloorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && a < 0) ? q - 1 : q;
+}
+
+void Resampler::Configure(int input_sample_rate, int output_sample_rate, int channels) {
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    channels_ = channels;
+
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    interpolation_ = output_sample_rate / divisor;
+    decimation_ = input_sample_rate / divisor;
+    num_phases_ = std::min(interpolation_, RESAMPLER_MAX_PHASES);
+    int factor = (decimation_ + interpolation_ - 1) / interpolation_;
+    taps_ = std::min(RESAMPLER_BASE_TAPS * std::max(factor, 1), RESAMPLER_MAX_TAPS);
+
+    // Windowed sinc low-pass at 90% of the lower Nyquist frequency, in cycles per input sample
+    double cutoff = 0.45 * std::min(1.0, double(interpolation_) / decimation_);
+    double delay = (taps_ - 1) / 2.0;
+    coefficients_.assign(num_phases_ * taps_, 0);
+    std::vector<double> phase(taps_);
+    for (int p = 0; p < num_phases_; p++) {
+        double fraction = double(p) / num_phases_;
+        double sum = 0;
+        for (int k = 0; k < taps_; k++) {
+            double x = fraction + k - delay;
+            double sinc = (x == 0) ? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            // Blackman window over [-taps/2, taps/2]
+            double w = 0.42 + 0.5 * cos(2 * M_PI * x / taps_) + 0.08 * cos(4 * M_PI * x / taps_);
+            phase[k] = (std::abs(x) < taps_ / 2.0) ? sinc * w : 0;
+            sum += phase[k];
+        }
+
+        // Normalize every phase to unity DC gain and push the rounding error into the center tap
+        int16_t* row = &coefficients_[p * taps_];
+        int32_t total = 0;
+        int center = 0;
+        for (int k = 0; k < taps_; k++) {
+            int32_t value = lround(phase[k] / sum * 32768.0);
+            value = std::clamp(value, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+            row[taps_ - 1 - k] = value;
+            total += value;
+            if (std::abs(phase[k]) > std::abs(phase[center])) {
+                center = k;
+            }
+        }
+        int32_t corrected = row[taps_ - 1 - center] + 32768 - total;
+        row[taps_ - 1 - center] = std::clamp(corrected, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+    }
+
+    history_.assign(taps_ * channels_, 0);
+    position_ = 0;
+    ESP_LOGI(TAG, "Resample %d -> %d Hz, channels: %d, ratio: %d/%d, phases: %d, taps: %d",
+        input_sample_rate, output_sample_rate, channels, interpolation_, decimation_, num_phases_, taps_);
+}
+
+void Resampler::Reset() {
+    std::fill(history_.begin(), history_.end(), 0);
+    position_ = 0;
+}
+
+int Resampler::GetInputFrames(int output_frames) const {
+    if (output_frames <= 0) {
+        return 0;
+    }
+    int64_t last = position_ + int64_t(output_frames - 1) * decimation_;
+    return std::max<int64_t>(FloorDiv(last, interpolation_) + 1, 0);
+}
+
+int Resampler::GetOutputFrames(int input_frames) const {
+    int64_t end = int64_t(input_frames) * interpolation_;
+    if (end <= position_) {
+        return 0;
+    }
+    return (end - position_ + decimation_ - 1) / decimation_;
+}
+
+// `input_frames` must not exceed GetInputFrames(max_output_frames), otherwise the
+// frames that did not fit into `output` are dropped
+int Resampler::Process(const int16_t* input, int input_frames, int16_t* output, int max_output_frames) {
+    const int channels = channels_;
+    const int taps = taps_;
+    const int64_t end = int64_t(input_frames) * interpolation_;
+    int64_t t = position_;
+    int produced = 0;
+
+    while (t < end && produced < max_output_frames) {
+        int64_t base = FloorDiv(t, interpolation_);
+        const int16_t* row = Phase(t - base * interpolation_);
+        int64_t start = base - taps + 1;
+        for (int c = 0; c < channels; c++) {
+            int32_t acc = 1 << 14;
+            if (start >= 0) {
+                const int16_t* x = input + start * channels + c;
+                for (int k = 0; k < taps; k++) {
+                    acc += int32_t(row[k]) * x[k * channels];
+                }
+            } else {
+                // The window reaches back into the previous block
+                for (int k = 0; k < taps; k++) {
+                    int64_t s = start + k;
+                    int16_t x = (s < 0) ? history_[(taps + s) * channels + c] : input[s * channels + c];
+                    acc += int32_t(row[k]) * x;
+                }
+            }
+            acc >>= 15;
+            output[produced * channels + c] = std::clamp(acc, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+        }
+        produced++;
+        t += decimation_;
+    }
+    if (produced == max_output_frames && t < end) {
+        // Skip whatever could not be written, keeping the window inside the history
+        t = std::max(t, end - interpolation_);
+    }
+    position_ = t - end;
+
+    // Keep the last taps frames for the next block
+    if (input_frames >= taps) {
+        memcpy(history_.data(), input + (input_frames - taps) * channels, taps * channels * sizeof(int16_t));
+    } else if (input_frames > 0) {
+        memmove(history_.data(), history_.data() + input_frames * channels, (taps - input_frames) * channels * sizeof(int16_t));
+        memcpy(history_.data() + (taps - input_frames) * channels, input, input_frames * channels * sizeof(int16_t));
+    }
+    return produced;
+}
@@ -0,0 +1,52 @@
+#ifndef _RESAMPLER_H
+#define _RESAMPLER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Streaming fixed-point polyphase resampler for interleaved int16 PCM.
+// All buffers are allocated in Configure(), Process() never touches the heap.
+class Resampler {
+public:
+    Resampler() = default;
+    ~Resampler() = default;
+
+    void Configure(int input_sample_rate, int output_sample_rate, int channels = 1);
+    void Reset();
+
+    // Number of input frames needed to produce exactly `output_frames` frames
+    int GetInputFrames(int output_frames) const;
+    // Number of output frames that `input_frames` input frames will produce
+    int GetOutputFrames(int input_frames) const;
+    // Returns the number of frames written to `output`, at most `max_output_frames`
+    int Process(const int16_t* input, int input_frames, int16_t* output, int max_output_frames);
+
+    inline bool configured() const { return interpolation_ != 0; }
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+    inline int channels() const { return channels_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int channels_ = 1;
+    // Reduced ratio output/input == interpolation_/decimation_
+    int interpolation_ = 0;
+    int decimation_ = 0;
+    int num_phases_ = 0;
+    int taps_ = 0;
+    // Position of the next output frame relative to the next input block, in 1/interpolation_ input frames
+    int64_t position_ = 0;
+    // Q15 coefficients, num_phases_ rows of taps_ entries, stored in reverse tap order
+    std::vector<int16_t> coefficients_;
+    // Last taps_ input frames of the previous block, interleaved
+    std::vector<int16_t> history_;
+
+    // Exact when num_phases_ == interpolation_, otherwise the row at or below the fraction
+    inline const int16_t* Phase(int64_t fraction) const {
+        return &coefficients_[(fraction * num_phases_ / interpolation_) * taps_];
+    }
+};
+
+#endif // _RESAMPLER_H
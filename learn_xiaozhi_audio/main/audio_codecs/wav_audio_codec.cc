@@ -0,0 +1,176 @@
+#include "wav_audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cinttypes>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "WavAudioCodec"
+
+#define WAV_HEADER_SIZE 44
+// Writes between two updates of the output header, about one second of 20 ms frames
+#define WAV_HEADER_INTERVAL 50
+
+WavAudioCodec::WavAudioCodec(const char* input_path, const char* output_path) {
+    duplex_ = true;
+    input_file_ = fopen(input_path, "rb");
+    if (input_file_ == nullptr || !ReadHeader()) {
+        ESP_LOGE(TAG, "Failed to open %s as a 16-bit PCM WAV file", input_path);
+        if (input_file_ != nullptr) {
+            fclose(input_file_);
+            input_file_ = nullptr;
+        }
+        input_sample_rate_ = 16000;
+    }
+    output_sample_rate_ = input_sample_rate_;
+    output_channels_ = 1;
+    output_file_ = fopen(output_path, "wb");
+    if (output_file_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create %s", output_path);
+    } else {
+        WriteHeader();
+    }
+    // Nothing to process, let the application leave the listening state
+    finished_ = failed();
+    ESP_LOGI(TAG, "Input %s: %d Hz, %d channels, %zu samples", input_path,
+        input_sample_rate_, input_channels_, input_samples_);
+}
+
+WavAudioCodec::~WavAudioCodec() {
+    if (output_file_ != nullptr) {
+        WriteHeader();
+        fclose(output_file_);
+    }
+    if (input_file_ != nullptr) {
+        fclose(input_file_);
+    }
+}
+
+// Walks the chunks up to "data", only PCM 16-bit is accepted
+bool WavAudioCodec::ReadHeader() {
+    char riff[12];
+    if (fread(riff, 1, sizeof(riff), input_file_) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    bool has_format = false;
+    while (true) {
+        char id[4];
+        uint32_t size;
+        if (fread(id, 1, 4, input_file_) != 4 || fread(&size, 4, 1, input_file_) != 1) {
+            return false;
+        }
+        if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+            uint16_t format, channels, bits;
+            uint32_t sample_rate, byte_rate;
+            uint16_t block_align;
+            fread(&format, 2, 1, input_file_);
+            fread(&channels, 2, 1, input_file_);
+            fread(&sample_rate, 4, 1, input_file_);
+            fread(&byte_rate, 4, 1, input_file_);
+            fread(&block_align, 2, 1, input_file_);
+            fread(&bits, 2, 1, input_file_);
+            if (format != 1 || bits != 16 || channels == 0) {
+                return false;
+            }
+            input_channels_ = channels;
+            input_sample_rate_ = sample_rate;
+            has_format = true;
+            fseek(input_file_, size - 16 + (size & 1), SEEK_CUR);
+        } else if (memcmp(id, "data", 4) == 0) {
+            input_samples_ = size / sizeof(int16_t);
+            return has_format;
+        } else {
+            fseek(input_file_, size + (size & 1), SEEK_CUR);
+        }
+    }
+}
+
+void WavAudioCodec::WriteHeader() {
+    uint32_t data_size = samples_written_ * sizeof(int16_t);
+    uint32_t riff_size = data_size + WAV_HEADER_SIZE - 8;
+    uint32_t fmt_size = 16;
+    uint16_t format = 1;
+    uint16_t channels = output_channels_;
+    uint32_t sample_rate = output_sample_rate_;
+    uint32_t byte_rate = sample_rate * channels * sizeof(int16_t);
+    uint16_t block_align = channels * sizeof(int16_t);
+    uint16_t bits = 16;
+
+    fseek(output_file_, 0, SEEK_SET);
+    fwrite("RIFF", 1, 4, output_file_);
+    fwrite(&riff_size, 4, 1, output_file_);
+    fwrite("WAVEfmt ", 1, 8, output_file_);
+    fwrite(&fmt_size, 4, 1, output_file_);
+    fwrite(&format, 2, 1, output_file_);
+    fwrite(&channels, 2, 1, output_file_);
+    fwrite(&sample_rate, 4, 1, output_file_);
+    fwrite(&byte_rate, 4, 1, output_file_);
+    fwrite(&block_align, 2, 1, output_file_);
+    fwrite(&bits, 2, 1, output_file_);
+    fwrite("data", 1, 4, output_file_);
+    fwrite(&data_size, 4, 1, output_file_);
+    fseek(output_file_, 0, SEEK_END);
+}
+
+// Reads one frame, sleeping so the file plays at CONFIG_WAV_AUDIO_SPEED percent of real time
+int WavAudioCodec::Read(int16_t* dest, int samples) {
+    if (input_file_ == nullptr || finished_) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        return 0;
+    }
+    if (start_time_ == 0) {
+        start_time_ = esp_timer_get_time();
+        start_free_heap_ = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    }
+    int64_t due = start_time_ + (int64_t)(samples_read_ / input_channels_) * 1000000 * 100 /
+        ((int64_t)input_sample_rate_ * CONFIG_WAV_AUDIO_SPEED);
+    int64_t wait = due - esp_timer_get_time();
+    if (wait >= 1000) {
+        vTaskDelay(std::max<TickType_t>(pdMS_TO_TICKS(wait / 1000), 1));
+    }
+
+    // Chunks after "data" (LIST, id3, ...) are not audio
+    size_t wanted = std::min<size_t>(samples, input_samples_ - samples_read_);
+    size_t n = fread(dest, sizeof(int16_t), wanted, input_file_);
+    samples_read_ += n;
+    if (n < (size_t)samples) {
+        finish_time_ = esp_timer_get_time();
+        finished_ = true;
+        ESP_LOGI(TAG, "End of input after %zu samples", samples_read_);
+    }
+    return n - n % input_channels_;
+}
+
+int WavAudioCodec::Write(const int16_t* data, int samples) {
+    if (output_file_ == nullptr) {
+        return 0;
+    }
+    size_t n = fwrite(data, sizeof(int16_t), samples, output_file_);
+    samples_written_ += n;
+    // Keep the sizes close, the run can end at any time
+    if (++writes_ % WAV_HEADER_INTERVAL == 0) {
+        WriteHeader();
+    }
+    return n;
+}
+
+void WavAudioCodec::Report() {
+    if (failed()) {
+        ESP_LOGE(TAG, "Nothing was processed, the input or output file could not be opened");
+        return;
+    }
+    if (finish_time_ > start_time_) {
+        int64_t audio_us = (int64_t)(samples_read_ / input_channels_) * 1000000 / input_sample_rate_;
+        int64_t wall_us = finish_time_ - start_time_;
+        // Below 1 the pipeline is faster than real time, drops in the input stats mean it was not
+        ESP_LOGI(TAG, "Processed %" PRId64 " ms of audio in %" PRId64 " ms, real-time factor %.3f",
+            audio_us / 1000, wall_us / 1000, (double)wall_us / audio_us);
+        ESP_LOGI(TAG, "Heap used during the run: %d bytes, %zu samples written",
+            (int)(start_free_heap_ - heap_caps_get_free_size(MALLOC_CAP_8BIT)), samples_written_);
+        auto input = input_stats();
+        ESP_LOGI(TAG, "Input frames: %" PRIu32 " dropped: %" PRIu32, input.frames, input.dropped);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _WAV_AUDIO_CODEC_H
+#define _WAV_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <cstdio>
+#include <atomic>
+
+// File-backed codec for offline runs: captures from a 16-bit PCM WAV file and plays back
+// into another one. Input is paced at CONFIG_WAV_AUDIO_SPEED percent of real time, frames
+// the pipeline cannot take show up as dropped or late in the input stats.
+class WavAudioCodec : public AudioCodec {
+public:
+    WavAudioCodec(const char* input_path, const char* output_path);
+    virtual ~WavAudioCodec();
+
+    // The whole input file was read, or it could not be opened
+    inline bool finished() const { return finished_; }
+    // One of the files could not be opened, the run is pointless
+    inline bool failed() const { return input_file_ == nullptr || output_file_ == nullptr; }
+    // Logs the real-time factor and heap use of the input run
+    void Report();
+
+private:
+    FILE* input_file_ = nullptr;
+    FILE* output_file_ = nullptr;
+    size_t input_samples_ = 0;
+    size_t samples_read_ = 0;
+    size_t samples_written_ = 0;
+    uint32_t writes_ = 0;
+    std::atomic<bool> finished_{false};
+    int64_t start_time_ = 0;
+    int64_t finish_time_ = 0;
+    size_t start_free_heap_ = 0;
+
+    virtual int Read(int16_t* dest, int samples) override;
+    virtual int Write(const int16_t* data, int samples) override;
+
+    bool ReadHeader();
+    void WriteHeader();
+};
+
+#endif // _WAV_AUDIO_CODEC_H
@@ -0,0 +1,173 @@
+#ifndef AUDIO_FRAME_H
+#define AUDIO_FRAME_H
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+class AudioFramePool;
+
+// Move-only handle to a pooled PCM buffer. The buffer goes back to its pool when the
+// last handle is destroyed, so a captured frame can be handed from stage to stage without copies.
+// Share() adds a handle for another consumer; shared buffers are read-only.
+class AudioFrame {
+public:
+    AudioFrame() = default;
+    ~AudioFrame() { Release(); }
+
+    AudioFrame(const AudioFrame&) = delete;
+    AudioFrame& operator=(const AudioFrame&) = delete;
+
+    AudioFrame(AudioFrame&& other) noexcept { *this = std::move(other); }
+    AudioFrame& operator=(AudioFrame&& other) noexcept {
+        if (this != &other) {
+            Release();
+            pool_ = std::exchange(other.pool_, nullptr);
+            index_ = std::exchange(other.index_, -1);
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            capacity_ = std::exchange(other.capacity_, 0);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return data_ != nullptr; }
+    inline int16_t* data() { return data_; }
+    inline const int16_t* data() const { return data_; }
+    inline size_t size() const { return size_; }
+    inline size_t capacity() const { return capacity_; }
+    inline bool empty() const { return size_ == 0; }
+    // Only shrinks or grows within the pooled buffer
+    inline void resize(size_t samples) { size_ = samples < capacity_ ? samples : capacity_; }
+
+    inline AudioFrame Share() const;
+    inline void Release();
+
+private:
+    friend class AudioFramePool;
+
+    AudioFramePool* pool_ = nullptr;
+    int index_ = -1;
+    int16_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+// Fixed set of equally sized PCM buffers, allocated once in PSRAM when available.
+// Acquire() and release are lock-free, a bit per buffer marks it free.
+// Created with new and given up with Retire(), never deleted: frames a consumer still
+// holds keep the pool alive, and the last one released frees it.
+class AudioFramePool {
+public:
+    static constexpr int kMaxFrames = 32;
+
+    AudioFramePool(int count, size_t frame_samples) : frame_samples_(frame_samples) {
+        count_ = count < kMaxFrames ? count : kMaxFrames;
+        buffer_ = (int16_t*)heap_caps_malloc(count_ * frame_samples_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+        if (buffer_ == nullptr) {
+            buffer_ = (int16_t*)heap_caps_malloc(count_ * frame_samples_ * sizeof(int16_t), MALLOC_CAP_8BIT);
+        }
+        if (buffer_ == nullptr) {
+            ESP_LOGE("AudioFramePool", "Failed to allocate %d frames of %zu samples", count_, frame_samples_);
+            count_ = 0;
+        }
+        free_mask_ = count_ == kMaxFrames ? UINT32_MAX : (1u << count_) - 1;
+    }
+
+    AudioFramePool(const AudioFramePool&) = delete;
+    AudioFramePool& operator=(const AudioFramePool&) = delete;
+
+    inline size_t frame_samples() const { return frame_samples_; }
+    // Buffers held by at least one handle, nonzero when idle means a leak
+    inline int in_use() const { return count_ - __builtin_popcount(free_mask_.load(std::memory_order_relaxed)); }
+    // Number of Acquire() calls that found no free buffer or asked for too much
+    inline uint32_t exhausted() const { return exhausted_.load(std::memory_order_relaxed); }
+
+    // The owner lets go of the pool, it is freed now or when the last frame is released
+    void Retire() {
+        ReleaseHolder();
+    }
+
+    // Returns an empty handle when all buffers are in use
+    AudioFrame Acquire(size_t samples) {
+        AudioFrame frame;
+        uint32_t mask = free_mask_.load(std::memory_order_acquire);
+        while (mask != 0 && samples <= frame_samples_) {
+            int index = __builtin_ctz(mask);
+            if (free_mask_.compare_exchange_weak(mask, mask & ~(1u << index), std::memory_order_acquire)) {
+                holders_.fetch_add(1, std::memory_order_relaxed);
+                refs_[index].store(1, std::memory_order_relaxed);
+                frame.pool_ = this;
+                frame.index_ = index;
+                frame.data_ = buffer_ + index * frame_samples_;
+                frame.size_ = samples;
+                frame.capacity_ = frame_samples_;
+                return frame;
+            }
+        }
+        exhausted_.fetch_add(1, std::memory_order_relaxed);
+        return frame;
+    }
+
+private:
+    friend class AudioFrame;
+
+    int16_t* buffer_ = nullptr;
+    size_t frame_samples_ = 0;
+    int count_ = 0;
+    std::atomic<uint32_t> free_mask_{0};
+    std::atomic<uint32_t> exhausted_{0};
+    std::atomic<uint8_t> refs_[kMaxFrames] = {};
+    // The owner until Retire(), and every buffer in use
+    std::atomic<int> holders_{1};
+
+    ~AudioFramePool() {
+        heap_caps_free(buffer_);
+    }
+
+    void ReleaseHolder() {
+        if (holders_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    void AddRef(int index) {
+        refs_[index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release(int index) {
+        if (refs_[index].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            free_mask_.fetch_or(1u << index, std::memory_order_release);
+            ReleaseHolder();
+        }
+    }
+};
+
+inline AudioFrame AudioFrame::Share() const {
+    AudioFrame frame;
+    if (pool_ != nullptr) {
+        pool_->AddRef(index_);
+        frame.pool_ = pool_;
+        frame.index_ = index_;
+        frame.data_ = data_;
+        frame.size_ = size_;
+        frame.capacity_ = capacity_;
+    }
+    return frame;
+}
+
+inline void AudioFrame::Release() {
+    if (pool_ != nullptr) {
+        pool_->Release(index_);
+        pool_ = nullptr;
+        index_ = -1;
+        data_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+    }
+}
+
+#endif // AUDIO_FRAME_H
@@ -1,139 +1,102 @@
 #include "afe_audio_processor.h"
 #include <esp_log.h>
+#include <cinttypes>
+#include <cstring>
 
-#define PROCESSOR_RUNNING 0x01
+// Enough for a consumer to hold a few frames, about 256ms of output
+#define OUTPUT_FRAME_COUNT 8
+// Log the output pool every 10s of 32ms frames
+#define OUTPUT_STATS_FRAMES 312
 
 static const char* TAG = "AfeAudioProcessor";
 
-AfeAudioProcessor::AfeAudioProcessor()
-    : afe_data_(nullptr) {
-    event_group_ = xEventGroupCreate();
+AfeAudioProcessor::AfeAudioProcessor(AudioFrontEnd* front_end)
+    : front_end_(front_end) {
 }
 
+// NS, AEC and the fetch task belong to the front end, which the wake word detector shares
 void AfeAudioProcessor::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
-
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
-    }
-
-    srmodel_list_t *models = esp_srmodel_init("model");
-    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
-
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
-#ifdef CONFIG_USE_DEVICE_AEC
-    afe_config->aec_init = true;
-    afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
-#else
-    afe_config->aec_init = false;
-#endif
-    afe_config->ns_init = true;
-    afe_config->ns_model_name = ns_model_name;
-    afe_config->afe_ns_mode = AFE_NS_MODE_NET;
-#ifdef CONFIG_USE_DEVICE_AEC
-    afe_config->vad_init = false;
-#else
-    afe_config->vad_init = true;
-    afe_config->vad_mode = VAD_MODE_0;
-    afe_config->vad_min_noise_ms = 100;
-#endif
-    afe_config->afe_perferred_core = 1;
-    afe_config->afe_perferred_priority = 1;
-    afe_config->agc_init = false;
-    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
-    
-    xTaskCreate([](void* arg) {
-        auto this_ = (AfeAudioProcessor*)arg;
-        this_->AudioProcessorTask();
-        vTaskDelete(NULL);
-    }, "audio_communication", 4096, this, 3, NULL);
+    output_frames_ = new AudioFramePool(OUTPUT_FRAME_COUNT, front_end_->GetFetchSize());
+    front_end_->OnResult(AUDIO_FRONT_END_COMMUNICATION, [this](afe_fetch_result_t* res) {
+        OnFrontEndResult(res);
+    });
+    ESP_LOGI(TAG, "Audio communication on the shared front end, feed size: %d", GetFeedSize());
 }
 
 AfeAudioProcessor::~AfeAudioProcessor() {
-    if (afe_data_ != nullptr) {
-        afe_iface_->destroy(afe_data_);
+    front_end_->OnResult(AUDIO_FRONT_END_COMMUNICATION, nullptr);
+    // Frames still held by a consumer keep the pool alive
+    if (output_frames_ != nullptr) {
+        output_frames_->Retire();
     }
-    vEventGroupDelete(event_group_);
 }
 
 size_t AfeAudioProcessor::GetFeedSize() {
-    if (afe_data_ == nullptr) {
-        return 0;
-    }
-    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    return front_end_->GetFeedSize();
 }
 
-void AfeAudioProcessor::Feed(const std::vector<int16_t>& data) {
-    if (afe_data_ == nullptr) {
-        return;
-    }
-    afe_iface_->feed(afe_data_, data.data());
+void AfeAudioProcessor::Feed(const int16_t* data, size_t samples) {
+    stats_.input_chunks++;
+    stats_.input_bytes += samples * sizeof(int16_t);
+    front_end_->Feed(data, samples);
 }
 
 void AfeAudioProcessor::Start() {
-    xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
+    vad_.Reset();
+    front_end_->Start(AUDIO_FRONT_END_COMMUNICATION);
 }
 
 void AfeAudioProcessor::Stop() {
-    xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
-    }
+    front_end_->Stop(AUDIO_FRONT_END_COMMUNICATION);
 }
 
 bool AfeAudioProcessor::IsRunning() {
-    return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
+    return front_end_->IsRunning(AUDIO_FRONT_END_COMMUNICATION);
 }
 
 void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
     output_callback_ = callback;
 }
 
-void AfeAudioProcessor::OnVadStateChange(std::function<void(bool speaking)> callback) {
-    vad_state_change_callback_ = callback;
+void AfeAudioProcessor::OnOutputFrame(std::function<void(AudioFrame&& frame)> callback) {
+    output_frame_callback_ = callback;
 }
 
-void AfeAudioProcessor::AudioProcessorTask() {
-    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
-    ESP_LOGI(TAG, "Audio communication task started, feed size: %d fetch size: %d",
-        feed_size, fetch_size);
-
-    while (true) {
-        xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
+void AfeAudioProcessor::OnOutputView(std::function<void(const int16_t* data, size_t samples)> callback) {
+    output_view_callback_ = callback;
+}
 
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if ((xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING) == 0) {
-            continue;
-        }
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            if (res != nullptr) {
-                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
-            }
-            continue;
-        }
+void AfeAudioProcessor::OnVadStateChange(std::function<void(bool speaking, uint64_t sample)> callback) {
+    vad_.OnStateChange(callback);
+}
 
-        // VAD state change
-        if (vad_state_change_callback_) {
-            if (res->vad_state == VAD_SPEECH && !is_speaking_) {
-                is_speaking_ = true;
-                vad_state_change_callback_(true);
-            } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
-                is_speaking_ = false;
-                vad_state_change_callback_(false);
-            }
+void AfeAudioProcessor::OnFrontEndResult(afe_fetch_result_t* res) {
+    size_t samples = res->data_size / sizeof(int16_t);
+    vad_.Update(res->vad_state == VAD_SPEECH, samples);
+    stats_.output_frames++;
+    stats_.output_bytes += res->data_size;
+
+    if (output_view_callback_) {
+        // res->data stays valid until the next fetch, which waits for this callback
+        output_view_callback_(res->data, samples);
+    } else if (output_frame_callback_) {
+        AudioFrame frame = output_frames_->Acquire(samples);
+        if (frame) {
+            memcpy(frame.data(), res->data, samples * sizeof(int16_t));
+            stats_.copied_bytes += res->data_size;
+            output_frame_callback_(std::move(frame));
+        } else {
+            // The consumer holds every frame, drop this one rather than allocate
+            dropped_frames_++;
         }
+    } else if (output_callback_) {
+        stats_.copied_bytes += res->data_size;
+        output_callback_(std::vector<int16_t>(res->data, res->data + samples));
+    }
 
-        if (output_callback_) {
-            output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
-        }
+    if (stats_.output_frames % OUTPUT_STATS_FRAMES == 0) {
+        ESP_LOGI(TAG, "Output frames: %" PRIu32 " dropped: %" PRIu32 ", pool exhausted: %" PRIu32 " in use: %d",
+            stats_.output_frames, dropped_frames_, output_frames_->exhausted(), output_frames_->in_use());
     }
-} 
\ No newline at end of file
+}
@@ -1,42 +1,50 @@
 #ifndef AFE_AUDIO_PROCESSOR_H
 #define AFE_AUDIO_PROCESSOR_H
 
-#include <esp_afe_sr_models.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <freertos/event_groups.h>
-
 #include <string>
 #include <vector>
 #include <functional>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "audio_front_end.h"
 
+// The communication consumer of the shared audio front end
 class AfeAudioProcessor : public AudioProcessor {
 public:
-    AfeAudioProcessor();
+    explicit AfeAudioProcessor(AudioFrontEnd* front_end);
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec) override;
-    void Feed(const std::vector<int16_t>& data) override;
+    using AudioProcessor::Feed;
+    void Feed(const int16_t* data, size_t samples) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
     void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
-    void OnVadStateChange(std::function<void(bool speaking)> callback) override;
+    void OnOutputFrame(std::function<void(AudioFrame&& frame)> callback) override;
+    void OnOutputView(std::function<void(const int16_t* data, size_t samples)> callback) override;
+    void OnVadStateChange(std::function<void(bool speaking, uint64_t sample)> callback) override;
     size_t GetFeedSize() override;
+    AudioProcessorStats stats() override {
+        AudioProcessorStats stats = stats_;
+        stats.dropped_frames = dropped_frames_;
+        return stats;
+    }
 
 private:
-    EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AudioFrontEnd* front_end_ = nullptr;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
-    std::function<void(bool speaking)> vad_state_change_callback_;
+    std::function<void(AudioFrame&& frame)> output_frame_callback_;
+    std::function<void(const int16_t* data, size_t samples)> output_view_callback_;
+    AudioFramePool* output_frames_ = nullptr;
+    uint32_t dropped_frames_ = 0;
+    AudioProcessorStats stats_;
     AudioCodec* codec_ = nullptr;
-    bool is_speaking_ = false;
+    // Attack and hangover over the per-frame AFE VAD decision
+    VadDetector vad_;
 
-    void AudioProcessorTask();
+    void OnFrontEndResult(afe_fetch_result_t* res);
 };
 
-#endif 
\ No newline at end of file
+#endif 
@@ -0,0 +1,176 @@
+#include "audio_front_end.h"
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <string>
+
+// Two WakeNet models at most, the AFE has wakenet_model_name and wakenet_model_name_2
+#define AFE_MAX_WAKENET_MODELS 2
+
+static const char* TAG = "AudioFrontEnd";
+
+AudioFrontEnd::AudioFrontEnd() {
+    event_group_ = xEventGroupCreate();
+}
+
+AudioFrontEnd::~AudioFrontEnd() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void AudioFrontEnd::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+    int ref_num = codec_->input_reference() ? 1 : 0;
+
+    std::string input_format;
+    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+    models_ = esp_srmodel_init("model");
+    for (int i = 0; i < models_->num && wakenet_models_.size() < AFE_MAX_WAKENET_MODELS; i++) {
+        if (strstr(models_->model_name[i], ESP_WN_PREFIX) != NULL) {
+            wakenet_models_.push_back(models_->model_name[i]);
+        }
+    }
+    char* ns_model_name = esp_srmodel_filter(models_, ESP_NSNET_PREFIX, NULL);
+
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models_, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+    afe_config->wakenet_init = !wakenet_models_.empty();
+    afe_config->wakenet_model_name = wakenet_models_.size() > 0 ? wakenet_models_[0] : NULL;
+    afe_config->wakenet_model_name_2 = wakenet_models_.size() > 1 ? wakenet_models_[1] : NULL;
+    afe_config->aec_init = codec_->input_reference();
+    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+    afe_config->ns_init = ns_model_name != NULL;
+    afe_config->ns_model_name = ns_model_name;
+    afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+    afe_config->agc_init = false;
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    // What the shared instance costs. The saving over the AFE_TYPE_SR plus AFE_TYPE_VC pair it
+    // replaced has not been measured, in memory or CPU: compare with the log of an older build.
+    size_t psram_before = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t internal_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+    ESP_LOGI(TAG, "Shared AFE uses %zu bytes of PSRAM and %zu bytes of internal RAM, %zu WakeNet models",
+        psram_before - heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+        internal_before - heap_caps_get_free_size(MALLOC_CAP_INTERNAL), wakenet_models_.size());
+    UpdateStages();
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AudioFrontEnd*)arg;
+        this_->AudioFrontEndTask();
+        vTaskDelete(NULL);
+    }, "audio_front_end", 4096, this, 3, NULL);
+}
+
+size_t AudioFrontEnd::GetFeedSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+}
+
+size_t AudioFrontEnd::GetFetchSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_fetch_chunksize(afe_data_);
+}
+
+void AudioFrontEnd::Feed(const int16_t* data, size_t samples) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    afe_iface_->feed(afe_data_, data);
+}
+
+void AudioFrontEnd::OnResult(int consumer, std::function<void(afe_fetch_result_t* result)> callback) {
+    if (consumer == AUDIO_FRONT_END_WAKE_WORD) {
+        wake_word_callback_ = callback;
+    } else if (consumer == AUDIO_FRONT_END_COMMUNICATION) {
+        communication_callback_ = callback;
+    }
+}
+
+void AudioFrontEnd::Start(int consumer) {
+    xEventGroupSetBits(event_group_, consumer);
+    UpdateStages();
+}
+
+void AudioFrontEnd::Stop(int consumer) {
+    xEventGroupClearBits(event_group_, consumer);
+    UpdateStages();
+}
+
+bool AudioFrontEnd::IsRunning(int consumer) {
+    return xEventGroupGetBits(event_group_) & consumer;
+}
+
+void AudioFrontEnd::SetWakeNetThreshold(int model_index, float threshold) {
+    if (afe_data_ != nullptr) {
+        afe_iface_->set_wakenet_threshold(afe_data_, model_index, threshold);
+    }
+}
+
+// Only the stages a running consumer needs are enabled, AEC and NS serve both
+void AudioFrontEnd::UpdateStages() {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    auto bits = xEventGroupGetBits(event_group_);
+    if (!wakenet_models_.empty()) {
+        if (bits & AUDIO_FRONT_END_WAKE_WORD) {
+            afe_iface_->enable_wakenet(afe_data_);
+        } else {
+            afe_iface_->disable_wakenet(afe_data_);
+        }
+    }
+    if (bits & AUDIO_FRONT_END_COMMUNICATION) {
+        afe_iface_->enable_vad(afe_data_);
+    } else {
+        afe_iface_->disable_vad(afe_data_);
+    }
+    if ((bits & (AUDIO_FRONT_END_WAKE_WORD | AUDIO_FRONT_END_COMMUNICATION)) == 0) {
+        afe_iface_->reset_buffer(afe_data_);
+    }
+}
+
+void AudioFrontEnd::AudioFrontEndTask() {
+    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
+    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
+    ESP_LOGI(TAG, "Audio front end task started, feed size: %d fetch size: %d",
+        feed_size, fetch_size);
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, AUDIO_FRONT_END_WAKE_WORD | AUDIO_FRONT_END_COMMUNICATION,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        auto bits = xEventGroupGetBits(event_group_);
+        if ((bits & AUDIO_FRONT_END_WAKE_WORD) && wake_word_callback_) {
+            wake_word_callback_(res);
+        }
+        if ((bits & AUDIO_FRONT_END_COMMUNICATION) && communication_callback_) {
+            communication_callback_(res);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef AUDIO_FRONT_END_H
+#define AUDIO_FRONT_END_H
+
+#include <esp_afe_sr_models.h>
+#include <esp_nsn_models.h>
+#include <model_path.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <functional>
+#include <vector>
+
+#include "audio_codec.h"
+
+// Consumers of the front end output, as bits of the running mask
+#define AUDIO_FRONT_END_WAKE_WORD (1 << 0)
+#define AUDIO_FRONT_END_COMMUNICATION (1 << 1)
+
+// One AFE instance shared by the wake word detector and the audio processor.
+// Audio is fed once, AEC and NS run once, and every fetch result goes to the running
+// consumers. WakeNet only runs while the wake word consumer does, VAD while the
+// communication one does, so switching between them is a mode change, not a second AFE.
+class AudioFrontEnd {
+public:
+    AudioFrontEnd();
+    ~AudioFrontEnd();
+
+    void Initialize(AudioCodec* codec);
+    void Feed(const int16_t* data, size_t samples);
+    size_t GetFeedSize();
+    // Samples of one fetch result, 16kHz mono
+    size_t GetFetchSize();
+    // Called from the fetch task with every result while the consumer runs
+    void OnResult(int consumer, std::function<void(afe_fetch_result_t* result)> callback);
+    void Start(int consumer);
+    void Stop(int consumer);
+    bool IsRunning(int consumer = AUDIO_FRONT_END_WAKE_WORD | AUDIO_FRONT_END_COMMUNICATION);
+
+    // The WakeNet models in the AFE, in the order of wakenet_model_index
+    const std::vector<char*>& wakenet_models() const { return wakenet_models_; }
+    srmodel_list_t* models() const { return models_; }
+    void SetWakeNetThreshold(int model_index, float threshold);
+
+private:
+    EventGroupHandle_t event_group_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    srmodel_list_t* models_ = nullptr;
+    std::vector<char*> wakenet_models_;
+    std::function<void(afe_fetch_result_t* result)> wake_word_callback_;
+    std::function<void(afe_fetch_result_t* result)> communication_callback_;
+    AudioCodec* codec_ = nullptr;
+
+    void UpdateStages();
+    void AudioFrontEndTask();
+};
+
+#endif
@@ -6,19 +6,41 @@
 #include <functional>
 
 #include "audio_codec.h"
+#include "audio_frame.h"
+#include "vad_detector.h"
+
+// Throughput counters, the same for every processor so configurations can be compared
+struct AudioProcessorStats {
+    uint32_t input_chunks = 0;
+    uint32_t input_bytes = 0;
+    uint32_t output_frames = 0;
+    uint32_t output_bytes = 0;
+    // Bytes copied between input and consumer, 0 on a zero-copy path
+    uint32_t copied_bytes = 0;
+    // Output frames lost because the consumer held every pooled frame
+    uint32_t dropped_frames = 0;
+};
 
 class AudioProcessor {
 public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec) = 0;
-    virtual void Feed(const std::vector<int16_t>& data) = 0;
+    virtual void Feed(const int16_t* data, size_t samples) = 0;
+    void Feed(const std::vector<int16_t>& data) { Feed(data.data(), data.size()); }
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
+    // Set one output callback. The vector is allocated per frame; the frame comes from a
+    // fixed pool and goes back when its last handle is released; the view costs nothing but
+    // is only valid until the synchronous callback returns.
     virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
-    virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
+    virtual void OnOutputFrame(std::function<void(AudioFrame&& frame)> callback) = 0;
+    virtual void OnOutputView(std::function<void(const int16_t* data, size_t samples)> callback) = 0;
+    // sample is where the speech began or ended, in 16kHz samples since Start()
+    virtual void OnVadStateChange(std::function<void(bool speaking, uint64_t sample)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
+    virtual AudioProcessorStats stats() = 0;
 };
 
 #endif
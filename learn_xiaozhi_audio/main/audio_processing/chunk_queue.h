@@ -0,0 +1,91 @@
+#ifndef CHUNK_QUEUE_H
+#define CHUNK_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "ring_buffer.h"
+
+// Fixed-size chunks of one channel from a producer task to a consumer task, e.g. WakeNet
+// chunks from Feed() to the detection task. A push is queued completely or dropped completely,
+// so the consumer gets every queued sample exactly once and in order, cut into whole chunks.
+class ChunkQueue {
+public:
+    ChunkQueue(size_t chunk_size, size_t chunks)
+        : queue_(chunk_size * chunks), chunk_size_(chunk_size), scratch_(chunk_size) {
+    }
+
+    ChunkQueue(const ChunkQueue&) = delete;
+    ChunkQueue& operator=(const ChunkQueue&) = delete;
+
+    inline size_t chunk_size() const { return chunk_size_; }
+    // Pushes that were dropped because the consumer was behind
+    inline uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Producer: queues the first of `channels` interleaved channels, nothing when it does not all fit
+    bool Push(const int16_t* data, size_t samples, int channels) {
+        size_t frames = samples / channels;
+        if (queue_.Free() < frames) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        size_t written = 0;
+        while (written < frames) {
+            int16_t* span;
+            size_t n = std::min(queue_.GetWriteSpan(&span), frames - written);
+            for (size_t i = 0; i < n; i++) {
+                span[i] = data[(written + i) * channels];
+            }
+            queue_.CommitWrite(n);
+            written += n;
+        }
+        return true;
+    }
+
+    // Consumer: the oldest whole chunk, nullptr when there is none. It is read in place
+    // unless it wraps around the end of the queue, and stays valid until Pop().
+    const int16_t* Front() {
+        if (front_ != nullptr) {
+            return front_;
+        }
+        if (queue_.Available() < chunk_size_) {
+            return nullptr;
+        }
+        const int16_t* data;
+        if (queue_.GetReadSpan(&data) >= chunk_size_) {
+            front_ = data;
+            in_place_ = true;
+        } else {
+            queue_.Read(scratch_.data(), chunk_size_);
+            front_ = scratch_.data();
+            in_place_ = false;
+        }
+        return front_;
+    }
+
+    // Consumer: releases the chunk returned by Front()
+    void Pop() {
+        if (front_ != nullptr && in_place_) {
+            queue_.CommitRead(chunk_size_);
+        }
+        front_ = nullptr;
+    }
+
+    // Consumer: drops everything queued so far
+    void Clear() {
+        Pop();
+        queue_.Clear();
+    }
+
+private:
+    SpscRingBuffer<int16_t> queue_;
+    size_t chunk_size_;
+    // Only used when a chunk wraps around the end of the queue
+    std::vector<int16_t> scratch_;
+    const int16_t* front_ = nullptr;
+    bool in_place_ = false;
+    std::atomic<uint32_t> dropped_{0};
+};
+
+#endif // CHUNK_QUEUE_H
@@ -1,21 +1,82 @@
 #include "dummy_audio_processor.h"
 #include <esp_log.h>
+#include <algorithm>
 
 #define TAG "DummyAudioProcessor"
 
+// Same as the AFE fetch size, so both configurations produce the same frames
+#define OUTPUT_FRAME_SAMPLES 512
+#define OUTPUT_FRAME_COUNT 4
+
+DummyAudioProcessor::~DummyAudioProcessor() {
+    // Frames still held by a consumer keep the pool alive
+    if (output_frames_ != nullptr) {
+        output_frames_->Retire();
+    }
+}
+
 void DummyAudioProcessor::Initialize(AudioCodec* codec) {
     codec_ = codec;
+    staging_.resize(OUTPUT_FRAME_SAMPLES);
+    output_frames_ = new AudioFramePool(OUTPUT_FRAME_COUNT, OUTPUT_FRAME_SAMPLES);
 }
 
-void DummyAudioProcessor::Feed(const std::vector<int16_t>& data) {
-    if (!is_running_ || !output_callback_) {
+void DummyAudioProcessor::Feed(const int16_t* data, size_t samples) {
+    if (!is_running_) {
         return;
     }
-    // 直接将输入数据传递给输出回调
-    output_callback_(std::vector<int16_t>(data));
+    int channels = codec_->input_channels();
+    size_t frames = samples / channels;
+    stats_.input_chunks++;
+    stats_.input_bytes += samples * sizeof(int16_t);
+    vad_.Process(data, samples, channels);
+
+    size_t i = 0;
+    while (i < frames) {
+        if (staged_ == 0 && channels == 1 && frames - i >= OUTPUT_FRAME_SAMPLES) {
+            // 直接将输入数据传递给输出回调
+            Output(data + i);
+            i += OUTPUT_FRAME_SAMPLES;
+            continue;
+        }
+        size_t n = std::min(OUTPUT_FRAME_SAMPLES - staged_, frames - i);
+        for (size_t k = 0; k < n; k++) {
+            staging_[staged_ + k] = data[(i + k) * channels];
+        }
+        staged_ += n;
+        i += n;
+        stats_.copied_bytes += n * sizeof(int16_t);
+        if (staged_ == OUTPUT_FRAME_SAMPLES) {
+            Output(staging_.data());
+            staged_ = 0;
+        }
+    }
+}
+
+void DummyAudioProcessor::Output(const int16_t* data) {
+    stats_.output_frames++;
+    stats_.output_bytes += OUTPUT_FRAME_SAMPLES * sizeof(int16_t);
+    if (output_view_callback_) {
+        output_view_callback_(data, OUTPUT_FRAME_SAMPLES);
+    } else if (output_frame_callback_) {
+        AudioFrame frame = output_frames_->Acquire(OUTPUT_FRAME_SAMPLES);
+        if (frame) {
+            std::copy(data, data + OUTPUT_FRAME_SAMPLES, frame.data());
+            stats_.copied_bytes += OUTPUT_FRAME_SAMPLES * sizeof(int16_t);
+            output_frame_callback_(std::move(frame));
+        } else {
+            // The consumer holds every frame, drop this one rather than allocate
+            dropped_frames_++;
+        }
+    } else if (output_callback_) {
+        stats_.copied_bytes += OUTPUT_FRAME_SAMPLES * sizeof(int16_t);
+        output_callback_(std::vector<int16_t>(data, data + OUTPUT_FRAME_SAMPLES));
+    }
 }
 
 void DummyAudioProcessor::Start() {
+    vad_.Reset();
+    staged_ = 0;
     is_running_ = true;
 }
 
@@ -31,8 +92,16 @@ void DummyAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& dat
     output_callback_ = callback;
 }
 
-void DummyAudioProcessor::OnVadStateChange(std::function<void(bool speaking)> callback) {
-    vad_state_change_callback_ = callback;
+void DummyAudioProcessor::OnOutputFrame(std::function<void(AudioFrame&& frame)> callback) {
+    output_frame_callback_ = callback;
+}
+
+void DummyAudioProcessor::OnOutputView(std::function<void(const int16_t* data, size_t samples)> callback) {
+    output_view_callback_ = callback;
+}
+
+void DummyAudioProcessor::OnVadStateChange(std::function<void(bool speaking, uint64_t sample)> callback) {
+    vad_.OnStateChange(callback);
 }
 
 size_t DummyAudioProcessor::GetFeedSize() {
@@ -40,5 +109,6 @@ size_t DummyAudioProcessor::GetFeedSize() {
         return 0;
     }
     // 返回一个固定的帧大小，比如 30ms 的数据
-    return 30 * codec_->input_sample_rate() / 1000;
-}
\ No newline at end of file
+    // The input is resampled to 16kHz
+    return 30 * 16000 / 1000 * codec_->input_channels();
+}
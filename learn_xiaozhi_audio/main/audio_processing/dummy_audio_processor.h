@@ -7,25 +7,46 @@
 #include "audio_processor.h"
 #include "audio_codec.h"
 
+// Pass-through for boards without AFE: the first channel of any input size is re-framed
+// into fixed 16kHz mono output frames. Whole frames of mono input are handed out in place,
+// only the pieces that straddle a frame boundary are copied.
 class DummyAudioProcessor : public AudioProcessor {
 public:
     DummyAudioProcessor() = default;
-    ~DummyAudioProcessor() = default;
+    ~DummyAudioProcessor();
 
     void Initialize(AudioCodec* codec) override;
-    void Feed(const std::vector<int16_t>& data) override;
+    using AudioProcessor::Feed;
+    void Feed(const int16_t* data, size_t samples) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
     void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
-    void OnVadStateChange(std::function<void(bool speaking)> callback) override;
+    void OnOutputFrame(std::function<void(AudioFrame&& frame)> callback) override;
+    void OnOutputView(std::function<void(const int16_t* data, size_t samples)> callback) override;
+    void OnVadStateChange(std::function<void(bool speaking, uint64_t sample)> callback) override;
     size_t GetFeedSize() override;
+    AudioProcessorStats stats() override {
+        AudioProcessorStats stats = stats_;
+        stats.dropped_frames = dropped_frames_;
+        return stats;
+    }
 
 private:
     AudioCodec* codec_ = nullptr;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
-    std::function<void(bool speaking)> vad_state_change_callback_;
+    std::function<void(AudioFrame&& frame)> output_frame_callback_;
+    std::function<void(const int16_t* data, size_t samples)> output_view_callback_;
+    AudioFramePool* output_frames_ = nullptr;
     bool is_running_ = false;
+    VadDetector vad_;
+    // The output frame being filled
+    std::vector<int16_t> staging_;
+    size_t staged_ = 0;
+    AudioProcessorStats stats_;
+    uint32_t dropped_frames_ = 0;
+
+    void Output(const int16_t* data);
 };
 
-#endif 
\ No newline at end of file
+#endif 
@@ -0,0 +1,73 @@
+#include "opus_preroll.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "OpusPreroll"
+
+OpusPreroll::OpusPreroll(int sample_rate, int frame_duration_ms, size_t max_packets)
+    : frame_samples_(sample_rate / 1000 * frame_duration_ms), max_packets_(max_packets), sizes_(max_packets) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, 1, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create the encoder: %d", error);
+        return;
+    }
+    // The same settings as the OpusEncoderWrapper of the protocol, at the lowest complexity
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(1));
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(0));
+
+    slots_ = (uint8_t*)heap_caps_malloc(max_packets_ * OPUS_PREROLL_MAX_PACKET, MALLOC_CAP_SPIRAM);
+    if (slots_ == nullptr) {
+        slots_ = (uint8_t*)heap_caps_malloc(max_packets_ * OPUS_PREROLL_MAX_PACKET, MALLOC_CAP_8BIT);
+    }
+    if (slots_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu packets", max_packets_);
+    }
+}
+
+OpusPreroll::~OpusPreroll() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+    heap_caps_free(slots_);
+}
+
+bool OpusPreroll::Encode(const int16_t* pcm) {
+    if (!ready() || max_packets_ == 0) {
+        return false;
+    }
+    uint8_t* slot = slots_ + head_ * OPUS_PREROLL_MAX_PACKET;
+    int size = opus_encode(encoder_, pcm, frame_samples_, slot, OPUS_PREROLL_MAX_PACKET);
+    if (size < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio: %d", size);
+        return false;
+    }
+    if (count_ == max_packets_) {
+        // The slot held the oldest packet
+        bytes_ -= sizes_[head_];
+    } else {
+        count_++;
+    }
+    sizes_[head_] = size;
+    bytes_ += size;
+    head_ = (head_ + 1) % max_packets_;
+    return true;
+}
+
+void OpusPreroll::Take(std::list<std::vector<uint8_t>>& packets) {
+    size_t index = (head_ + max_packets_ - count_) % std::max<size_t>(max_packets_, 1);
+    for (size_t i = 0; i < count_; i++) {
+        const uint8_t* slot = slots_ + index * OPUS_PREROLL_MAX_PACKET;
+        packets.emplace_back(slot, slot + sizes_[index]);
+        index = (index + 1) % max_packets_;
+    }
+    Clear();
+}
+
+void OpusPreroll::Clear() {
+    head_ = 0;
+    count_ = 0;
+    bytes_ = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef OPUS_PREROLL_H
+#define OPUS_PREROLL_H
+
+#include <opus.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <vector>
+
+// Upper bound of one packet, opus_encode() lowers the quality of a frame to stay below it
+#define OPUS_PREROLL_MAX_PACKET 512
+
+// The most recent Opus packets of a mono stream, encoded one frame at a time as the audio
+// arrives. The packet slots are allocated once, in PSRAM when available, and Encode()
+// never allocates: once full, a new packet replaces the oldest one.
+class OpusPreroll {
+public:
+    OpusPreroll(int sample_rate, int frame_duration_ms, size_t max_packets);
+    ~OpusPreroll();
+
+    OpusPreroll(const OpusPreroll&) = delete;
+    OpusPreroll& operator=(const OpusPreroll&) = delete;
+
+    // Encodes exactly frame_samples() samples into one packet
+    bool Encode(const int16_t* pcm);
+    // Appends copies of the packets to `packets`, oldest first, and empties the store
+    void Take(std::list<std::vector<uint8_t>>& packets);
+    void Clear();
+
+    inline bool ready() const { return encoder_ != nullptr && slots_ != nullptr; }
+    inline size_t frame_samples() const { return frame_samples_; }
+    inline size_t packets() const { return count_; }
+    inline size_t bytes() const { return bytes_; }
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    size_t frame_samples_ = 0;
+    size_t max_packets_ = 0;
+    // max_packets_ slots of OPUS_PREROLL_MAX_PACKET bytes, and the size used in each
+    uint8_t* slots_ = nullptr;
+    std::vector<uint16_t> sizes_;
+    // Next slot to write, and the number of packets behind it
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t bytes_ = 0;
+};
+
+#endif // OPUS_PREROLL_H
@@ -0,0 +1,63 @@
+#include "pcm_preroll.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "PcmPreroll"
+
+PcmPreroll::PcmPreroll(size_t capacity) : capacity_(capacity) {
+    buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (buffer_ == nullptr) {
+        buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu samples", capacity_);
+        capacity_ = 0;
+    }
+}
+
+PcmPreroll::~PcmPreroll() {
+    heap_caps_free(buffer_);
+}
+
+void PcmPreroll::Write(const int16_t* data, size_t samples) {
+    if (capacity_ == 0) {
+        return;
+    }
+    // Only the newest capacity_ samples can survive
+    if (samples > capacity_) {
+        data += samples - capacity_;
+        samples = capacity_;
+    }
+    size_t first = std::min(samples, capacity_ - head_);
+    memcpy(buffer_ + head_, data, first * sizeof(int16_t));
+    memcpy(buffer_, data + first, (samples - first) * sizeof(int16_t));
+    head_ = (head_ + samples) % capacity_;
+    size_ = std::min(size_ + samples, capacity_);
+}
+
+int PcmPreroll::Snapshot(size_t samples, PcmSpan spans[2]) const {
+    samples = std::min(samples, size_);
+    if (samples == 0) {
+        return 0;
+    }
+    if (samples <= head_) {
+        spans[0] = {buffer_ + head_ - samples, samples};
+        return 1;
+    }
+    // The oldest part sits at the end of the buffer
+    size_t tail = samples - head_;
+    spans[0] = {buffer_ + capacity_ - tail, tail};
+    if (head_ == 0) {
+        return 1;
+    }
+    spans[1] = {buffer_, head_};
+    return 2;
+}
+
+void PcmPreroll::Clear() {
+    head_ = 0;
+    size_ = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef PCM_PREROLL_H
+#define PCM_PREROLL_H
+
+#include <cstdint>
+#include <cstddef>
+
+struct PcmSpan {
+    const int16_t* data;
+    size_t samples;
+};
+
+// Fixed-size history of the most recent PCM samples, allocated once in PSRAM when available.
+// Writing never allocates: once full, new samples overwrite the oldest ones.
+// Write() and Snapshot() must be called from the same task, and the spans returned
+// by Snapshot() stay valid until the next Write().
+class PcmPreroll {
+public:
+    explicit PcmPreroll(size_t capacity);
+    ~PcmPreroll();
+
+    PcmPreroll(const PcmPreroll&) = delete;
+    PcmPreroll& operator=(const PcmPreroll&) = delete;
+
+    void Write(const int16_t* data, size_t samples);
+    // The last `samples` samples (or fewer if not stored yet) in order, as one or two spans.
+    // Returns the number of spans used.
+    int Snapshot(size_t samples, PcmSpan spans[2]) const;
+    void Clear();
+
+    inline size_t capacity() const { return capacity_; }
+    inline size_t size() const { return size_; }
+
+private:
+    int16_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    // Next sample to write, and the number of valid samples behind it
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
+
+#endif // PCM_PREROLL_H
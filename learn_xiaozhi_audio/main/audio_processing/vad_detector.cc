@@ -0,0 +1,65 @@
+#include "vad_detector.h"
+
+VadDetector::VadDetector(int sample_rate) : VadDetector(sample_rate, Config()) {
+}
+
+VadDetector::VadDetector(int sample_rate, const Config& config) {
+    frame_samples_ = sample_rate * config.frame_ms / 1000;
+    // Compared with the sum of squares, so no division per frame
+    energy_limit_ = (uint64_t)config.energy_threshold * config.energy_threshold * frame_samples_;
+    zero_crossing_limit_ = config.zero_crossing_limit * config.frame_ms / 1000;
+    attack_samples_ = sample_rate * config.attack_ms / 1000;
+    hangover_samples_ = sample_rate * config.hangover_ms / 1000;
+}
+
+void VadDetector::OnStateChange(std::function<void(bool speaking, uint64_t sample)> callback) {
+    callback_ = callback;
+}
+
+void VadDetector::Process(const int16_t* data, size_t samples, int channels) {
+    size_t frames = samples / channels;
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sample = data[i * channels];
+        energy_ += sample * sample;
+        zero_crossings_ += (sample ^ last_sample_) < 0;
+        last_sample_ = sample;
+        if (++frame_fill_ == frame_samples_) {
+            Update(energy_ >= energy_limit_ && zero_crossings_ <= zero_crossing_limit_, frame_samples_);
+            energy_ = 0;
+            zero_crossings_ = 0;
+            frame_fill_ = 0;
+        }
+    }
+}
+
+void VadDetector::Update(bool speech, size_t frames) {
+    uint64_t frame_start = position_;
+    position_ += frames;
+    if (speech == speaking_) {
+        // The run that would flip the state is broken
+        run_samples_ = 0;
+        return;
+    }
+    if (run_samples_ == 0) {
+        run_start_ = frame_start;
+    }
+    run_samples_ += frames;
+    if (run_samples_ >= (speaking_ ? hangover_samples_ : attack_samples_)) {
+        speaking_ = speech;
+        run_samples_ = 0;
+        if (callback_) {
+            callback_(speaking_, run_start_);
+        }
+    }
+}
+
+void VadDetector::Reset() {
+    energy_ = 0;
+    zero_crossings_ = 0;
+    frame_fill_ = 0;
+    last_sample_ = 0;
+    speaking_ = false;
+    position_ = 0;
+    run_start_ = 0;
+    run_samples_ = 0;
+}
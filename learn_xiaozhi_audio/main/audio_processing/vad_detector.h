@@ -0,0 +1,61 @@
+#ifndef VAD_DETECTOR_H
+#define VAD_DETECTOR_H
+
+#include <sdkconfig.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// Fixed-point voice activity detector. Each frame is speech when its energy is above
+// the threshold and its zero crossing count is below the limit, which rejects hiss.
+// Speech starts after attack_ms of speech frames and ends after hangover_ms of silence.
+// Events carry the sample position, counted from Reset(), where the speech run began or
+// the last speech frame ended.
+class VadDetector {
+public:
+    struct Config {
+        int frame_ms = 10;
+        // RMS amplitude of a speech frame
+        int energy_threshold = 300;
+        // Zero crossings per second, voiced speech stays well below this
+        int zero_crossing_limit = 5000;
+        int attack_ms = CONFIG_VAD_ATTACK_MS;
+        int hangover_ms = CONFIG_VAD_HANGOVER_MS;
+    };
+
+    explicit VadDetector(int sample_rate = 16000);
+    VadDetector(int sample_rate, const Config& config);
+
+    void OnStateChange(std::function<void(bool speaking, uint64_t sample)> callback);
+    // Classifies the first channel of interleaved PCM, frames may span calls
+    void Process(const int16_t* data, size_t samples, int channels = 1);
+    // Runs a decision made elsewhere, like the AFE VAD, through attack and hangover
+    void Update(bool speech, size_t frames);
+    void Reset();
+
+    inline bool speaking() const { return speaking_; }
+    inline uint64_t position() const { return position_; }
+
+private:
+    std::function<void(bool speaking, uint64_t sample)> callback_;
+    size_t frame_samples_;
+    uint64_t energy_limit_;
+    int zero_crossing_limit_;
+    size_t attack_samples_;
+    size_t hangover_samples_;
+
+    // Current frame
+    uint64_t energy_ = 0;
+    int zero_crossings_ = 0;
+    size_t frame_fill_ = 0;
+    int16_t last_sample_ = 0;
+
+    bool speaking_ = false;
+    uint64_t position_ = 0;
+    // Start and length of the current speech or silence run
+    uint64_t run_start_ = 0;
+    size_t run_samples_ = 0;
+};
+
+#endif // VAD_DETECTOR_H
@@ -1,98 +1,204 @@
 #include "wake_word_detect.h"
 #include "application.h"
+#include "settings.h"
+#include "opus_preroll.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <model_path.h>
 #include <arpa/inet.h>
+#include <cinttypes>
 #include <sstream>
+#include <memory>
+#include <algorithm>
 
 #define DETECTION_RUNNING_EVENT 1
 #define WAKE_NET_TO_PROCESS_VALID_DATA 2
 
+// Chunks buffered between Feed() and the detection task, about a quarter second
+#define WAKENET_QUEUE_CHUNKS 8
+
+// The direct interface runs every model on its own, the AFE path uses the models the
+// shared front end loaded, two at most
+#define WAKENET_MAX_MODELS 3
+// Report the CPU used by each model every 10s of audio
+#define WAKENET_BUDGET_PERIOD_MS 10000
+
+#define OPUS_FRAME_DURATION_MS 60
+#define OPUS_FRAME_SAMPLES (16000 / 1000 * OPUS_FRAME_DURATION_MS)
+#define ENCODE_QUEUE_FRAMES 4
+// Notification bits of the encode task
+#define ENCODE_DATA_EVENT (1 << 0)
+#define ENCODE_SNAPSHOT_EVENT (1 << 1)
+
 static const char* TAG = "WakeWordDetect";
 
 WakeWordDetect::WakeWordDetect()
-    : afe_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
+    : wake_word_opus_() {
 
     event_group_ = xEventGroupCreate();
 }
 
 WakeWordDetect::~WakeWordDetect() {
-    if (afe_data_ != nullptr) {
-        afe_iface_->destroy(afe_data_);
+#if CONFIG_USE_WAKENET_DIRECT_IF
+    for (auto& model : models_) {
+        model.iface->destroy(model.data);
     }
+#endif
 
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
     }
+    delete preroll_;
+    delete encode_queue_;
+#if CONFIG_USE_WAKENET_DIRECT_IF
+    delete chunk_queue_;
+#endif
 
     vEventGroupDelete(event_group_);
 }
 
-void WakeWordDetect::Initialize(AudioCodec* codec) {
+void WakeWordDetect::Initialize(AudioCodec* codec, AudioFrontEnd* front_end) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
+    // Both the AFE output and the WakeNet chunks are 16kHz mono
+    preroll_ = new PcmPreroll(CONFIG_WAKE_WORD_PREROLL_MS * 16);
 
+#if CONFIG_USE_WAKENET_DIRECT_IF
     srmodel_list_t *models = esp_srmodel_init("model");
+    std::vector<char*> model_names;
     for (int i = 0; i < models->num; i++) {
         ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
-        if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
+        if (strstr(models->model_name[i], ESP_WN_PREFIX) == NULL) {
+            continue;
         }
+        if (model_names.size() >= WAKENET_MAX_MODELS) {
+            ESP_LOGW(TAG, "Model %s skipped, at most %d wake word models", models->model_name[i], WAKENET_MAX_MODELS);
+            continue;
+        }
+        model_names.push_back(models->model_name[i]);
+    }
+#else
+    if (front_end == nullptr) {
+        ESP_LOGE(TAG, "The AFE path needs the audio front end");
+        return;
+    }
+    front_end_ = front_end;
+    srmodel_list_t *models = front_end_->models();
+    auto& model_names = front_end_->wakenet_models();
+#endif
+    for (auto name : model_names) {
+        WakeWordModel model;
+        model.name = name;
+        auto words = esp_srmodel_get_wake_words(models, model.name);
+        // split by ";" to get all wake words
+        std::stringstream ss(words);
+        std::string word;
+        while (std::getline(ss, word, ';')) {
+            model.words.push_back(word);
+        }
+        LoadThresholds(model);
+        models_.push_back(std::move(model));
+    }
+    if (models_.empty()) {
+        ESP_LOGE(TAG, "No wake word model found");
+        return;
     }
 
 #if CONFIG_USE_WAKENET_DIRECT_IF
-    //Only one model is supported
-    afe_iface_ = (esp_wn_iface_t*)esp_wn_handle_from_name(models->model_name[models->num-1]);
-    afe_data_ = afe_iface_->create(models->model_name[models->num-1], DET_MODE_95);
+    for (auto& model : models_) {
+        model.iface = (esp_wn_iface_t*)esp_wn_handle_from_name(model.name);
+        model.data = model.iface->create(model.name, DET_MODE_95);
+        for (size_t i = 0; i < model.thresholds.size(); i++) {
+            if (model.thresholds[i] > 0) {
+                model.iface->set_det_threshold(model.data, model.thresholds[i], i + 1);
+            }
+        }
+    }
+    // Every model gets the same chunks
+    chunk_size_ = models_[0].iface->get_samp_chunksize(models_[0].data);
+    for (auto it = models_.begin() + 1; it != models_.end();) {
+        if (it->iface->get_samp_chunksize(it->data) != (int)chunk_size_) {
+            ESP_LOGE(TAG, "Model %s skipped, its chunk size differs", it->name);
+            it->iface->destroy(it->data);
+            it = models_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    chunk_queue_ = new ChunkQueue(chunk_size_, WAKENET_QUEUE_CHUNKS);
 #else
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
-    }
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
-    afe_config->aec_init = codec_->input_reference();
-    afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
-    afe_config->afe_perferred_core = 1;
-    afe_config->afe_perferred_priority = 1;
-    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-    
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
+    for (size_t m = 0; m < models_.size(); m++) {
+        auto& thresholds = models_[m].thresholds;
+        float threshold = 0;
+        for (float t : thresholds) {
+            if (t > 0 && (threshold == 0 || t < threshold)) {
+                threshold = t;
+            }
+        }
+        if (threshold > 0) {
+            front_end_->SetWakeNetThreshold(m + 1, threshold);
+            std::fill(thresholds.begin(), thresholds.end(), threshold);
+        }
+    }
+    front_end_->OnResult(AUDIO_FRONT_END_WAKE_WORD, [this](afe_fetch_result_t* result) {
+        OnFrontEndResult(result);
+    });
 #endif
 
+    // Opus needs a large stack, keep it in PSRAM when possible
+    encode_queue_ = new SpscRingBuffer<int16_t>(OPUS_FRAME_SAMPLES * ENCODE_QUEUE_FRAMES);
+    wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    if (wake_word_encode_task_stack_ == nullptr) {
+        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_8BIT);
+    }
+    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (WakeWordDetect*)arg;
+        this_->AudioEncodeTask();
+        vTaskDelete(NULL);
+    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+
+#if CONFIG_USE_WAKENET_DIRECT_IF
     xTaskCreate([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         this_->AudioDetectionTask();
         vTaskDelete(NULL);
     }, "audio_detection", 4096, this, 3, nullptr);
+#endif
 }
 
-void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
+// Per-word thresholds live in Settings("wake_word"), keyed by the word (NVS keys are at
+// most 15 characters) and stored in 1/1000, e.g. "hilexin" = 900 for 0.9
+void WakeWordDetect::LoadThresholds(WakeWordModel& model) {
+    Settings settings("wake_word", false);
+    for (auto& word : model.words) {
+        int permille = settings.GetInt(word.substr(0, 15), 0);
+        if (permille != 0 && (permille < 400 || permille > 999)) {
+            ESP_LOGW(TAG, "Threshold %d of %s out of range 400-999, using the model default", permille, word.c_str());
+            permille = 0;
+        }
+        model.thresholds.push_back(permille / 1000.0f);
+        ESP_LOGI(TAG, "Wake word %s of %s, threshold %d", word.c_str(), model.name, permille);
+    }
+}
+
+void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word, float threshold)> callback) {
     wake_word_detected_callback_ = callback;
 }
 
 void WakeWordDetect::StartDetection() {
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
+#ifndef CONFIG_USE_WAKENET_DIRECT_IF
+    if (front_end_ != nullptr) {
+        front_end_->Start(AUDIO_FRONT_END_WAKE_WORD);
+    }
+#endif
 }
 
 void WakeWordDetect::StopDetection() {
     xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
 #ifndef CONFIG_USE_WAKENET_DIRECT_IF
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
+    if (front_end_ != nullptr) {
+        front_end_->Stop(AUDIO_FRONT_END_WAKE_WORD);
     }
 #endif
 }
@@ -101,119 +207,173 @@ bool WakeWordDetect::IsDetectionRunning() {
     return xEventGroupGetBits(event_group_) & DETECTION_RUNNING_EVENT;
 }
 
-void WakeWordDetect::Feed(const std::vector<int16_t>& data) {
-    if (afe_data_ == nullptr) {
+void WakeWordDetect::Feed(const int16_t* data, size_t samples) {
+#if CONFIG_USE_WAKENET_DIRECT_IF
+    if (chunk_queue_ == nullptr) {
+        return;
+    }
+    // WakeNet listens to the first microphone only
+    if (!chunk_queue_->Push(data, samples, codec_->input_channels())) {
+        // The detector is behind, drop the newest audio rather than block the audio loop
+        uint32_t dropped = chunk_queue_->dropped();
+        if ((dropped & (dropped - 1)) == 0) {
+            ESP_LOGW(TAG, "Detection queue full, %" PRIu32 " chunks dropped", dropped);
+        }
         return;
     }
-#if CONFIG_USE_WAKENET_DIRECT_IF
-    data_to_det_.insert(data_to_det_.begin(), data.begin(), data.end());
     xEventGroupSetBits(event_group_, WAKE_NET_TO_PROCESS_VALID_DATA);
 #else
-    afe_iface_->feed(afe_data_, data.data());
+    if (front_end_ != nullptr) {
+        front_end_->Feed(data, samples);
+    }
 #endif
 }
 
 size_t WakeWordDetect::GetFeedSize() {
-    if (afe_data_ == nullptr) {
-        return 0;
-    }
 #if CONFIG_USE_WAKENET_DIRECT_IF
-    return afe_iface_->get_samp_chunksize(afe_data_) * codec_->input_channels();
+    return chunk_size_ * codec_->input_channels();
 #else
-    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+    return front_end_ != nullptr ? front_end_->GetFeedSize() : 0;
 #endif
 }
 
-void WakeWordDetect::AudioDetectionTask() {
 #if CONFIG_USE_WAKENET_DIRECT_IF
-    auto feed_size = afe_iface_->get_samp_chunksize(afe_data_) * sizeof(int16_t);
+void WakeWordDetect::AudioDetectionTask() {
+    auto feed_size = chunk_size_ * sizeof(int16_t);
     auto audio_channels = codec_->input_channels();
-    ESP_LOGI(TAG, "Audio detection task started, feed size per channel: %d, audio channels: %d",
-        feed_size, audio_channels);
-#else
-    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
-    ESP_LOGI(TAG, "Audio detection task started, feed size: %d fetch size: %d",
-        feed_size, fetch_size);
-#endif
+    ESP_LOGI(TAG, "Audio detection task started, feed size per channel: %d, audio channels: %d, models: %zu",
+        feed_size, audio_channels, models_.size());
+    const int64_t chunk_us = chunk_size_ * 1000 / 16;
 
     while (true) {
-    #if CONFIG_USE_WAKENET_DIRECT_IF
-        xEventGroupWaitBits(event_group_, WAKE_NET_TO_PROCESS_VALID_DATA, pdFALSE, pdTRUE, portMAX_DELAY);
-        if(data_to_det_.size()){
-            wakenet_state_t state = afe_iface_->detect(afe_data_, data_to_det_.data());
-            data_to_det_.clear();
-            if(state == WAKENET_DETECTED){
-                StopDetection();
-                if (wake_word_detected_callback_) {
-                    wake_word_detected_callback_(wake_words_[wake_words_.size()-1]);
+        // Cleared on wake up, so a chunk fed while draining sets it again
+        xEventGroupWaitBits(event_group_, WAKE_NET_TO_PROCESS_VALID_DATA, pdTRUE, pdTRUE, portMAX_DELAY);
+        const int16_t* chunk;
+        while ((chunk = chunk_queue_->Front()) != nullptr) {
+
+            // Every model sees every chunk, the first one to fire wins
+            WakeWordModel* detected_model = nullptr;
+            int detected_index = 0;
+            for (auto& model : models_) {
+                auto start_time = esp_timer_get_time();
+                int index = model.iface->detect(model.data, const_cast<int16_t*>(chunk));
+                model.detect_time_us += esp_timer_get_time() - start_time;
+                if (index > 0 && detected_model == nullptr) {
+                    detected_model = &model;
+                    detected_index = index;
+                }
+            }
+            StoreWakeWordData(chunk, chunk_size_);
+            chunk_queue_->Pop();
+            detected_chunks_++;
+
+            if (++budget_chunks_ * chunk_us >= WAKENET_BUDGET_PERIOD_MS * 1000) {
+                for (auto& model : models_) {
+                    int permille = model.detect_time_us * 1000 / (budget_chunks_ * chunk_us);
+                    ESP_LOGI(TAG, "Model %s: %d.%d%% CPU", model.name, permille / 10, permille % 10);
+                    model.detect_time_us = 0;
                 }
+                budget_chunks_ = 0;
+            }
+
+            if (detected_model != nullptr) {
+                // Audio queued behind the wake word is stale once detection stops
+                chunk_queue_->Clear();
+                ESP_LOGI(TAG, "Wake word after %" PRIu32 " chunks, %" PRIu32 " dropped", detected_chunks_, chunk_queue_->dropped());
+                OnDetected(*detected_model, detected_index - 1);
+                break;
             }
-        }    
-        xEventGroupClearBits(event_group_, WAKE_NET_TO_PROCESS_VALID_DATA);
-    #else
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            continue;;
         }
+    }
+}
+#else
+// Runs on the front end task, with the NS/AEC output the audio processor also gets
+void WakeWordDetect::OnFrontEndResult(afe_fetch_result_t* res) {
+    if (models_.empty()) {
+        return;
+    }
+    // Store the wake word data for voice recognition, like who is speaking
+    StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+
+    if (res->wakeup_state == WAKENET_DETECTED) {
+        int model_index = std::clamp<int>(res->wakenet_model_index, 1, models_.size()) - 1;
+        OnDetected(models_[model_index], res->wake_word_index - 1);
+    }
+}
+#endif
+
+void WakeWordDetect::OnDetected(const WakeWordModel& model, int word_index) {
+    StopDetection();
+    EncodeWakeWordData();
+    if (model.words.empty()) {
+        return;
+    }
+    word_index = std::clamp<int>(word_index, 0, model.words.size() - 1);
+    last_detected_wake_word_ = model.words[word_index];
+    float threshold = model.thresholds[word_index];
+#if CONFIG_USE_WAKENET_DIRECT_IF
+    if (threshold == 0) {
+        threshold = model.iface->get_det_threshold(model.data, word_index + 1);
+    }
+#endif
+    ESP_LOGI(TAG, "Wake word %s from %s, threshold %.3f", last_detected_wake_word_.c_str(), model.name, threshold);
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
+    if (wake_word_detected_callback_) {
+        wake_word_detected_callback_(last_detected_wake_word_, threshold);
+    }
+}
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            StopDetection();
-            last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+void WakeWordDetect::StoreWakeWordData(const int16_t* data, size_t samples) {
+    // Overwrites the oldest audio, no allocation after Initialize()
+    preroll_->Write(data, samples);
+    // A full queue means the encoder fell behind, the overrun is counted by the queue
+    encode_queue_->Write(data, samples);
+    xTaskNotify(wake_word_encode_task_, ENCODE_DATA_EVENT, eSetBits);
+}
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
-            }
+int WakeWordDetect::GetPreroll(int duration_ms, PcmSpan spans[2]) const {
+    if (preroll_ == nullptr) {
+        return 0;
+    }
+    return preroll_->Snapshot(duration_ms * 16, spans);
+}
+
+void WakeWordDetect::EncodeWakeWordData() {
+    // The encode task finishes the queued audio first, so the packets end at the wake word
+    xTaskNotify(wake_word_encode_task_, ENCODE_SNAPSHOT_EVENT, eSetBits);
+}
+
+void WakeWordDetect::AudioEncodeTask() {
+    const size_t max_packets = CONFIG_WAKE_WORD_PREROLL_MS / OPUS_FRAME_DURATION_MS;
+    auto preroll = std::make_unique<OpusPreroll>(16000, OPUS_FRAME_DURATION_MS, max_packets);
+    // Reused for every frame, nothing on this path allocates after start
+    std::vector<int16_t> pcm(OPUS_FRAME_SAMPLES);
+
+    while (true) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        while (encode_queue_->Available() >= OPUS_FRAME_SAMPLES) {
+            encode_queue_->Read(pcm.data(), pcm.size());
+            auto start_time = esp_timer_get_time();
+            preroll->Encode(pcm.data());
+            encode_time_.Record(esp_timer_get_time() - start_time);
         }
-    #endif
-    }
-}
-
-void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 32ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 32) {
-        wake_word_pcm_.pop_front();
-    }
-}
-
-// void WakeWordDetect::EncodeWakeWordData() {
-//     wake_word_opus_.clear();
-//     if (wake_word_encode_task_stack_ == nullptr) {
-//         wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
-//     }
-//     wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-//         auto this_ = (WakeWordDetect*)arg;
-//         {
-//             auto start_time = esp_timer_get_time();
-//             auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-//             encoder->SetComplexity(0); // 0 is the fastest
-
-//             for (auto& pcm: this_->wake_word_pcm_) {
-//                 encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-//                     std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-//                     this_->wake_word_opus_.emplace_back(std::move(opus));
-//                     this_->wake_word_cv_.notify_all();
-//                 });
-//             }
-//             this_->wake_word_pcm_.clear();
-
-//             auto end_time = esp_timer_get_time();
-//             ESP_LOGI(TAG, "Encode wake word opus %zu packets in %lld ms",
-//                 this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
-
-//             std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-//             this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-//             this_->wake_word_cv_.notify_all();
-//         }
-//         vTaskDelete(NULL);
-//     }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
-// }
+
+        if (events & ENCODE_SNAPSHOT_EVENT) {
+            ESP_LOGI(TAG, "Wake word opus: %zu packets, %zu bytes, %" PRIu32 " PCM overruns",
+                preroll->packets(), preroll->bytes(), encode_queue_->overruns());
+            encode_time_.Print(TAG, "Opus encode time per packet");
+            encode_time_.Reset();
+
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            wake_word_opus_.clear();
+            preroll->Take(wake_word_opus_);
+            wake_word_opus_.push_back(std::vector<uint8_t>());
+            wake_word_cv_.notify_all();
+        }
+    }
+}
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
@@ -10,8 +10,7 @@
 #include <esp_wn_models.h>
 #include <model_path.h>
 #else
-#include <esp_afe_sr_models.h>
-#include <esp_nsn_models.h>
+#include "audio_front_end.h"
 #endif
 
 #include <list>
@@ -20,51 +19,91 @@
 #include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include "audio_codec.h"
+#include "ring_buffer.h"
+#include "chunk_queue.h"
+#include "pcm_preroll.h"
+#include "latency_histogram.h"
 
 class WakeWordDetect {
 public:
     WakeWordDetect();
     ~WakeWordDetect();
 
-    void Initialize(AudioCodec* codec);
-    void Feed(const std::vector<int16_t>& data);
-    void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
+    // The AFE path runs on the shared front end, the direct interface needs none
+    void Initialize(AudioCodec* codec, AudioFrontEnd* front_end = nullptr);
+    void Feed(const int16_t* data, size_t samples);
+    void Feed(const std::vector<int16_t>& data) { Feed(data.data(), data.size()); }
+    // threshold is the one the model score reached, not the score itself; WakeNet does not
+    // report the score. 0 when the AFE uses its default.
+    void OnWakeWordDetected(std::function<void(const std::string& wake_word, float threshold)> callback);
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
     size_t GetFeedSize();
-    //void EncodeWakeWordData();
+    // Hand the pre-roll packets encoded so far to GetWakeWordOpus(), done on every detection
+    void EncodeWakeWordData();
+    // Blocks until the packets are handed over, an empty packet ends the list
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    // The last duration_ms of processed audio as one or two spans, call it from the
+    // wake word callback only; the spans are overwritten by the next detection chunk
+    int GetPreroll(int duration_ms, PcmSpan spans[2]) const;
 
 private:
+    struct WakeWordModel {
+        // Owned by the model list of esp_srmodel_init()
+        char* name = nullptr;
+        std::vector<std::string> words;
+        // Detection threshold per word, 0 when the model default is used.
+        // The AFE only takes one threshold per model, the lowest one of its words.
+        std::vector<float> thresholds;
 #if CONFIG_USE_WAKENET_DIRECT_IF
-    esp_wn_iface_t * afe_iface_ = nullptr;
-    model_iface_data_t * afe_data_ = nullptr;
-    std::vector<int16_t> data_to_det_;
+        esp_wn_iface_t* iface = nullptr;
+        model_iface_data_t* data = nullptr;
+        // Time spent in detect(), for the CPU budget of each model
+        int64_t detect_time_us = 0;
+#endif
+    };
+    std::vector<WakeWordModel> models_;
+
+#if CONFIG_USE_WAKENET_DIRECT_IF
+    // Whole WakeNet chunks of the first microphone, from Feed() to the detection task
+    ChunkQueue* chunk_queue_ = nullptr;
+    size_t chunk_size_ = 0;
+    uint32_t detected_chunks_ = 0;
+    uint32_t budget_chunks_ = 0;
 #else
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AudioFrontEnd* front_end_ = nullptr;
 #endif
-    char* wakenet_model_ = NULL;
-    std::vector<std::string> wake_words_;
     EventGroupHandle_t event_group_;
-    std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
+    std::function<void(const std::string& wake_word, float threshold)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
 
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
+    PcmPreroll* preroll_ = nullptr;
+    // The pre-roll is encoded while it is stored: PCM goes through encode_queue_ to the encode
+    // task, which keeps the last CONFIG_WAKE_WORD_PREROLL_MS of packets in an OpusPreroll
+    SpscRingBuffer<int16_t>* encode_queue_ = nullptr;
+    LatencyHistogram encode_time_;
     std::list<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
-    void StoreWakeWordData(uint16_t* data, size_t size);
+    void LoadThresholds(WakeWordModel& model);
+    void OnDetected(const WakeWordModel& model, int word_index);
+    void StoreWakeWordData(const int16_t* data, size_t samples);
+#if CONFIG_USE_WAKENET_DIRECT_IF
     void AudioDetectionTask();
+#else
+    void OnFrontEndResult(afe_fetch_result_t* result);
+#endif
+    void AudioEncodeTask();
 };
 
 #endif
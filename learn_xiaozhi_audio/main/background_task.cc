@@ -1,63 +1,207 @@
 #include "background_task.h"
 
+#include <cstdio>
 #include <esp_log.h>
-#include <esp_task_wdt.h>
+#include <esp_heap_caps.h>
 
 #define TAG "BackgroundTask"
 
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
-    xTaskCreate([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 2, &background_task_handle_);
+// The worker running on this thread, so nested Schedule() calls stay on the same worker
+static thread_local BackgroundTask* current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+BackgroundTask::BackgroundTask(uint32_t stack_size, int workers, bool pinned) {
+    if (workers < 1) {
+        workers = 1;
+    }
+    for (int i = 0; i < workers; i++) {
+        workers_.push_back(new Worker());
+    }
+#if defined(ESP_PLATFORM)
+    running_workers_ = workers;
+#endif
+    for (int i = 0; i < workers; i++) {
+#if defined(ESP_PLATFORM)
+        struct Args {
+            BackgroundTask* pool;
+            int index;
+        };
+        auto args = new Args{this, i};
+        char name[16];
+        snprintf(name, sizeof(name), workers == 1 ? "background_task" : "background_%d", i);
+        BaseType_t created = xTaskCreatePinnedToCore([](void* arg) {
+            auto args = (Args*)arg;
+            auto pool = args->pool;
+            int index = args->index;
+            delete args;
+            pool->BackgroundTaskLoop(index);
+            // The pool may be gone already, only the task itself is left to delete
+            vTaskDelete(NULL);
+        }, name, stack_size, args, 2, NULL, pinned ? i % portNUM_PROCESSORS : tskNO_AFFINITY);
+        if (created != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create %s", name);
+            delete args;
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_workers_--;
+        }
+#else
+        (void)stack_size;
+        (void)pinned;
+        workers_[i]->thread = std::thread(&BackgroundTask::BackgroundTaskLoop, this, i);
+#endif
+    }
 }
 
 BackgroundTask::~BackgroundTask() {
-    if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+        work_available_.notify_all();
+#if defined(ESP_PLATFORM)
+        // The workers finish what is queued and delete their own tasks; workers steal from
+        // each other, so none is freed before all have left their loop
+        completed_.wait(lock, [this]() { return running_workers_ == 0; });
+#endif
+    }
+#if !defined(ESP_PLATFORM)
+    for (auto worker : workers_) {
+        worker->thread.join();
+    }
+#endif
+    for (auto worker : workers_) {
+        delete worker;
     }
 }
 
-void BackgroundTask::Schedule(std::function<void()> callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
+// The FreeRTOS task or thread calling Schedule()
+uintptr_t BackgroundTask::CurrentCaller() {
+#if defined(ESP_PLATFORM)
+    return (uintptr_t)xTaskGetCurrentTaskHandle();
+#else
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+void BackgroundTask::Schedule(std::function<void()> callback, bool serial) {
+#if defined(ESP_PLATFORM)
     if (active_tasks_ >= 30) {
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         if (free_sram < 10000) {
-            ESP_LOGW(TAG, "active_tasks_ == %u, free_sram == %u", active_tasks_.load(), free_sram);
+            ESP_LOGW(TAG, "active_tasks_ == %zu, free_sram == %d", active_tasks_.load(), free_sram);
         }
     }
+#endif
     active_tasks_++;
-    main_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (main_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
-            }
-        }
-    });
-    condition_variable_.notify_all();
+    uintptr_t caller = CurrentCaller();
+    int index = current_pool == this ? current_worker : caller % workers_.size();
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        workers_[index]->tasks.push_back({std::move(callback), caller, serial});
+        pending_tasks_++;
+        wake = idle_workers_ > 0;
+    }
+    // Busy workers look for the next task on their own
+    if (wake) {
+        work_available_.notify_one();
+    }
 }
 
 void BackgroundTask::WaitForCompletion() {
     std::unique_lock<std::mutex> lock(mutex_);
-    condition_variable_.wait(lock, [this]() {
-        return main_tasks_.empty() && active_tasks_ == 0;
+    completed_.wait(lock, [this]() {
+        return active_tasks_ == 0;
     });
 }
 
-void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
+void BackgroundTask::OnCompletion(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (active_tasks_ != 0) {
+            completion_callbacks_.push_back(std::move(callback));
+            return;
+        }
+    }
+    callback();
+}
+
+bool BackgroundTask::SerialRunning(uintptr_t caller) const {
+    for (auto worker : workers_) {
+        if (worker->running_serial && worker->running_caller == caller) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The oldest task of the own deque that may run, else the oldest of another worker. A serial
+// task waits while another serial task of its caller runs, and the serial tasks of a caller
+// sit in order in one deque, so they never overlap or overtake each other. Called with
+// mutex_ held.
+bool BackgroundTask::TakeTask(int index, Task& task) {
+    int count = workers_.size();
+    for (int i = 0; i < count; i++) {
+        auto& tasks = workers_[(index + i) % count]->tasks;
+        for (auto it = tasks.begin(); it != tasks.end(); ++it) {
+            if (it->serial && SerialRunning(it->caller)) {
+                continue;
+            }
+            task = std::move(*it);
+            tasks.erase(it);
+            pending_tasks_--;
+            if (i != 0) {
+                stolen_tasks_++;
+            }
+            workers_[index]->running_serial = task.serial;
+            workers_[index]->running_caller = task.caller;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BackgroundTask::BackgroundTaskLoop(int index) {
+    ESP_LOGI(TAG, "background_task %d started", index);
+    current_pool = this;
+    current_worker = index;
+    Task task;
+    std::unique_lock<std::mutex> lock(mutex_);
     while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !main_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(main_tasks_);
-        lock.unlock();
+        if (TakeTask(index, task)) {
+            lock.unlock();
+            task.callback();
+            task.callback = nullptr;
+            lock.lock();
+            bool serial = workers_[index]->running_serial;
+            workers_[index]->running_serial = false;
+            if (--active_tasks_ == 0) {
+                std::vector<std::function<void()>> callbacks;
+                // A task scheduled meanwhile defers the callbacks to its own completion
+                if (active_tasks_ == 0) {
+                    callbacks.swap(completion_callbacks_);
+                }
+                completed_.notify_all();
+                lock.unlock();
+                for (auto& callback : callbacks) {
+                    callback();
+                }
+                lock.lock();
+            } else if (serial && pending_tasks_ > 0) {
+                // The next serial task of the same caller may have been waiting for this one
+                work_available_.notify_all();
+            }
+            continue;
+        }
 
-        for (auto& task : tasks) {
-            task();
+        if (stopping_) {
+            break;
         }
+        idle_workers_++;
+        work_available_.wait(lock);
+        idle_workers_--;
     }
+#if defined(ESP_PLATFORM)
+    running_workers_--;
+    completed_.notify_all();
+#endif
 }
@@ -1,29 +1,83 @@
 #ifndef BACKGROUND_TASK_H
 #define BACKGROUND_TASK_H
 
+#if defined(ESP_PLATFORM)
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#else
+#include <thread>
+#endif
 #include <mutex>
-#include <list>
+#include <deque>
+#include <vector>
+#include <functional>
 #include <condition_variable>
 #include <atomic>
+#include <cstdint>
 
+// Runs callbacks on one or more worker tasks, each on the first worker that is free, so a
+// single caller spreads its work over all workers. Callbacks scheduled as serial keep their
+// order instead: the serial callbacks of one caller (the task that calls Schedule()) run one
+// at a time and in the order they were scheduled, whatever the number of workers. Every
+// caller has a home worker, and idle workers steal the oldest task they may run from the
+// others.
 class BackgroundTask {
 public:
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    // pinned puts worker i on core i % portNUM_PROCESSORS, otherwise the workers float
+    BackgroundTask(uint32_t stack_size = 4096 * 2, int workers = 1, bool pinned = false);
     ~BackgroundTask();
 
-    void Schedule(std::function<void()> callback);
+    // serial is for work that depends on the serial callbacks the same caller scheduled
+    // before, e.g. encoding a stream; everything else runs in parallel
+    void Schedule(std::function<void()> callback, bool serial = false);
+    // Returns when every scheduled callback has finished, including ones scheduled meanwhile
     void WaitForCompletion();
+    // The same without blocking: callback runs on the worker that finishes the last task,
+    // or right away in the caller when nothing is scheduled
+    void OnCompletion(std::function<void()> callback);
+
+    int workers() const { return workers_.size(); }
+    uint32_t stolen_tasks() const { return stolen_tasks_.load(std::memory_order_relaxed); }
 
 private:
+    struct Task {
+        std::function<void()> callback;
+        uintptr_t caller = 0;
+        bool serial = false;
+    };
+    // Everything but the thread is guarded by mutex_
+    struct Worker {
+        std::deque<Task> tasks;
+        // The caller of the serial task being run, if any
+        bool running_serial = false;
+        uintptr_t running_caller = 0;
+#if !defined(ESP_PLATFORM)
+        std::thread thread;
+#endif
+    };
+    std::vector<Worker*> workers_;
+
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
-    std::condition_variable condition_variable_;
-    TaskHandle_t background_task_handle_ = nullptr;
+    std::condition_variable work_available_;
+    // Signals WaitForCompletion() and, on the way out, the destructor
+    std::condition_variable completed_;
+    std::vector<std::function<void()>> completion_callbacks_;
+    // Queued and not yet taken
+    int pending_tasks_ = 0;
+    // Waiting for work, Schedule() only wakes one when there is any
+    int idle_workers_ = 0;
     std::atomic<size_t> active_tasks_{0};
+    std::atomic<uint32_t> stolen_tasks_{0};
+    bool stopping_ = false;
+#if defined(ESP_PLATFORM)
+    // Workers that have not left their loop yet, each one deletes its own FreeRTOS task
+    int running_workers_ = 0;
+#endif
 
-    void BackgroundTaskLoop();
+    static uintptr_t CurrentCaller();
+    bool SerialRunning(uintptr_t caller) const;
+    bool TakeTask(int index, Task& task);
+    void BackgroundTaskLoop(int index);
 };
 
 #endif
@@ -135,6 +135,9 @@ private:
         boot_button_.OnClick([this]() {
             Application::GetInstance().ToggleChatState();
         });
+        boot_button_.OnDoubleClick([this]() {
+            Application::GetInstance().DumpTaskStats();
+        });
 
         speak_button_.OnPressDown([this](){
             Application::GetInstance().StartListening();
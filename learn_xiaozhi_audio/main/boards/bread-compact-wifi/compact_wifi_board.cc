@@ -1,5 +1,13 @@
 #include "board.h"
 #include "audio_codecs/no_audio_codec.h"
+#if CONFIG_USE_WAV_AUDIO_CODEC
+#include "audio_codecs/wav_audio_codec.h"
+#endif
+#if CONFIG_WAV_AUDIO_SD_CARD
+#include <esp_vfs_fat.h>
+#include <sdmmc_cmd.h>
+#include <driver/sdspi_host.h>
+#endif
 #include "display/oled_display.h"
 #include "system_reset.h"
 #include "application.h"
@@ -99,6 +107,9 @@ private:
         boot_button_.OnClick([this]() {
             Application::GetInstance().ToggleChatState();;
         });
+        boot_button_.OnDoubleClick([this]() {
+            Application::GetInstance().DumpTaskStats();
+        });
         
         #if defined(CONFIG_IDF_TARGET_ESP32S3)
         //no touch_button_ is connected, reuse the volume_up_button_
@@ -148,6 +159,42 @@ private:
         });
     }
 
+#if CONFIG_WAV_AUDIO_SD_CARD
+    // Mounts the card holding the WAV files at /sdcard
+    bool MountSdCard() {
+        sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+        spi_bus_config_t bus_config = {};
+        bus_config.mosi_io_num = CONFIG_WAV_AUDIO_SD_MOSI;
+        bus_config.miso_io_num = CONFIG_WAV_AUDIO_SD_MISO;
+        bus_config.sclk_io_num = CONFIG_WAV_AUDIO_SD_SCLK;
+        bus_config.quadwp_io_num = -1;
+        bus_config.quadhd_io_num = -1;
+        bus_config.max_transfer_sz = 4000;
+        esp_err_t ret = spi_bus_initialize((spi_host_device_t)host.slot, &bus_config, SDSPI_DEFAULT_DMA);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to initialize the SD card bus: %s", esp_err_to_name(ret));
+            return false;
+        }
+
+        sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+        slot_config.gpio_cs = (gpio_num_t)CONFIG_WAV_AUDIO_SD_CS;
+        slot_config.host_id = (spi_host_device_t)host.slot;
+        esp_vfs_fat_sdmmc_mount_config_t mount_config = {};
+        mount_config.format_if_mount_failed = false;
+        mount_config.max_files = 4;
+        mount_config.allocation_unit_size = 16 * 1024;
+        sdmmc_card_t* card;
+        ret = esp_vfs_fat_sdspi_mount("/sdcard", &host, &slot_config, &mount_config, &card);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to mount the SD card: %s", esp_err_to_name(ret));
+            spi_bus_free((spi_host_device_t)host.slot);
+            return false;
+        }
+        sdmmc_card_print_info(stdout, card);
+        return true;
+    }
+#endif
+
 public:
     CompactWifiBoard() :
         boot_button_(BOOT_BUTTON_GPIO),
@@ -165,12 +212,23 @@ public:
     }
 
     virtual AudioCodec* GetAudioCodec() override {
-#ifdef AUDIO_I2S_METHOD_SIMPLEX
+#if CONFIG_USE_WAV_AUDIO_CODEC
+#if CONFIG_WAV_AUDIO_SD_CARD
+        // The codec opens the files when it is constructed
+        static bool sd_card_mounted = MountSdCard();
+        (void)sd_card_mounted;
+#endif
+        static WavAudioCodec audio_codec(CONFIG_WAV_AUDIO_INPUT_PATH, CONFIG_WAV_AUDIO_OUTPUT_PATH);
+#elif defined(AUDIO_I2S_METHOD_SIMPLEX)
         static NoAudioCodecSimplex audio_codec(AUDIO_INPUT_SAMPLE_RATE, AUDIO_OUTPUT_SAMPLE_RATE,
             AUDIO_I2S_SPK_GPIO_BCLK, AUDIO_I2S_SPK_GPIO_LRCK, AUDIO_I2S_SPK_GPIO_DOUT, AUDIO_I2S_MIC_GPIO_SCK, AUDIO_I2S_MIC_GPIO_WS, AUDIO_I2S_MIC_GPIO_DIN);
 #else
         static NoAudioCodecDuplex audio_codec(AUDIO_INPUT_SAMPLE_RATE, AUDIO_OUTPUT_SAMPLE_RATE,
             AUDIO_I2S_GPIO_BCLK, AUDIO_I2S_GPIO_WS, AUDIO_I2S_GPIO_DOUT, AUDIO_I2S_GPIO_DIN);
+#endif
+#if CONFIG_USE_AUDIO_REFERENCE && !CONFIG_USE_WAV_AUDIO_CODEC
+        static bool reference_enabled = audio_codec.EnableInputReference();
+        (void)reference_enabled;
 #endif
         return &audio_codec;
     }
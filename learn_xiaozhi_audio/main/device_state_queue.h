@@ -0,0 +1,131 @@
+#ifndef DEVICE_STATE_QUEUE_H
+#define DEVICE_STATE_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+#include "device_state.h"
+#include "task_queue.h"
+
+// Device state requests from any task, run as transitions one at a time by a single
+// consumer, the main loop. A transition starts with one action of its own, the owner adds
+// one for every side effect it waits for, and the next request only starts once all of
+// them have completed.
+class DeviceStateQueue {
+public:
+    struct Request {
+        DeviceState state = kDeviceStateUnknown;
+        int64_t request_time = 0;
+    };
+
+    enum Next {
+        // Nothing queued, or a transition is still running
+        kNextNone,
+        kNextStart,
+        // Not an edge of the state table, counted in illegal()
+        kNextRejected,
+    };
+
+    // Any task; false when the queue is full
+    bool Push(DeviceState state, int64_t request_time) {
+        return requests_.Push(Request{state, request_time});
+    }
+
+    // Main loop: pops the next request for a state other than current, ready to Begin()
+    template <typename T, size_t N>
+    Next Pop(const DeviceStateInfo<T> (&table)[N], DeviceState current, Request& request) {
+        while (!running_ && requests_.Pop(request)) {
+            if (request.state == current) {
+                continue;
+            }
+            if (!IsDeviceStateTransitionAllowed(table, current, request.state)) {
+                illegal_++;
+                return kNextRejected;
+            }
+            return kNextStart;
+        }
+        return kNextNone;
+    }
+
+    // Main loop: the transition of request from the state from starts with one action
+    void Begin(const Request& request, DeviceState from, int64_t now) {
+        assert(!running_);
+        running_ = true;
+        request_ = request;
+        from_ = from;
+        start_time_ = now;
+        actions_ = 1;
+    }
+
+    // Main loop, while the transition runs
+    void AddAction() {
+        assert(running_);
+        actions_++;
+    }
+
+    // Main loop; returns true when this was the last action and the transition is over
+    bool CompleteAction() {
+        // An action completing twice or outside a transition would let the next one start early
+        assert(running_ && actions_ > 0);
+        if (--actions_ > 0) {
+            return false;
+        }
+        running_ = false;
+        return true;
+    }
+
+    inline bool running() const { return running_; }
+    // The running or last transition
+    inline const Request& request() const { return request_; }
+    inline DeviceState from() const { return from_; }
+    inline int64_t start_time() const { return start_time_; }
+    inline uint32_t illegal() const { return illegal_.load(std::memory_order_relaxed); }
+    // Counts a request refused before it was queued
+    inline void CountIllegal() { illegal_++; }
+
+private:
+    TaskQueue<Request, 8> requests_;
+    // Everything below but illegal_ is only touched by the main loop
+    bool running_ = false;
+    Request request_;
+    DeviceState from_ = kDeviceStateUnknown;
+    int64_t start_time_ = 0;
+    int actions_ = 0;
+    std::atomic<uint32_t> illegal_{0};
+};
+
+// A transition action waiting for the speaker to play out, ended once by whichever comes
+// first: the codec reporting the drain or the timeout. A timeout left over from an earlier
+// wait does not end a newer one.
+class OutputDrainWait {
+public:
+    // Main loop
+    void Start(int64_t now) {
+        start_time_.store(now, std::memory_order_relaxed);
+        waiting_.store(true, std::memory_order_release);
+    }
+
+    // Any task; true for the call that ended the wait
+    bool Drained() {
+        return waiting_.exchange(false, std::memory_order_acq_rel);
+    }
+
+    // Any task; true when the wait had lasted timeout_us and this call ended it
+    bool Expired(int64_t now, int64_t timeout_us) {
+        if (!waiting_.load(std::memory_order_acquire) ||
+            now - start_time_.load(std::memory_order_relaxed) < timeout_us) {
+            return false;
+        }
+        return waiting_.exchange(false, std::memory_order_acq_rel);
+    }
+
+    inline bool waiting() const { return waiting_.load(std::memory_order_acquire); }
+    inline int64_t start_time() const { return start_time_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> waiting_{false};
+    std::atomic<int64_t> start_time_{0};
+};
+
+#endif // DEVICE_STATE_QUEUE_H
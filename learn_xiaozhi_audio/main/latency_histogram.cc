@@ -0,0 +1,40 @@
+#include "latency_histogram.h"
+
+#include <esp_log.h>
+#include <cinttypes>
+#include <cstdio>
+
+// Upper bounds of all buckets but the last one
+static const int64_t kBucketLimitsUs[LatencyHistogram::kBucketCount - 1] = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000
+};
+
+void LatencyHistogram::Record(int64_t us) {
+    if (us < 0) {
+        us = -us;
+    }
+    int bucket = 0;
+    while (bucket < kBucketCount - 1 && us >= kBucketLimitsUs[bucket]) {
+        bucket++;
+    }
+    buckets_[bucket]++;
+    count_++;
+    total_us_ += us;
+    if (us > max_us_) {
+        max_us_ = us;
+    }
+}
+
+void LatencyHistogram::Reset() {
+    *this = LatencyHistogram();
+}
+
+void LatencyHistogram::Print(const char* tag, const char* name) const {
+    char line[128];
+    int length = 0;
+    for (int i = 0; i < kBucketCount && length < (int)sizeof(line); i++) {
+        length += snprintf(line + length, sizeof(line) - length, " %lu", (unsigned long)buckets_[i]);
+    }
+    ESP_LOGI(tag, "%s: count %lu avg %" PRId64 " us max %" PRId64 " us, <0.5/1/2/5/10/20/50/50+ ms:%s",
+        name, (unsigned long)count_, average_us(), max_us_, line);
+}
@@ -0,0 +1,26 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+
+// Fixed-bucket histogram of durations in microseconds, no allocation
+class LatencyHistogram {
+public:
+    static constexpr int kBucketCount = 8;
+
+    void Record(int64_t us);
+    void Reset();
+    void Print(const char* tag, const char* name) const;
+
+    inline uint32_t count() const { return count_; }
+    inline int64_t max_us() const { return max_us_; }
+    inline int64_t average_us() const { return count_ ? total_us_ / count_ : 0; }
+
+private:
+    uint32_t buckets_[kBucketCount] = {};
+    uint32_t count_ = 0;
+    int64_t total_us_ = 0;
+    int64_t max_us_ = 0;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,137 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+// Fixed-capacity single-producer/single-consumer ring buffer.
+// The storage is allocated once, in PSRAM when available. The producer only moves
+// write_pos_ and the consumer only moves read_pos_, so no lock is needed.
+// Positions run over [0, 2 * capacity) so that a full and an empty buffer differ
+// without a spare slot and without a modulo on the hot path.
+template <typename T>
+class SpscRingBuffer {
+public:
+    explicit SpscRingBuffer(size_t capacity) : capacity_(capacity) {
+        buffer_ = (T*)heap_caps_malloc(capacity_ * sizeof(T), MALLOC_CAP_SPIRAM);
+        if (buffer_ == nullptr) {
+            buffer_ = (T*)heap_caps_malloc(capacity_ * sizeof(T), MALLOC_CAP_8BIT);
+        }
+        if (buffer_ == nullptr) {
+            ESP_LOGE("SpscRingBuffer", "Failed to allocate %zu elements", capacity_);
+            capacity_ = 0;
+        }
+    }
+
+    ~SpscRingBuffer() {
+        heap_caps_free(buffer_);
+    }
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    inline size_t capacity() const { return capacity_; }
+    inline size_t Available() const {
+        return Distance(read_pos_.load(std::memory_order_acquire), write_pos_.load(std::memory_order_acquire));
+    }
+    inline size_t Free() const { return capacity_ - Available(); }
+    // Number of Write() calls that could not store all of their data
+    inline uint32_t overruns() const { return overruns_.load(std::memory_order_relaxed); }
+    // Number of Read() calls that got less than they asked for
+    inline uint32_t underruns() const { return underruns_.load(std::memory_order_relaxed); }
+    // Elements dropped by overruns
+    inline uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Producer: copy as much as fits, the rest is dropped and counted as an overrun
+    size_t Write(const T* data, size_t count) {
+        size_t written = 0;
+        while (written < count) {
+            T* span;
+            size_t n = std::min(GetWriteSpan(&span), count - written);
+            if (n == 0) {
+                break;
+            }
+            memcpy(span, data + written, n * sizeof(T));
+            CommitWrite(n);
+            written += n;
+        }
+        if (written < count) {
+            overruns_.fetch_add(1, std::memory_order_relaxed);
+            dropped_.fetch_add(count - written, std::memory_order_relaxed);
+        }
+        return written;
+    }
+
+    // Consumer: copy up to count elements, a short read is counted as an underrun
+    size_t Read(T* data, size_t count) {
+        size_t read = 0;
+        while (read < count) {
+            const T* span;
+            size_t n = std::min(GetReadSpan(&span), count - read);
+            if (n == 0) {
+                break;
+            }
+            memcpy(data + read, span, n * sizeof(T));
+            CommitRead(n);
+            read += n;
+        }
+        if (read < count) {
+            underruns_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return read;
+    }
+
+    // Producer: contiguous free space starting at *data, fill it and call CommitWrite()
+    size_t GetWriteSpan(T** data) {
+        size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+        size_t free = capacity_ - Distance(read_pos_.load(std::memory_order_acquire), write_pos);
+        size_t index = Index(write_pos);
+        *data = buffer_ + index;
+        return std::min(free, capacity_ - index);
+    }
+
+    void CommitWrite(size_t count) {
+        write_pos_.store(Advance(write_pos_.load(std::memory_order_relaxed), count), std::memory_order_release);
+    }
+
+    // Consumer: contiguous readable data starting at *data, release it with CommitRead()
+    size_t GetReadSpan(const T** data) {
+        size_t read_pos = read_pos_.load(std::memory_order_relaxed);
+        size_t available = Distance(read_pos, write_pos_.load(std::memory_order_acquire));
+        size_t index = Index(read_pos);
+        *data = buffer_ + index;
+        return std::min(available, capacity_ - index);
+    }
+
+    void CommitRead(size_t count) {
+        read_pos_.store(Advance(read_pos_.load(std::memory_order_relaxed), count), std::memory_order_release);
+    }
+
+    // Consumer: discard everything that has been written so far
+    void Clear() {
+        read_pos_.store(write_pos_.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    T* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    // Producer and consumer positions live on separate cache lines
+    alignas(64) std::atomic<size_t> write_pos_{0};
+    alignas(64) std::atomic<size_t> read_pos_{0};
+    alignas(64) std::atomic<uint32_t> overruns_{0};
+    std::atomic<uint32_t> underruns_{0};
+    std::atomic<uint32_t> dropped_{0};
+
+    inline size_t Index(size_t pos) const { return pos < capacity_ ? pos : pos - capacity_; }
+    inline size_t Distance(size_t from, size_t to) const { return to >= from ? to - from : to + 2 * capacity_ - from; }
+    inline size_t Advance(size_t pos, size_t count) const {
+        pos += count;
+        return pos >= 2 * capacity_ ? pos - 2 * capacity_ : pos;
+    }
+};
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,196 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only callable with inline storage for small captures. Larger ones go to a fixed
+// pool of blocks, and only when that is used up to the heap, which is counted.
+class InlineTask {
+public:
+    static constexpr size_t kInlineSize = 48;
+    static constexpr size_t kPoolBlockSize = 128;
+    static constexpr int kPoolBlocks = 16;
+
+    // Stored inline, and copied and destroyed without running any code: queueing such a
+    // callable from an ISR neither allocates nor frees
+    template <typename T>
+    static constexpr bool kIsrSafe = sizeof(T) <= kInlineSize && alignof(T) <= alignof(std::max_align_t) &&
+        std::is_trivially_copyable_v<T>;
+
+    InlineTask() = default;
+    ~InlineTask() { Reset(); }
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineTask>>>
+    InlineTask(F&& callable) {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= kInlineSize && alignof(T) <= alignof(std::max_align_t) &&
+                std::is_nothrow_move_constructible_v<T>) {
+            new (storage_) T(std::forward<F>(callable));
+            ops_ = InlineOps<T>();
+        } else {
+            void* block = sizeof(T) <= kPoolBlockSize ? AcquireBlock() : nullptr;
+            if (block == nullptr) {
+                heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+                block = ::operator new(sizeof(T));
+            }
+            new (block) T(std::forward<F>(callable));
+            *reinterpret_cast<void**>(storage_) = block;
+            ops_ = BoxedOps<T>();
+        }
+    }
+
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator=(const InlineTask&) = delete;
+
+    InlineTask(InlineTask&& other) noexcept { *this = std::move(other); }
+    InlineTask& operator=(InlineTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            if (other.ops_ != nullptr) {
+                other.ops_->move(storage_, other.storage_);
+                ops_ = std::exchange(other.ops_, nullptr);
+            }
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->invoke(storage_); }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    // Captures that did not fit inline or in the pool, should stay 0
+    static uint32_t heap_allocations() { return heap_allocations_.load(std::memory_order_relaxed); }
+    // Pool blocks in use right now
+    static int pooled() { return kPoolBlocks - __builtin_popcount(pool_free_.load(std::memory_order_relaxed)); }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Moves the callable from src to dst storage and destroys the source
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename T>
+    static const Ops* InlineOps() {
+        static constexpr Ops ops = {
+            [](void* s) { (*static_cast<T*>(s))(); },
+            [](void* d, void* s) { new (d) T(std::move(*static_cast<T*>(s))); static_cast<T*>(s)->~T(); },
+            [](void* s) { static_cast<T*>(s)->~T(); },
+        };
+        return &ops;
+    }
+
+    template <typename T>
+    static const Ops* BoxedOps() {
+        static constexpr Ops ops = {
+            [](void* s) { (**static_cast<T**>(s))(); },
+            [](void* d, void* s) { *static_cast<T**>(d) = *static_cast<T**>(s); },
+            [](void* s) { T* target = *static_cast<T**>(s); target->~T(); ReleaseBlock(target); },
+        };
+        return &ops;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_ = nullptr;
+
+    alignas(std::max_align_t) static inline unsigned char pool_[kPoolBlocks][kPoolBlockSize];
+    static inline std::atomic<uint32_t> pool_free_{(1u << kPoolBlocks) - 1};
+    static inline std::atomic<uint32_t> heap_allocations_{0};
+
+    static void* AcquireBlock() {
+        uint32_t mask = pool_free_.load(std::memory_order_acquire);
+        while (mask != 0) {
+            int index = __builtin_ctz(mask);
+            if (pool_free_.compare_exchange_weak(mask, mask & ~(1u << index), std::memory_order_acquire)) {
+                return pool_[index];
+            }
+        }
+        return nullptr;
+    }
+
+    static void ReleaseBlock(void* block) {
+        auto bytes = static_cast<unsigned char*>(block);
+        if (bytes >= pool_[0] && bytes < pool_[0] + sizeof(pool_)) {
+            int index = (bytes - pool_[0]) / kPoolBlockSize;
+            pool_free_.fetch_or(1u << index, std::memory_order_release);
+        } else {
+            ::operator delete(block);
+        }
+    }
+};
+
+// Bounded lock-free queue for many producers and one consumer (Vyukov's array queue).
+// Push never blocks or allocates, so it can be called from timers and ISRs; it fails when full.
+template <typename T, size_t N>
+class TaskQueue {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    TaskQueue() {
+        for (size_t i = 0; i < N; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    bool Push(T&& item) {
+        size_t position = enqueue_position_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[position & (N - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+            if (diff == 0) {
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = std::move(item);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side only
+    bool Pop(T& item) {
+        Cell* cell = &cells_[dequeue_position_ & (N - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        if ((intptr_t)sequence - (intptr_t)(dequeue_position_ + 1) < 0) {
+            return false;
+        }
+        item = std::move(cell->item);
+        cell->sequence.store(dequeue_position_ + N, std::memory_order_release);
+        dequeue_position_++;
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    Cell cells_[N];
+    std::atomic<size_t> enqueue_position_{0};
+    size_t dequeue_position_ = 0;
+};
+
+#endif // TASK_QUEUE_H
@@ -5,6 +5,7 @@
 #include "font_awesome_symbols.h"
 #include "assets/lang_config.h"
 
+#include <cinttypes>
 #include <cstring>
 #include <esp_log.h>
 #include <cJSON.h>
@@ -15,18 +16,45 @@
 #define TAG "Application"
 
 
-static const char* const STATE_STRINGS[] = {
-    "unknown",
-    "starting",
-    "configuring",
-    "idle",
-    "connecting",
-    "listening",
-    "speaking",
-    "upgrading",
-    "activating",
-    "fatal_error",
-    "invalid_state"
+constexpr DeviceStateInfo<Application> Application::kDeviceStates[] = {
+    {kDeviceStateUnknown, DeviceStateMask(kDeviceStateStarting), nullptr, nullptr},
+    {kDeviceStateStarting, DeviceStateMask(kDeviceStateWifiConfiguring, kDeviceStateActivating, kDeviceStateIdle,
+        kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateWifiConfiguring, DeviceStateMask(kDeviceStateActivating, kDeviceStateIdle, kDeviceStateFatalError),
+        nullptr, nullptr},
+    {kDeviceStateIdle, DeviceStateMask(kDeviceStateWifiConfiguring, kDeviceStateConnecting, kDeviceStateListening,
+        kDeviceStateSpeaking, kDeviceStateUpgrading, kDeviceStateActivating, kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateConnecting, DeviceStateMask(kDeviceStateIdle, kDeviceStateListening, kDeviceStateSpeaking,
+        kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateListening, DeviceStateMask(kDeviceStateIdle, kDeviceStateSpeaking, kDeviceStateFatalError),
+        nullptr, nullptr},
+    {kDeviceStateSpeaking, DeviceStateMask(kDeviceStateIdle, kDeviceStateListening, kDeviceStateFatalError),
+        nullptr, nullptr},
+    {kDeviceStateUpgrading, DeviceStateMask(kDeviceStateIdle, kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateActivating, DeviceStateMask(kDeviceStateWifiConfiguring, kDeviceStateIdle, kDeviceStateListening,
+        kDeviceStateUpgrading, kDeviceStateFatalError), nullptr, nullptr},
+    {kDeviceStateFatalError, DeviceStateMask(), nullptr, nullptr},
+};
+
+struct StateIndicator {
+    // nullptr leaves the display as it is
+    const char* status;
+    const char* emotion;
+    const char* role;
+    const char* message;
+};
+
+static constexpr StateIndicator kStateIndicators[kDeviceStateCount] = {
+    {Lang::Strings::STANDBY, "neutral", "system", "待命中..."},                           // unknown
+    {nullptr, nullptr, nullptr, nullptr},                                                // starting
+    {nullptr, nullptr, nullptr, nullptr},                                                // configuring
+    {Lang::Strings::STANDBY, "neutral", "system", "待命中..."},                           // idle
+    {Lang::Strings::CONNECTING, "neutral", "system", ""},                                 // connecting
+    {Lang::Strings::LISTENING, "loving", "user", "Display Demo: 聆听用户说话..."},          // listening
+    {Lang::Strings::SPEAKING, "laughing", "assistant", "Display Demo: 正在和用户说话..."},   // speaking
+    {nullptr, nullptr, nullptr, nullptr},                                                // upgrading
+    {nullptr, nullptr, nullptr, nullptr},                                                // activating
+    {nullptr, nullptr, nullptr, nullptr},                                                // fatal_error
 };
 
 Application::Application() {
@@ -173,54 +201,44 @@ void Application::MainLoop() {
 
 
 void Application::SetDeviceState(DeviceState state) {
+    static_assert(IsValidDeviceStateTable(kDeviceStates), "kDeviceStates needs one row per state in enum order");
     if (device_state_ == state) {
         return;
     }
+    if (!IsDeviceStateTransitionAllowed(kDeviceStates, device_state_, state)) {
+        illegal_transitions_++;
+        ESP_LOGW(TAG, "Illegal transition %s -> %s rejected (%" PRIu32 " so far)", DeviceStateName(device_state_),
+            DeviceStateName(state), illegal_transitions_.load());
+        return;
+    }
     
     clock_ticks_ = 0;
     auto previous_state = device_state_;
+    if (auto on_exit = kDeviceStates[previous_state].on_exit) {
+        (this->*on_exit)(state);
+    }
     device_state_ = state;
-    ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+    ESP_LOGI(TAG, "STATE: %s", DeviceStateName(device_state_));
+    // Nothing runs on the background task or plays audio in this demo, so there is nothing to
+    // wait for before the indicators change
+    UpdateStateIndicators();
+    if (auto on_enter = kDeviceStates[state].on_enter) {
+        (this->*on_enter)(previous_state);
+    }
+}
 
+void Application::UpdateStateIndicators() {
     auto& board = Board::GetInstance();
-    auto display = board.GetDisplay();
-    auto led = board.GetLed();
-    led->OnStateChanged();
-    switch (state) {
-        case kDeviceStateUnknown:
-        case kDeviceStateIdle:
-            display->SetStatus(Lang::Strings::STANDBY);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "待命中...");
-            break;
-        case kDeviceStateConnecting:
-            display->SetStatus(Lang::Strings::CONNECTING);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "");
-            break;
-        case kDeviceStateListening:
-            display->SetStatus(Lang::Strings::LISTENING);
-            display->SetEmotion("loving");
-            display->SetChatMessage("user", "Display Demo: 聆听用户说话...");
-            if (previous_state == kDeviceStateSpeaking) {
-                // FIXME: Wait for the speaker to empty the buffer
-                vTaskDelay(pdMS_TO_TICKS(120));
-            }
-            break;
-        case kDeviceStateSpeaking:
-            display->SetStatus(Lang::Strings::SPEAKING);
-            display->SetEmotion("laughing");
-            display->SetChatMessage("assistant", "Display Demo: 正在和用户说话...");
-            break;
-        default:
-            // Do nothing
-            break;
+    board.GetLed()->OnStateChanged();
+    auto& indicator = kStateIndicators[device_state_];
+    if (indicator.status != nullptr) {
+        auto display = board.GetDisplay();
+        display->SetStatus(indicator.status);
+        display->SetEmotion(indicator.emotion);
+        display->SetChatMessage(indicator.role, indicator.message);
     }
 }
 
-
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
     esp_restart();
@@ -9,21 +9,10 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <atomic>
 
 #include "background_task.h"
-
-enum DeviceState {
-    kDeviceStateUnknown,
-    kDeviceStateStarting,
-    kDeviceStateWifiConfiguring,
-    kDeviceStateIdle,
-    kDeviceStateConnecting,
-    kDeviceStateListening,
-    kDeviceStateSpeaking,
-    kDeviceStateUpgrading,
-    kDeviceStateActivating,
-    kDeviceStateFatalError
-};
+#include "device_state.h"
 
 #define SCHEDULE_EVENT (1 << 0)
 #define AUDIO_INPUT_READY_EVENT (1 << 1)
@@ -70,8 +59,13 @@ private:
 
     BackgroundTask* background_task_ = nullptr;
 
+    // Allowed edges and entry/exit actions, one row per state in enum order
+    static const DeviceStateInfo<Application> kDeviceStates[kDeviceStateCount];
+    std::atomic<uint32_t> illegal_transitions_{0};
+
     void MainLoop();
     void OnClockTimer();
+    void UpdateStateIndicators();
 };
 
 
@@ -0,0 +1,81 @@
+#ifndef DEVICE_STATE_H
+#define DEVICE_STATE_H
+
+#include <cstddef>
+#include <cstdint>
+
+enum DeviceState {
+    kDeviceStateUnknown,
+    kDeviceStateStarting,
+    kDeviceStateWifiConfiguring,
+    kDeviceStateIdle,
+    kDeviceStateConnecting,
+    kDeviceStateListening,
+    kDeviceStateSpeaking,
+    kDeviceStateUpgrading,
+    kDeviceStateActivating,
+    kDeviceStateFatalError
+};
+
+constexpr int kDeviceStateCount = kDeviceStateFatalError + 1;
+
+constexpr uint32_t DeviceStateMask() { return 0; }
+
+template <typename... States>
+constexpr uint32_t DeviceStateMask(DeviceState state, States... states) {
+    return (1u << state) | DeviceStateMask(states...);
+}
+
+constexpr const char* kDeviceStateNames[kDeviceStateCount] = {
+    "unknown",
+    "starting",
+    "configuring",
+    "idle",
+    "connecting",
+    "listening",
+    "speaking",
+    "upgrading",
+    "activating",
+    "fatal_error",
+};
+
+// Bounds checked, also for values cast from integers
+constexpr const char* DeviceStateName(int state) {
+    return state >= 0 && state < kDeviceStateCount ? kDeviceStateNames[state] : "invalid_state";
+}
+
+// One row of a state table, listed in enum order. The actions are member functions
+// of the owner T, nullptr when there is nothing to do.
+template <typename T>
+struct DeviceStateInfo {
+    DeviceState state;
+    // DeviceStateMask() of the states this one may change to
+    uint32_t next_states;
+    void (T::*on_exit)(DeviceState next);
+    void (T::*on_enter)(DeviceState previous);
+};
+
+// For static_assert: every state has its row in enum order and a name, and the edges
+// only lead to other, valid states
+template <typename T, size_t N>
+constexpr bool IsValidDeviceStateTable(const DeviceStateInfo<T> (&table)[N]) {
+    if (N != kDeviceStateCount) {
+        return false;
+    }
+    for (size_t i = 0; i < N; i++) {
+        if (table[i].state != (DeviceState)i || kDeviceStateNames[i] == nullptr) {
+            return false;
+        }
+        if ((table[i].next_states >> kDeviceStateCount) != 0 || (table[i].next_states & (1u << i)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T, size_t N>
+constexpr bool IsDeviceStateTransitionAllowed(const DeviceStateInfo<T> (&table)[N], int from, int to) {
+    return from >= 0 && from < (int)N && to >= 0 && to < (int)N && (table[from].next_states & (1u << to)) != 0;
+}
+
+#endif // DEVICE_STATE_H
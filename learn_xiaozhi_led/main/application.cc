@@ -1,4 +1,5 @@
 #include "application.h"
+#include <cinttypes>
 #include <cstring>
 #include <esp_log.h>
 
@@ -11,6 +12,20 @@
 #define LED_SINGLE_PIN GPIO_NUM_41
 #endif
 
+// The demo walks through every state but unknown, starting -> configuring -> ... -> activating -> starting
+constexpr DeviceStateInfo<Application> Application::kDeviceStates[] = {
+    {kDeviceStateUnknown, DeviceStateMask(kDeviceStateStarting), nullptr, nullptr},
+    {kDeviceStateStarting, DeviceStateMask(kDeviceStateWifiConfiguring), nullptr, nullptr},
+    {kDeviceStateWifiConfiguring, DeviceStateMask(kDeviceStateIdle), nullptr, nullptr},
+    {kDeviceStateIdle, DeviceStateMask(kDeviceStateConnecting), nullptr, nullptr},
+    {kDeviceStateConnecting, DeviceStateMask(kDeviceStateListening), nullptr, nullptr},
+    {kDeviceStateListening, DeviceStateMask(kDeviceStateSpeaking), nullptr, nullptr},
+    {kDeviceStateSpeaking, DeviceStateMask(kDeviceStateUpgrading), nullptr, nullptr},
+    {kDeviceStateUpgrading, DeviceStateMask(kDeviceStateActivating), nullptr, nullptr},
+    {kDeviceStateActivating, DeviceStateMask(kDeviceStateStarting), nullptr, nullptr},
+    {kDeviceStateFatalError, DeviceStateMask(), nullptr, nullptr},
+};
+
 Application::Application() {
     //event_group_ = xEventGroupCreate();
     //background_task_ = new BackgroundTask(4096 * 8);
@@ -59,16 +74,37 @@ void Application::Start() {
 // they should use Schedule to call this function
 void Application::MainLoop() {
     while (true) {
-        if(++state_count_ > 8) state_count_ = 1;
-        device_state_ = DeviceState(state_count_);
-        GetLed()->OnStateChanged();
-        GetGpioLed()->OnStateChanged();
-        ESP_LOGI(TAG, "State change to %s (%d).", stateName(device_state_), state_count_);
+        // Unknown and fatal error are left out of the cycle
+        auto next = device_state_ == kDeviceStateActivating || device_state_ == kDeviceStateUnknown ?
+            kDeviceStateStarting : DeviceState(device_state_ + 1);
+        SetDeviceState(next);
         //Software delay just for test
         vTaskDelay(5000 / portTICK_PERIOD_MS);
     }
 }
 
+bool Application::SetDeviceState(DeviceState state) {
+    static_assert(IsValidDeviceStateTable(kDeviceStates), "kDeviceStates needs one row per state in enum order");
+    if (!IsDeviceStateTransitionAllowed(kDeviceStates, device_state_, state)) {
+        illegal_transitions_++;
+        ESP_LOGW(TAG, "Illegal transition %s -> %s rejected (%" PRIu32 " so far)", DeviceStateName(device_state_),
+            DeviceStateName(state), illegal_transitions_.load());
+        return false;
+    }
+    auto previous_state = device_state_;
+    if (auto on_exit = kDeviceStates[previous_state].on_exit) {
+        (this->*on_exit)(state);
+    }
+    device_state_ = state;
+    if (auto on_enter = kDeviceStates[state].on_enter) {
+        (this->*on_enter)(previous_state);
+    }
+    GetLed()->OnStateChanged();
+    GetGpioLed()->OnStateChanged();
+    ESP_LOGI(TAG, "State change to %s (%d).", DeviceStateName(device_state_), device_state_);
+    return true;
+}
+
 SingleLed* Application::GetLed(){
     static SingleLed led(LED_WS2812_PIN);
     return &led;
@@ -80,34 +116,6 @@ GpioLed * Application::GetGpioLed(){
 }
 
 
-const char * Application::stateName(DeviceState state){
-    switch(state){
-        case kDeviceStateUnknown:
-            return "kDeviceStateUnknown";
-        case kDeviceStateStarting:
-            return "kDeviceStateStarting";
-        case kDeviceStateWifiConfiguring:
-            return "kDeviceStateWifiConfiguring";
-        case kDeviceStateIdle:
-            return "kDeviceStateIdle";
-        case kDeviceStateConnecting:
-            return "kDeviceStateConnecting";
-        case kDeviceStateListening:
-            return "kDeviceStateListening";
-        case kDeviceStateSpeaking:
-            return "kDeviceStateSpeaking";
-        case kDeviceStateUpgrading:
-            return "kDeviceStateUpgrading";
-        case kDeviceStateActivating:
-            return "kDeviceStateActivating";
-        case kDeviceStateFatalError:
-            return "kDeviceStateFatalError";
-        default:
-            return "Invalid_kDeviceState";
-    }
-}
-
-
 void Application::OnClockTimer() {
     clock_ticks_++;
 
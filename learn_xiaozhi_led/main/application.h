@@ -9,22 +9,11 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <atomic>
 
 #include "single_led.h"
 #include "gpio_led.h"
-
-enum DeviceState {
-    kDeviceStateUnknown,
-    kDeviceStateStarting,
-    kDeviceStateWifiConfiguring,
-    kDeviceStateIdle,
-    kDeviceStateConnecting,
-    kDeviceStateListening,
-    kDeviceStateSpeaking,
-    kDeviceStateUpgrading,
-    kDeviceStateActivating,
-    kDeviceStateFatalError
-};
+#include "device_state.h"
 
 class Application {
 public:
@@ -45,7 +34,9 @@ private:
     ~Application();
 
     volatile DeviceState device_state_ = kDeviceStateUnknown;
-    int state_count_ = 0;
+    // Allowed edges of the demo cycle, one row per state in enum order
+    static const DeviceStateInfo<Application> kDeviceStates[kDeviceStateCount];
+    std::atomic<uint32_t> illegal_transitions_{0};
     bool voice_detected_ = false;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
@@ -56,7 +47,7 @@ private:
     SingleLed* GetLed(); 
     GpioLed * GetGpioLed();
 
-    const char * stateName(DeviceState state);
+    bool SetDeviceState(DeviceState state);
 
     void OnClockTimer();
 